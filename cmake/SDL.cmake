@@ -0,0 +1,20 @@
+# Simple Directmedia Layer, shared by the app, the unit tests and the benchmark through the SDL target
+# the bundled SDL2.lib only links on Windows, elsewhere the installed SDL2 is used
+set(SDL_DIR "${CMAKE_SOURCE_DIR}/project/libs/SDL2-2.30.3")
+
+if(WIN32)
+    add_library(SDL STATIC IMPORTED)
+    set_target_properties(SDL PROPERTIES
+        IMPORTED_LOCATION "${SDL_DIR}/lib/SDL2.lib"
+        INTERFACE_INCLUDE_DIRECTORIES "${SDL_DIR}/include"
+    )
+else()
+    find_package(SDL2 REQUIRED)
+    add_library(SDL INTERFACE)
+    if(TARGET SDL2::SDL2)
+        target_link_libraries(SDL INTERFACE SDL2::SDL2)
+    else()
+        target_include_directories(SDL INTERFACE ${SDL2_INCLUDE_DIRS})
+        target_link_libraries(SDL INTERFACE ${SDL2_LIBRARIES})
+    endif()
+endif()
@@ -0,0 +1,414 @@
+//Standard includes
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Project includes
+#include "../src/Renderer.h"
+#include "../src/Scene.h"
+#include "../src/Timer.h"
+
+using namespace dae;
+
+struct Resolution
+{
+	uint32_t width{};
+	uint32_t height{};
+};
+
+struct BenchmarkOptions
+{
+	bool showHelp{ false };
+	std::vector<std::string> sceneNames{ "w1", "w2", "w3", "w3_test", "w4_test", "reference", "bunny", "instances" };
+	std::vector<Resolution> resolutions{ { 320, 240 }, { 640, 480 }, { 1280, 720 } };
+	std::vector<uint32_t> threadCounts{ 1, 0 };
+	uint32_t frameCount{ 30 };
+	uint32_t warmupFrameCount{ 3 };
+	uint32_t samplesPerPixel{ 1 };
+	uint32_t tileSize{ 32 };
+	uint32_t interleaveFactor{ 1 };
+	std::string label{};
+	std::string outputPath{ "benchmark" };
+};
+
+//One scene, resolution and thread count
+struct BenchmarkResult
+{
+	std::string sceneName{};
+	Resolution resolution{};
+	uint32_t threadCount{};
+	std::vector<double> frameMilliseconds{};
+	uint64_t primaryRayCount{};
+	uint64_t shadowRayCount{};
+};
+
+struct FrameTimeSummary
+{
+	double mean{};
+	double min{};
+	double max{};
+	double p50{};
+	double p90{};
+	double p99{};
+};
+
+void PrintUsage()
+{
+	std::cout << "Usage: Benchmark [options]\n"
+		<< "Renders every combination of scene, resolution and thread count headless along a fixed camera path\n"
+		<< "  --help                   show this list\n"
+		<< "  --scenes <a,b,...>       scenes to run (default w1,w2,w3,w3_test,w4_test,reference,bunny,instances)\n"
+		<< "  --resolutions <WxH,...>  (default 320x240,640x480,1280x720)\n"
+		<< "  --threads <n,...>        render thread counts, 0 uses every hardware thread (default 1,0)\n"
+		<< "  --frames <count>         measured frames per combination (default 30)\n"
+		<< "  --warmup <count>         frames rendered before measuring (default 3)\n"
+		<< "  --samples <count>        samples per pixel (default 1)\n"
+		<< "  --tile <pixels>          tile size (default 32)\n"
+		<< "  --interleave <n>         1, 2 or 4, pixels per traced pixel while the camera path moves (default 1)\n"
+		<< "  --label <text>           stored in the JSON, e.g. a commit hash\n"
+		<< "  --output <path>          writes <path>.json and <path>.csv (default benchmark)\n";
+}
+
+bool ParseUnsigned(const std::string& text, uint32_t& value)
+{
+	const char* pEnd{ text.data() + text.size() };
+	const auto [pLast, error] = std::from_chars(text.data(), pEnd, value);
+	return !text.empty() && error == std::errc{} && pLast == pEnd;
+}
+
+std::vector<std::string> SplitList(const std::string& text)
+{
+	std::vector<std::string> items{};
+	size_t start{ 0 };
+	while (start <= text.size())
+	{
+		const size_t comma{ std::min(text.find(',', start), text.size()) };
+		if (comma > start)
+			items.push_back(text.substr(start, comma - start));
+		start = comma + 1;
+	}
+	return items;
+}
+
+bool ParseResolution(const std::string& text, Resolution& resolution)
+{
+	const size_t separator{ text.find('x') };
+	return separator != std::string::npos
+		&& ParseUnsigned(text.substr(0, separator), resolution.width) && resolution.width > 0
+		&& ParseUnsigned(text.substr(separator + 1), resolution.height) && resolution.height > 0;
+}
+
+bool ParseOptions(int argc, char* args[], BenchmarkOptions& options)
+{
+	for (int inx = 1; inx < argc; ++inx)
+	{
+		const std::string option{ args[inx] };
+		if (option == "--help")
+		{
+			options.showHelp = true;
+			continue;
+		}
+
+		const bool takesValue{ option == "--scenes" || option == "--resolutions" || option == "--threads" || option == "--frames"
+			|| option == "--warmup" || option == "--samples" || option == "--tile" || option == "--interleave" || option == "--label" || option == "--output" };
+		if (!takesValue)
+		{
+			std::cout << "Unknown option " << option << std::endl;
+			return false;
+		}
+
+		if (inx + 1 >= argc)
+		{
+			std::cout << "Missing value for " << option << std::endl;
+			return false;
+		}
+		const std::string value{ args[++inx] };
+
+		bool isValid{ true };
+		if (option == "--scenes")
+		{
+			options.sceneNames = SplitList(value);
+			isValid = !options.sceneNames.empty();
+		}
+		else if (option == "--resolutions")
+		{
+			options.resolutions.clear();
+			for (const std::string& item : SplitList(value))
+			{
+				Resolution resolution{};
+				isValid = isValid && ParseResolution(item, resolution);
+				options.resolutions.push_back(resolution);
+			}
+			isValid = isValid && !options.resolutions.empty();
+		}
+		else if (option == "--threads")
+		{
+			options.threadCounts.clear();
+			for (const std::string& item : SplitList(value))
+			{
+				uint32_t threadCount{};
+				isValid = isValid && ParseUnsigned(item, threadCount);
+				options.threadCounts.push_back(threadCount);
+			}
+			isValid = isValid && !options.threadCounts.empty();
+		}
+		else if (option == "--frames") isValid = ParseUnsigned(value, options.frameCount) && options.frameCount > 0;
+		else if (option == "--warmup") isValid = ParseUnsigned(value, options.warmupFrameCount);
+		else if (option == "--samples") isValid = ParseUnsigned(value, options.samplesPerPixel) && options.samplesPerPixel > 0;
+		else if (option == "--tile") isValid = ParseUnsigned(value, options.tileSize) && options.tileSize > 0;
+		else if (option == "--interleave") isValid = ParseUnsigned(value, options.interleaveFactor)
+			&& (options.interleaveFactor == 1 || options.interleaveFactor == 2 || options.interleaveFactor == 4);
+		else if (option == "--label") options.label = value;
+		else if (option == "--output") options.outputPath = value;
+
+		if (!isValid)
+		{
+			std::cout << "Invalid value '" << value << "' for " << option << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+//Same path for every run: a slow sway and pan around the scene's own camera, one full period over the measured frames
+void ApplyCameraPath(Camera& camera, const Vector3& startOrigin, float startPitch, uint32_t frame, uint32_t frameCount)
+{
+	const float phase{ PI_2 * frame / frameCount };
+	camera.origin = startOrigin + Vector3{ 0.5f * std::sin(phase), 0.25f * std::sin(2.f * phase), 0.f };
+	camera.totalPitch = startPitch + 0.05f * std::sin(phase);
+}
+
+bool RunBenchmark(const BenchmarkOptions& options, const std::string& sceneName, const Resolution& resolution, uint32_t threadCount, BenchmarkResult& result)
+{
+	const std::unique_ptr<Scene> pScene{ CreateScene(sceneName) };
+	if (!pScene)
+	{
+		std::cout << "Unknown scene " << sceneName << std::endl;
+		return false;
+	}
+	pScene->Initialize();
+
+	Camera& camera = pScene->GetCamera();
+	const Vector3 startOrigin{ camera.origin };
+	const float startPitch{ camera.totalPitch };
+
+	//Animated scenes advance by a fixed step per measured frame, so every run sees the same frames
+	Timer timer{};
+	Renderer renderer{ resolution.width, resolution.height, threadCount, options.tileSize };
+	renderer.SetSamplesPerPixel(options.samplesPerPixel);
+	renderer.SetInterleaveFactor(options.interleaveFactor);
+	//Every frame has to trace the whole image, the warmup and the first measured frame see the same static view
+	renderer.SetIncrementalRendering(false);
+
+	result.sceneName = sceneName;
+	result.resolution = resolution;
+	result.threadCount = threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	result.frameMilliseconds.reserve(options.frameCount);
+
+	for (uint32_t frame = 0; frame < options.warmupFrameCount + options.frameCount; ++frame)
+	{
+		const bool isMeasured{ frame >= options.warmupFrameCount };
+		ApplyCameraPath(camera, startOrigin, startPitch, isMeasured ? frame - options.warmupFrameCount : 0, options.frameCount);
+
+		pScene->Update(&timer);
+		pScene->UpdateAccelerationStructure();
+
+		//Only the render itself is timed, scene updates depend on the scene's own animation code
+		const auto renderStart{ std::chrono::steady_clock::now() };
+		renderer.Render(pScene.get());
+		const auto renderEnd{ std::chrono::steady_clock::now() };
+
+		if (isMeasured)
+		{
+			result.frameMilliseconds.push_back(std::chrono::duration<double, std::milli>(renderEnd - renderStart).count());
+			result.primaryRayCount += renderer.GetLastFrameStatistics().primaryRayCount;
+			result.shadowRayCount += renderer.GetLastFrameStatistics().shadowRayCount;
+		}
+
+		if (isMeasured)
+			timer.Step(1.f / 30.f);
+	}
+	return true;
+}
+
+//Nearest-rank percentiles over the sorted frame times
+FrameTimeSummary Summarize(const std::vector<double>& frameMilliseconds)
+{
+	std::vector<double> sorted{ frameMilliseconds };
+	std::sort(sorted.begin(), sorted.end());
+
+	const auto percentile = [&sorted](double fraction)
+	{
+		const size_t rank{ static_cast<size_t>(std::ceil(fraction * sorted.size())) };
+		return sorted[std::clamp(rank, size_t(1), sorted.size()) - 1];
+	};
+
+	FrameTimeSummary summary{};
+	for (double milliseconds : sorted)
+	{
+		summary.mean += milliseconds;
+	}
+	summary.mean /= sorted.size();
+	summary.min = sorted.front();
+	summary.max = sorted.back();
+	summary.p50 = percentile(0.5);
+	summary.p90 = percentile(0.9);
+	summary.p99 = percentile(0.99);
+	return summary;
+}
+
+double GetTotalSeconds(const BenchmarkResult& result)
+{
+	double totalMilliseconds{ 0.0 };
+	for (double milliseconds : result.frameMilliseconds)
+	{
+		totalMilliseconds += milliseconds;
+	}
+	return totalMilliseconds / 1000.0;
+}
+
+double GetMegaRaysPerSecond(uint64_t rayCount, double seconds)
+{
+	return seconds > 0.0 ? rayCount / seconds / 1e6 : 0.0;
+}
+
+std::string EscapeJson(const std::string& text)
+{
+	std::string escaped{};
+	for (const char character : text)
+	{
+		if (character == '"' || character == '\\')
+			escaped += '\\';
+		escaped += character;
+	}
+	return escaped;
+}
+
+bool WriteJson(const std::string& path, const BenchmarkOptions& options, const std::vector<BenchmarkResult>& results)
+{
+	std::ofstream file{ path };
+	if (!file)
+		return false;
+
+	file << std::fixed << std::setprecision(4);
+	file << "{\n"
+		<< "  \"label\": \"" << EscapeJson(options.label) << "\",\n"
+		<< "  \"frames\": " << options.frameCount << ",\n"
+		<< "  \"warmupFrames\": " << options.warmupFrameCount << ",\n"
+		<< "  \"samplesPerPixel\": " << options.samplesPerPixel << ",\n"
+		<< "  \"tileSize\": " << options.tileSize << ",\n"
+		<< "  \"interleaveFactor\": " << options.interleaveFactor << ",\n"
+		<< "  \"results\": [\n";
+
+	for (size_t inx = 0; inx < results.size(); ++inx)
+	{
+		const BenchmarkResult& result = results[inx];
+		const FrameTimeSummary summary{ Summarize(result.frameMilliseconds) };
+		const double seconds{ GetTotalSeconds(result) };
+
+		file << "    {\n"
+			<< "      \"scene\": \"" << EscapeJson(result.sceneName) << "\",\n"
+			<< "      \"width\": " << result.resolution.width << ",\n"
+			<< "      \"height\": " << result.resolution.height << ",\n"
+			<< "      \"threads\": " << result.threadCount << ",\n"
+			<< "      \"meanMs\": " << summary.mean << ",\n"
+			<< "      \"minMs\": " << summary.min << ",\n"
+			<< "      \"maxMs\": " << summary.max << ",\n"
+			<< "      \"p50Ms\": " << summary.p50 << ",\n"
+			<< "      \"p90Ms\": " << summary.p90 << ",\n"
+			<< "      \"p99Ms\": " << summary.p99 << ",\n"
+			<< "      \"primaryRays\": " << result.primaryRayCount << ",\n"
+			<< "      \"shadowRays\": " << result.shadowRayCount << ",\n"
+			<< "      \"primaryMraysPerSecond\": " << GetMegaRaysPerSecond(result.primaryRayCount, seconds) << ",\n"
+			<< "      \"shadowMraysPerSecond\": " << GetMegaRaysPerSecond(result.shadowRayCount, seconds) << ",\n"
+			<< "      \"frameMs\": [";
+
+		for (size_t frame = 0; frame < result.frameMilliseconds.size(); ++frame)
+		{
+			file << (frame > 0 ? ", " : "") << result.frameMilliseconds[frame];
+		}
+		file << "]\n    }" << (inx + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	file << "  ]\n}\n";
+	return static_cast<bool>(file);
+}
+
+bool WriteCsv(const std::string& path, const std::vector<BenchmarkResult>& results)
+{
+	std::ofstream file{ path };
+	if (!file)
+		return false;
+
+	file << std::fixed << std::setprecision(4);
+	file << "scene,width,height,threads,frames,mean_ms,min_ms,max_ms,p50_ms,p90_ms,p99_ms,primary_mrays_per_s,shadow_mrays_per_s\n";
+	for (const BenchmarkResult& result : results)
+	{
+		const FrameTimeSummary summary{ Summarize(result.frameMilliseconds) };
+		const double seconds{ GetTotalSeconds(result) };
+
+		file << result.sceneName << ',' << result.resolution.width << ',' << result.resolution.height << ',' << result.threadCount << ','
+			<< result.frameMilliseconds.size() << ',' << summary.mean << ',' << summary.min << ',' << summary.max << ','
+			<< summary.p50 << ',' << summary.p90 << ',' << summary.p99 << ','
+			<< GetMegaRaysPerSecond(result.primaryRayCount, seconds) << ',' << GetMegaRaysPerSecond(result.shadowRayCount, seconds) << '\n';
+	}
+	return static_cast<bool>(file);
+}
+
+int main(int argc, char* args[])
+{
+	BenchmarkOptions options{};
+	if (!ParseOptions(argc, args, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+	if (options.showHelp)
+	{
+		PrintUsage();
+		return 0;
+	}
+
+	std::vector<BenchmarkResult> results{};
+	for (const std::string& sceneName : options.sceneNames)
+	{
+		for (const Resolution& resolution : options.resolutions)
+		{
+			for (uint32_t threadCount : options.threadCounts)
+			{
+				BenchmarkResult result{};
+				if (!RunBenchmark(options, sceneName, resolution, threadCount, result))
+					return 1;
+
+				const FrameTimeSummary summary{ Summarize(result.frameMilliseconds) };
+				const double seconds{ GetTotalSeconds(result) };
+				std::cout << std::fixed << std::setprecision(2)
+					<< sceneName << ' ' << resolution.width << 'x' << resolution.height << ' ' << result.threadCount << " threads: "
+					<< summary.mean << " ms mean, " << summary.p50 << " p50, " << summary.p99 << " p99, "
+					<< GetMegaRaysPerSecond(result.primaryRayCount, seconds) << " primary Mrays/s, "
+					<< GetMegaRaysPerSecond(result.shadowRayCount, seconds) << " shadow Mrays/s" << std::endl;
+
+				results.push_back(std::move(result));
+			}
+		}
+	}
+
+	const std::string jsonPath{ options.outputPath + ".json" };
+	const std::string csvPath{ options.outputPath + ".csv" };
+	if (!WriteJson(jsonPath, options, results) || !WriteCsv(csvPath, results))
+	{
+		std::cout << "Something went wrong. " << jsonPath << " or " << csvPath << " not saved!" << std::endl;
+		return 1;
+	}
+	std::cout << "Saved " << jsonPath << " and " << csvPath << std::endl;
+	return 0;
+}
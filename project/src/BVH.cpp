@@ -0,0 +1,219 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace dae
+{
+	namespace
+	{
+		constexpr int BinCount{ 12 };
+		constexpr uint32_t MaxLeafSize{ 8 };
+
+		struct Bin
+		{
+			Vector3 minAABB{ FLT_MAX, FLT_MAX, FLT_MAX };
+			Vector3 maxAABB{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+			uint32_t count{};
+
+			void Grow(const Vector3& otherMin, const Vector3& otherMax)
+			{
+				minAABB = Vector3::Min(minAABB, otherMin);
+				maxAABB = Vector3::Max(maxAABB, otherMax);
+			}
+		};
+
+		//Half the surface area, the factor 2 cancels out in every SAH comparison
+		float HalfArea(const Vector3& minAABB, const Vector3& maxAABB)
+		{
+			const Vector3 extent{ maxAABB - minAABB };
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+	}
+
+	void BVH::Build(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax)
+	{
+		Clear();
+
+		const uint32_t primitiveCount{ static_cast<uint32_t>(primitiveMin.size()) };
+		if (primitiveCount == 0)
+			return;
+
+		primitiveIndices.resize(primitiveCount);
+		std::iota(primitiveIndices.begin(), primitiveIndices.end(), 0u);
+
+		std::vector<Vector3> centroids{};
+		centroids.reserve(primitiveCount);
+		for (uint32_t inx = 0; inx < primitiveCount; ++inx)
+		{
+			centroids.emplace_back((primitiveMin[inx] + primitiveMax[inx]) * 0.5f);
+		}
+
+		//A binary tree with N leaves never has more than 2N - 1 nodes, so references stay valid while building
+		nodes.reserve(2 * primitiveCount - 1);
+
+		BVHNode& root = nodes.emplace_back();
+		root.leftFirst = 0;
+		root.primitiveCount = primitiveCount;
+		UpdateNodeBounds(root, primitiveMin, primitiveMax);
+
+		struct BuildTask
+		{
+			uint32_t nodeIndex;
+			uint32_t depth;
+		};
+
+		std::vector<BuildTask> tasks{ { 0, 1 } };
+		while (!tasks.empty())
+		{
+			const BuildTask task{ tasks.back() };
+			tasks.pop_back();
+
+			BVHNode& node = nodes[task.nodeIndex];
+			if (node.primitiveCount <= 1 || task.depth >= MaxDepth)
+				continue;
+
+			int axis{};
+			float splitPosition{};
+			if (!FindBestSplit(node, centroids, primitiveMin, primitiveMax, axis, splitPosition))
+				continue;
+
+			const auto first = primitiveIndices.begin() + node.leftFirst;
+			const auto last = first + node.primitiveCount;
+			const auto middle = std::partition(first, last, [&](uint32_t primitiveIndex)
+				{
+					return centroids[primitiveIndex][axis] < splitPosition;
+				});
+
+			const uint32_t leftCount{ static_cast<uint32_t>(middle - first) };
+			if (leftCount == 0 || leftCount == node.primitiveCount)
+				continue;
+
+			const uint32_t leftIndex{ static_cast<uint32_t>(nodes.size()) };
+			BVHNode& left = nodes.emplace_back();
+			BVHNode& right = nodes.emplace_back();
+
+			left.leftFirst = node.leftFirst;
+			left.primitiveCount = leftCount;
+			right.leftFirst = node.leftFirst + leftCount;
+			right.primitiveCount = node.primitiveCount - leftCount;
+
+			node.leftFirst = leftIndex;
+			node.primitiveCount = 0;
+
+			UpdateNodeBounds(left, primitiveMin, primitiveMax);
+			UpdateNodeBounds(right, primitiveMin, primitiveMax);
+
+			tasks.push_back({ leftIndex, task.depth + 1 });
+			tasks.push_back({ leftIndex + 1, task.depth + 1 });
+		}
+	}
+
+	void BVH::Refit(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax)
+	{
+		//Children are always stored after their parent, so a reverse sweep visits them first
+		for (size_t inx = nodes.size(); inx-- > 0;)
+		{
+			BVHNode& node = nodes[inx];
+			if (node.IsLeaf())
+			{
+				UpdateNodeBounds(node, primitiveMin, primitiveMax);
+				continue;
+			}
+
+			const BVHNode& left = nodes[node.leftFirst];
+			const BVHNode& right = nodes[node.leftFirst + 1];
+			node.minAABB = Vector3::Min(left.minAABB, right.minAABB);
+			node.maxAABB = Vector3::Max(left.maxAABB, right.maxAABB);
+		}
+	}
+
+	void BVH::Clear()
+	{
+		nodes.clear();
+		primitiveIndices.clear();
+	}
+
+	void BVH::UpdateNodeBounds(BVHNode& node, const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax) const
+	{
+		node.minAABB = Vector3{ FLT_MAX, FLT_MAX, FLT_MAX };
+		node.maxAABB = Vector3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for (uint32_t inx = 0; inx < node.primitiveCount; ++inx)
+		{
+			const uint32_t primitiveIndex{ primitiveIndices[node.leftFirst + inx] };
+			node.minAABB = Vector3::Min(node.minAABB, primitiveMin[primitiveIndex]);
+			node.maxAABB = Vector3::Max(node.maxAABB, primitiveMax[primitiveIndex]);
+		}
+	}
+
+	bool BVH::FindBestSplit(const BVHNode& node, const std::vector<Vector3>& centroids, const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax, int& axis, float& splitPosition) const
+	{
+		//Bin over the centroid bounds, not the node bounds, so large primitives can't collapse all bins into one
+		Vector3 centroidMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vector3 centroidMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t inx = 0; inx < node.primitiveCount; ++inx)
+		{
+			const Vector3& centroid{ centroids[primitiveIndices[node.leftFirst + inx]] };
+			centroidMin = Vector3::Min(centroidMin, centroid);
+			centroidMax = Vector3::Max(centroidMax, centroid);
+		}
+
+		float bestCost{ FLT_MAX };
+		for (int currentAxis = 0; currentAxis < 3; ++currentAxis)
+		{
+			const float extent{ centroidMax[currentAxis] - centroidMin[currentAxis] };
+			if (extent <= 0.f)
+				continue;
+
+			Bin bins[BinCount]{};
+			const float scale{ BinCount / extent };
+			for (uint32_t inx = 0; inx < node.primitiveCount; ++inx)
+			{
+				const uint32_t primitiveIndex{ primitiveIndices[node.leftFirst + inx] };
+				const int binIndex{ std::min(BinCount - 1, static_cast<int>((centroids[primitiveIndex][currentAxis] - centroidMin[currentAxis]) * scale)) };
+
+				bins[binIndex].Grow(primitiveMin[primitiveIndex], primitiveMax[primitiveIndex]);
+				++bins[binIndex].count;
+			}
+
+			//Sweep from both sides to get the area and count on each side of the BinCount - 1 split planes
+			float leftArea[BinCount - 1]{}, rightArea[BinCount - 1]{};
+			uint32_t leftCount[BinCount - 1]{}, rightCount[BinCount - 1]{};
+
+			Bin leftBox{}, rightBox{};
+			uint32_t leftSum{}, rightSum{};
+			for (int inx = 0; inx < BinCount - 1; ++inx)
+			{
+				leftSum += bins[inx].count;
+				leftCount[inx] = leftSum;
+				if (bins[inx].count > 0) leftBox.Grow(bins[inx].minAABB, bins[inx].maxAABB);
+				leftArea[inx] = leftSum > 0 ? HalfArea(leftBox.minAABB, leftBox.maxAABB) : 0.f;
+
+				const int rightInx{ BinCount - 1 - inx };
+				rightSum += bins[rightInx].count;
+				rightCount[rightInx - 1] = rightSum;
+				if (bins[rightInx].count > 0) rightBox.Grow(bins[rightInx].minAABB, bins[rightInx].maxAABB);
+				rightArea[rightInx - 1] = rightSum > 0 ? HalfArea(rightBox.minAABB, rightBox.maxAABB) : 0.f;
+			}
+
+			for (int inx = 0; inx < BinCount - 1; ++inx)
+			{
+				const float cost{ leftCount[inx] * leftArea[inx] + rightCount[inx] * rightArea[inx] };
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					axis = currentAxis;
+					splitPosition = centroidMin[currentAxis] + (inx + 1) / scale;
+				}
+			}
+		}
+
+		if (bestCost == FLT_MAX)
+			return false;
+
+		//Keep the node as a leaf when testing all of its primitives is cheaper than splitting, unless it is too big
+		const float leafCost{ node.primitiveCount * HalfArea(node.minAABB, node.maxAABB) };
+		return bestCost < leafCost || node.primitiveCount > MaxLeafSize;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "Maths.h"
+
+namespace dae
+{
+	//Flattened BVH node (32 bytes), the two children of an interior node are stored next to each other
+	struct BVHNode
+	{
+		Vector3 minAABB{};
+		uint32_t leftFirst{}; //interior: index of the left child (right = left + 1), leaf: first entry in primitiveIndices
+		Vector3 maxAABB{};
+		uint32_t primitiveCount{}; //0 for interior nodes
+
+		bool IsLeaf() const { return primitiveCount > 0; }
+	};
+
+	//Bounding volume hierarchy over a set of primitive AABBs (binned SAH build)
+	struct BVH
+	{
+		//Deepest level the builder will create, traversal stacks are sized with this
+		static constexpr uint32_t MaxDepth{ 64 };
+
+		BVH() = default;
+		//Nodes and primitive indices are allocated from pResource, a scene passes its arena
+		explicit BVH(std::pmr::memory_resource* pResource) :
+			nodes(pResource), primitiveIndices(pResource) {}
+
+		std::pmr::vector<BVHNode> nodes{};
+		std::pmr::vector<uint32_t> primitiveIndices{};
+
+		/**
+		 * \brief Builds the hierarchy from scratch
+		 * \param primitiveMin min corner of every primitive's AABB
+		 * \param primitiveMax max corner of every primitive's AABB
+		 */
+		void Build(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax);
+		/**
+		 * \brief Recomputes the node bounds bottom-up in O(n) while keeping the topology,
+		 * only valid when the primitive count matches the last Build
+		 */
+		void Refit(const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax);
+		void Clear();
+
+		bool IsEmpty() const { return nodes.empty(); }
+
+	private:
+		void UpdateNodeBounds(BVHNode& node, const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax) const;
+		bool FindBestSplit(const BVHNode& node, const std::vector<Vector3>& centroids, const std::vector<Vector3>& primitiveMin, const std::vector<Vector3>& primitiveMax, int& axis, float& splitPosition) const;
+	};
+}
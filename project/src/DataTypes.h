@@ -1,19 +1,28 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <memory_resource>
 #include <stdexcept>
 #include <vector>
 
 #include "Maths.h"
+#include "BVH.h"
+#include "Trace.h"
 
 
 namespace dae
 {
+	//Names a material in the scene's MaterialTable, see MakeMaterialHandle for the layout
+	using MaterialHandle = uint32_t;
+
 #pragma region GEOMETRY
 	struct Sphere
 	{
 		Vector3 origin{};
 		float radius{};
 
-		unsigned char materialIndex{ 0 };
+		MaterialHandle materialIndex{ 0 };
 	};
 
 	struct Plane
@@ -21,7 +30,7 @@ namespace dae
 		Vector3 origin{};
 		Vector3 normal{};
 
-		unsigned char materialIndex{ 0 };
+		MaterialHandle materialIndex{ 0 };
 	};
 
 	enum class TriangleCullMode
@@ -52,33 +61,26 @@ namespace dae
 		Vector3 normal{};
 
 		TriangleCullMode cullMode{};
-		unsigned char materialIndex{};
+		MaterialHandle materialIndex{};
 	};
 
-	struct TriangleMesh
+	//Precomputed Moller-Trumbore data for one mesh triangle, meshes keep these in BVH leaf order
+	struct alignas(16) TriangleIntersectionRecord
 	{
+		TriangleIntersectionRecord() = default;
+		TriangleIntersectionRecord(const Vector3& _v0, const Vector3& _v1, const Vector3& _v2, uint32_t _triangleIndex = 0) :
+			v0{ _v0 }, edge1{ _v1 - _v0 }, edge2{ _v2 - _v0 }, triangleIndex{ _triangleIndex } {}
 
-		TriangleMesh() = default;
-		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, TriangleCullMode _cullMode) :
-			positions(_positions), indices(_indices), cullMode(_cullMode)
-		{
-			//Calculate Normals
-			CalculateNormals();
-
-			//Update Transforms
-			UpdateTransforms();
-		}
-
-		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, const std::vector<Vector3>& _normals, TriangleCullMode _cullMode) :
-			positions(_positions), indices(_indices), normals(_normals), cullMode(_cullMode)
-		{
-			UpdateTransforms();
-		}
+		Vector3 v0{};
+		Vector3 edge1{}; //v1 - v0
+		Vector3 edge2{}; //v2 - v0
+		uint32_t triangleIndex{}; //face index into the mesh indices (indices[triangleIndex * 3])
+	};
 
-		std::vector<Vector3> positions{};
-		std::vector<Vector3> normals{};
-		std::vector<int> indices{};
-		unsigned char materialIndex{};
+	//Where a mesh sits in the world and how it is shaded. A TriangleMesh places its own vertices, a MeshInstance places shared ones
+	struct MeshPlacement
+	{
+		MaterialHandle materialIndex{};
 
 		TriangleCullMode cullMode{ TriangleCullMode::BackFaceCulling };
 
@@ -86,13 +88,14 @@ namespace dae
 		Matrix translationTransform{};
 		Matrix scaleTransform{};
 
-		Vector3 minAABB;
-		Vector3 maxAABB;
 		Vector3 transformedMinAABB;
 		Vector3 transformedMaxAABB;
 
-		std::vector<Vector3> transformedPositions{};
-		std::vector<Vector3> transformedNormals{};
+		Matrix finalTransform{};
+		Matrix inverseTransform{};
+
+		//Bumped whenever the placement moves (and for a TriangleMesh when its vertices change), lets cached results tied to the old geometry be dropped
+		uint32_t revision{};
 
 		void Translate(const Vector3& translation)
 		{
@@ -109,6 +112,110 @@ namespace dae
 			scaleTransform = Matrix::CreateScale(scale);
 		}
 
+		//Normals go through the inverse transpose so non-uniform scales keep them perpendicular to the surface
+		Vector3 TransformNormal(const Vector3& objectNormal) const
+		{
+			return Vector3{
+				Vector3::Dot(objectNormal, inverseTransform.GetAxisX()),
+				Vector3::Dot(objectNormal, inverseTransform.GetAxisY()),
+				Vector3::Dot(objectNormal, inverseTransform.GetAxisZ()) }.Normalized();
+		}
+
+	protected:
+		//Combines scale, rotation and translation into finalTransform and its inverse
+		void UpdateFinalTransform()
+		{
+			const Matrix newTransform{ scaleTransform * rotationTransform * translationTransform };
+			if (!(newTransform == finalTransform))
+				++revision;
+
+			finalTransform = newTransform;
+			inverseTransform = Matrix::Inverse(finalTransform);
+		}
+
+		//World AABB around the object-space box, from its eight transformed corners
+		void UpdateTransformedAABB(const Vector3& minAABB, const Vector3& maxAABB)
+		{
+			Vector3 tMinAABB = finalTransform.TransformPoint(minAABB);
+			Vector3 tMaxAABB = tMinAABB;
+
+			Vector3 tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, minAABB.z);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+			tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, maxAABB.z);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+			tAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, maxAABB.z);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+
+			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, minAABB.z);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+			tAABB = finalTransform.TransformPoint(maxAABB);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, maxAABB.z);
+			tMinAABB = Vector3::Min(tAABB, tMinAABB);
+			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+
+			transformedMinAABB = tMinAABB;
+			transformedMaxAABB = tMaxAABB;
+		}
+	};
+
+	struct TriangleMesh : MeshPlacement
+	{
+
+		TriangleMesh() = default;
+		//Every array, including the BVH, is allocated from pResource. Scene::AddTriangleMesh passes the scene arena
+		explicit TriangleMesh(std::pmr::memory_resource* pResource) :
+			positions(pResource), normals(pResource), indices(pResource), vertexNormals(pResource), bvh(pResource), triangleRecords(pResource)
+		{
+		}
+
+		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, TriangleCullMode _cullMode) :
+			positions(_positions.begin(), _positions.end()), indices(_indices.begin(), _indices.end())
+		{
+			cullMode = _cullMode;
+
+			//Calculate Normals
+			CalculateNormals();
+
+			//Update Transforms
+			UpdateTransforms();
+		}
+
+		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, const std::vector<Vector3>& _normals, TriangleCullMode _cullMode) :
+			positions(_positions.begin(), _positions.end()), normals(_normals.begin(), _normals.end()), indices(_indices.begin(), _indices.end())
+		{
+			cullMode = _cullMode;
+			UpdateTransforms();
+		}
+
+		std::pmr::vector<Vector3> positions{};
+		std::pmr::vector<Vector3> normals{};
+		std::pmr::vector<int> indices{};
+		//Object space, one per position. When present, hits blend them with the barycentrics instead of using the face normal
+		std::pmr::vector<Vector3> vertexNormals{};
+
+		Vector3 minAABB;
+		Vector3 maxAABB;
+
+		//Built once over the object-space triangles. The intersection records are stored in leaf order,
+		//so the BVH primitive indices are the identity and point straight into triangleRecords
+		BVH bvh{};
+		std::pmr::vector<TriangleIntersectionRecord> triangleRecords{};
+
 		void AppendTriangle(const Triangle& triangle, bool ignoreTransformUpdate = false)
 		{
 			int startIndex = static_cast<int>(positions.size());
@@ -144,27 +251,151 @@ namespace dae
 			}
 		}
 
+		//Every face normal is weighted by the angle it makes at the vertex, so splitting a face into more triangles doesn't tilt the result
+		void CalculateVertexNormals()
+		{
+			vertexNormals.assign(positions.size(), Vector3{});
+			for (size_t inx = 0; inx + 2 < indices.size(); inx += 3)
+			{
+				const int cornerIndices[3]{ indices[inx], indices[inx + 1], indices[inx + 2] };
+				const Vector3 faceNormal{ Vector3::Cross(positions[cornerIndices[1]] - positions[cornerIndices[0]], positions[cornerIndices[2]] - positions[cornerIndices[0]]) };
+				if (faceNormal.SqrMagnitude() == 0.f)
+					continue;
+
+				const Vector3 unitNormal{ faceNormal.Normalized() };
+				for (int corner = 0; corner < 3; ++corner)
+				{
+					const Vector3& position = positions[cornerIndices[corner]];
+					const Vector3 toNext{ (positions[cornerIndices[(corner + 1) % 3]] - position).Normalized() };
+					const Vector3 toPrevious{ (positions[cornerIndices[(corner + 2) % 3]] - position).Normalized() };
+					const float angle{ std::acos(std::clamp(Vector3::Dot(toNext, toPrevious), -1.f, 1.f)) };
+
+					vertexNormals[cornerIndices[corner]] += angle * unitNormal;
+				}
+			}
+
+			//Vertices no triangle uses keep a zero normal, they can't be hit anyway
+			for (Vector3& vertexNormal : vertexNormals)
+			{
+				if (vertexNormal.SqrMagnitude() > 0.f)
+					vertexNormal.Normalize();
+			}
+		}
+
+		//Rigid path: vertices stay in object space, only the cached transforms and the world AABB are updated
+		//Rays get moved into object space with inverseTransform at hit time
 		void UpdateTransforms()
 		{
-			const auto finalTransform = scaleTransform * rotationTransform * translationTransform;
-			
-			transformedPositions.clear();
-			transformedPositions.reserve(positions.size());
-			for (int inx = 0; inx < positions.size(); ++inx)
+			const Trace::ScopedEvent traceEvent{ "TriangleMesh::UpdateTransforms" };
+
+			if (bvh.primitiveIndices.size() != indices.size() / 3)
+				BuildBVH();
+
+			UpdateFinalTransform();
+			UpdateTransformedAABB(minAABB, maxAABB);
+		}
+
+		//Non-rigid path: call after editing positions in place, refits the BVH bounds in O(n) instead of rebuilding
+		//Vertex normals are left alone, call CalculateVertexNormals as well when the surface should follow the new shape
+		void Refit()
+		{
+			for (TriangleIntersectionRecord& record : triangleRecords)
 			{
-				transformedPositions.emplace_back(finalTransform.TransformPoint(positions[inx]));
+				record = CreateTriangleRecord(record.triangleIndex);
 			}
 
-			UpdateTransformedAABB(finalTransform);
+			std::vector<Vector3> triangleMin{};
+			std::vector<Vector3> triangleMax{};
+			CalculateRecordBounds(triangleMin, triangleMax);
+
+			bvh.Refit(triangleMin, triangleMax);
+			UpdateBoundsFromBVH();
+			UpdateTransformedAABB(minAABB, maxAABB);
+			++revision;
+		}
+
+		void BuildBVH()
+		{
+			const uint32_t triangleCount{ static_cast<uint32_t>(indices.size() / 3) };
+
+			triangleRecords.clear();
+			triangleRecords.reserve(triangleCount);
+			for (uint32_t inx = 0; inx < triangleCount; ++inx)
+			{
+				triangleRecords.emplace_back(CreateTriangleRecord(inx));
+			}
+
+			std::vector<Vector3> triangleMin{};
+			std::vector<Vector3> triangleMax{};
+			CalculateRecordBounds(triangleMin, triangleMax);
+			bvh.Build(triangleMin, triangleMax);
+
+			//Recreate the records in leaf order so every leaf references a contiguous run of them. They are rebuilt
+			//in their own storage, a second arena backed array would stay allocated for the scene's lifetime
+			triangleRecords.clear();
+			for (uint32_t primitiveIndex : bvh.primitiveIndices)
+			{
+				triangleRecords.emplace_back(CreateTriangleRecord(primitiveIndex));
+			}
+
+			for (uint32_t inx = 0; inx < triangleCount; ++inx)
+			{
+				bvh.primitiveIndices[inx] = inx;
+			}
+
+			UpdateBoundsFromBVH();
+			++revision;
+		}
+
+		TriangleIntersectionRecord CreateTriangleRecord(uint32_t triangleIndex) const
+		{
+			const size_t firstIndex{ triangleIndex * size_t(3) };
+			return TriangleIntersectionRecord{ positions[indices[firstIndex]], positions[indices[firstIndex + 1]], positions[indices[firstIndex + 2]], triangleIndex };
+		}
+
+		//Object space normal at barycentrics (u, v) of a triangle, u weighs v1 and v weighs v2 like in HitTest_TriangleRecord
+		Vector3 GetObjectHitNormal(const TriangleIntersectionRecord& triangle, float u, float v) const
+		{
+			if (vertexNormals.empty())
+				return Vector3::Cross(triangle.edge1, triangle.edge2);
+
+			const size_t firstIndex{ triangle.triangleIndex * size_t(3) };
+			return (1.f - u - v) * vertexNormals[indices[firstIndex]]
+				+ u * vertexNormals[indices[firstIndex + 1]]
+				+ v * vertexNormals[indices[firstIndex + 2]];
+		}
+
+		//World space normal at barycentrics (u, v) of a triangle
+		Vector3 GetHitNormal(const TriangleIntersectionRecord& triangle, float u, float v) const
+		{
+			return TransformNormal(GetObjectHitNormal(triangle, u, v));
+		}
+
+		void CalculateRecordBounds(std::vector<Vector3>& triangleMin, std::vector<Vector3>& triangleMax) const
+		{
+			triangleMin.reserve(triangleRecords.size());
+			triangleMax.reserve(triangleRecords.size());
 
-			transformedNormals.clear();
-			transformedNormals.reserve(normals.size());
-			for (int inx = 0; inx < normals.size(); ++inx)
+			for (const TriangleIntersectionRecord& record : triangleRecords)
 			{
-				transformedNormals.emplace_back(finalTransform.TransformVector(normals[inx]));
+				const Vector3 v1{ record.v0 + record.edge1 };
+				const Vector3 v2{ record.v0 + record.edge2 };
+
+				triangleMin.emplace_back(Vector3::Min(record.v0, Vector3::Min(v1, v2)));
+				triangleMax.emplace_back(Vector3::Max(record.v0, Vector3::Max(v1, v2)));
 			}
 		}
 
+		//The root node holds the exact object-space bounds of the referenced vertices
+		void UpdateBoundsFromBVH()
+		{
+			if (bvh.IsEmpty())
+				return;
+
+			minAABB = bvh.nodes[0].minAABB;
+			maxAABB = bvh.nodes[0].maxAABB;
+		}
+
 		void UpdateAABB()
 		{
 			if (positions.size() > 0)
@@ -179,43 +410,27 @@ namespace dae
 				}
 			}
 		}
+	};
 
-		void UpdateTransformedAABB(const Matrix& finalTransform)
-		{
-			Vector3 tMinAABB = finalTransform.TransformPoint(minAABB);
-			Vector3 tMaxAABB = tMinAABB;
-
-			Vector3 tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(maxAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(minAABB.x, minAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(maxAABB.x, maxAABB.y, minAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
-
-			tAABB = finalTransform.TransformPoint(maxAABB);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+	/**
+	 * Places a shared TriangleMesh in the world. The mesh data (vertices, records and BVH) is immutable and referenced by every instance,
+	 * only the transform and material are per instance, so memory grows with the unique meshes instead of the instances.
+	 * The mesh's own placement is ignored, rays are moved into its object space with the instance's inverseTransform
+	 */
+	struct MeshInstance : MeshPlacement
+	{
+		//Must have its BVH built (TriangleMesh::UpdateTransforms or MeshCache::LoadOBJ) before it is shared
+		std::shared_ptr<const TriangleMesh> pMesh{};
 
-			tAABB = finalTransform.TransformPoint(minAABB.x, maxAABB.y, maxAABB.z);
-			tMinAABB = Vector3::Min(tAABB, tMinAABB);
-			tMaxAABB = Vector3::Max(tAABB, tMaxAABB);
+		void UpdateTransforms()
+		{
+			UpdateFinalTransform();
+			UpdateTransformedAABB(pMesh->minAABB, pMesh->maxAABB);
+		}
 
-			transformedMinAABB = tMinAABB;
-			transformedMaxAABB = tMaxAABB;
+		Vector3 GetHitNormal(const TriangleIntersectionRecord& triangle, float u, float v) const
+		{
+			return TransformNormal(pMesh->GetObjectHitNormal(triangle, u, v));
 		}
 	};
 #pragma endregion
@@ -253,7 +468,7 @@ namespace dae
 		float t = FLT_MAX;
 
 		bool didHit{ false };
-		unsigned char materialIndex{ 0 };
+		MaterialHandle materialIndex{ 0 };
 	};
 #pragma endregion
 }
\ No newline at end of file
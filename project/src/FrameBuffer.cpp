@@ -0,0 +1,428 @@
+#include "FrameBuffer.h"
+
+//Standard includes
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DAE_RESOLVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace dae
+{
+	namespace
+	{
+		std::string GetLowerCaseExtension(const std::string& path)
+		{
+			const size_t dotIndex{ path.find_last_of('.') };
+			if (dotIndex == std::string::npos)
+				return {};
+
+			std::string extension{ path.substr(dotIndex + 1) };
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			return extension;
+		}
+
+#pragma region PNG Helpers
+		uint32_t UpdateCRC32(uint32_t crc, const uint8_t* pData, size_t size)
+		{
+			static const std::array<uint32_t, 256> table = []
+				{
+					std::array<uint32_t, 256> crcTable{};
+					for (uint32_t n = 0; n < 256; ++n)
+					{
+						uint32_t c{ n };
+						for (int k = 0; k < 8; ++k)
+							c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+						crcTable[n] = c;
+					}
+					return crcTable;
+				}();
+
+			for (size_t inx = 0; inx < size; ++inx)
+				crc = table[(crc ^ pData[inx]) & 0xFF] ^ (crc >> 8);
+			return crc;
+		}
+
+		void AppendBigEndian(std::vector<uint8_t>& bytes, uint32_t value)
+		{
+			bytes.push_back(static_cast<uint8_t>(value >> 24));
+			bytes.push_back(static_cast<uint8_t>(value >> 16));
+			bytes.push_back(static_cast<uint8_t>(value >> 8));
+			bytes.push_back(static_cast<uint8_t>(value));
+		}
+
+		void WritePNGChunk(std::ofstream& file, const char type[4], const std::vector<uint8_t>& data)
+		{
+			std::vector<uint8_t> chunk{};
+			chunk.reserve(data.size() + 12);
+			AppendBigEndian(chunk, static_cast<uint32_t>(data.size()));
+			chunk.insert(chunk.end(), type, type + 4);
+			chunk.insert(chunk.end(), data.begin(), data.end());
+
+			//The CRC covers the type and the data, not the length
+			const uint32_t crc{ UpdateCRC32(0xFFFFFFFFu, chunk.data() + 4, chunk.size() - 4) ^ 0xFFFFFFFFu };
+			AppendBigEndian(chunk, crc);
+
+			file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+		}
+#pragma endregion
+
+		//Linear [0, 1] to sRGB encoded 8-bit values, indexed with the linear value scaled to [0, GammaTableSize - 1]
+		constexpr uint32_t GammaTableSize{ 4096 };
+
+		const std::array<uint8_t, GammaTableSize>& GetGammaTable()
+		{
+			static const std::array<uint8_t, GammaTableSize> table = []
+				{
+					std::array<uint8_t, GammaTableSize> gammaTable{};
+					for (uint32_t inx = 0; inx < GammaTableSize; ++inx)
+					{
+						const float linear{ inx / float(GammaTableSize - 1) };
+						const float encoded{ linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1.f / 2.4f) - 0.055f };
+						gammaTable[inx] = static_cast<uint8_t>(encoded * 255.f + 0.5f);
+					}
+					return gammaTable;
+				}();
+			return table;
+		}
+
+		uint32_t PackPixel(uint32_t red, uint32_t green, uint32_t blue, const PackedPixelFormat& format)
+		{
+			return ((red >> format.redLoss) << format.redShift)
+				| ((green >> format.greenLoss) << format.greenShift)
+				| ((blue >> format.blueLoss) << format.blueShift)
+				| format.alphaMask;
+		}
+
+		//Shared exponent encoding of the Radiance format, negative values are clamped to black
+		std::array<uint8_t, 4> ToRGBE(float r, float g, float b)
+		{
+			r = std::max(r, 0.f);
+			g = std::max(g, 0.f);
+			b = std::max(b, 0.f);
+
+			const float maxValue{ std::max(r, std::max(g, b)) };
+			if (maxValue < 1e-32f)
+				return { 0, 0, 0, 0 };
+
+			int exponent{};
+			const float scale{ std::frexp(maxValue, &exponent) * 256.f / maxValue };
+			return { static_cast<uint8_t>(r * scale), static_cast<uint8_t>(g * scale), static_cast<uint8_t>(b * scale), static_cast<uint8_t>(exponent + 128) };
+		}
+	}
+
+	FrameBuffer::FrameBuffer(uint32_t width, uint32_t height)
+	{
+		Resize(width, height);
+	}
+
+	void FrameBuffer::Resize(uint32_t width, uint32_t height)
+	{
+		m_Width = width;
+		m_Height = height;
+		m_Stride = (width + RowAlignment - 1) / RowAlignment * RowAlignment;
+
+		const size_t pixelCount{ size_t(m_Stride) * height };
+		m_Red.assign(pixelCount, 0.f);
+		m_Green.assign(pixelCount, 0.f);
+		m_Blue.assign(pixelCount, 0.f);
+	}
+
+	void FrameBuffer::Upscale(const FrameBuffer& source, uint32_t firstRow, uint32_t lastRow)
+	{
+		const float scaleX{ float(source.m_Width) / m_Width };
+		const float scaleY{ float(source.m_Height) / m_Height };
+
+		for (uint32_t py = firstRow; py < lastRow; ++py)
+		{
+			const float sourceY{ std::max((py + 0.5f) * scaleY - 0.5f, 0.f) };
+			const uint32_t y0{ std::min(uint32_t(sourceY), source.m_Height - 1) };
+			const uint32_t y1{ std::min(y0 + 1, source.m_Height - 1) };
+			const float weightY{ sourceY - y0 };
+
+			const size_t row0{ size_t(y0) * source.m_Stride };
+			const size_t row1{ size_t(y1) * source.m_Stride };
+			const size_t targetRow{ size_t(py) * m_Stride };
+
+			for (uint32_t px = 0; px < m_Width; ++px)
+			{
+				const float sourceX{ std::max((px + 0.5f) * scaleX - 0.5f, 0.f) };
+				const uint32_t x0{ std::min(uint32_t(sourceX), source.m_Width - 1) };
+				const uint32_t x1{ std::min(x0 + 1, source.m_Width - 1) };
+				const float weightX{ sourceX - x0 };
+
+				const auto sample = [&](const FloatPlane& plane)
+					{
+						const float top{ plane[row0 + x0] + (plane[row0 + x1] - plane[row0 + x0]) * weightX };
+						const float bottom{ plane[row1 + x0] + (plane[row1 + x1] - plane[row1 + x0]) * weightX };
+						return top + (bottom - top) * weightY;
+					};
+
+				m_Red[targetRow + px] = sample(source.m_Red);
+				m_Green[targetRow + px] = sample(source.m_Green);
+				m_Blue[targetRow + px] = sample(source.m_Blue);
+			}
+		}
+	}
+
+	void FrameBuffer::Clear()
+	{
+		std::fill(m_Red.begin(), m_Red.end(), 0.f);
+		std::fill(m_Green.begin(), m_Green.end(), 0.f);
+		std::fill(m_Blue.begin(), m_Blue.end(), 0.f);
+	}
+
+	void FrameBuffer::Resolve(uint32_t firstRow, uint32_t lastRow, const PackedPixelFormat& format, bool applyGamma, uint32_t* pPixels, uint32_t pixelsPerRow) const
+	{
+		const std::array<uint8_t, GammaTableSize>& gammaTable{ GetGammaTable() };
+
+#if defined(DAE_RESOLVE_SSE2)
+		const __m128 zero{ _mm_setzero_ps() }, one{ _mm_set1_ps(1.f) };
+		const __m128 byteScale{ _mm_set1_ps(255.f) }, gammaScale{ _mm_set1_ps(float(GammaTableSize - 1)) }, half{ _mm_set1_ps(0.5f) };
+		const __m128i alphaMask{ _mm_set1_epi32(static_cast<int>(format.alphaMask)) };
+		const __m128i redLoss{ _mm_cvtsi32_si128(static_cast<int>(format.redLoss)) }, redShift{ _mm_cvtsi32_si128(static_cast<int>(format.redShift)) };
+		const __m128i greenLoss{ _mm_cvtsi32_si128(static_cast<int>(format.greenLoss)) }, greenShift{ _mm_cvtsi32_si128(static_cast<int>(format.greenShift)) };
+		const __m128i blueLoss{ _mm_cvtsi32_si128(static_cast<int>(format.blueLoss)) }, blueShift{ _mm_cvtsi32_si128(static_cast<int>(format.blueShift)) };
+
+		//Linear channel in [0, 1] to 8-bit, the gamma curve goes through the table one lane at a time
+		const auto toByte = [&](__m128 channel)
+			{
+				if (!applyGamma)
+					return _mm_cvttps_epi32(_mm_mul_ps(channel, byteScale));
+
+				alignas(16) int32_t indices[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(channel, gammaScale), half)));
+				return _mm_setr_epi32(gammaTable[indices[0]], gammaTable[indices[1]], gammaTable[indices[2]], gammaTable[indices[3]]);
+			};
+#endif
+
+		for (uint32_t py = firstRow; py < lastRow; ++py)
+		{
+			const float* pRed{ m_Red.data() + size_t(py) * m_Stride };
+			const float* pGreen{ m_Green.data() + size_t(py) * m_Stride };
+			const float* pBlue{ m_Blue.data() + size_t(py) * m_Stride };
+			uint32_t* pRow{ pPixels + size_t(py) * pixelsPerRow };
+
+			uint32_t px{ 0 };
+#if defined(DAE_RESOLVE_SSE2)
+			for (; px + 4 <= m_Width; px += 4)
+			{
+				__m128 red{ _mm_load_ps(pRed + px) };
+				__m128 green{ _mm_load_ps(pGreen + px) };
+				__m128 blue{ _mm_load_ps(pBlue + px) };
+
+				//MaxToOne, dividing by 1 keeps the channels that don't need it bit exact
+				const __m128 maxValue{ _mm_max_ps(red, _mm_max_ps(green, blue)) };
+				const __m128 needsScale{ _mm_cmpgt_ps(maxValue, one) };
+				const __m128 divisor{ _mm_or_ps(_mm_and_ps(needsScale, maxValue), _mm_andnot_ps(needsScale, one)) };
+				red = _mm_min_ps(_mm_max_ps(_mm_div_ps(red, divisor), zero), one);
+				green = _mm_min_ps(_mm_max_ps(_mm_div_ps(green, divisor), zero), one);
+				blue = _mm_min_ps(_mm_max_ps(_mm_div_ps(blue, divisor), zero), one);
+
+				__m128i pixels{ alphaMask };
+				pixels = _mm_or_si128(pixels, _mm_sll_epi32(_mm_srl_epi32(toByte(red), redLoss), redShift));
+				pixels = _mm_or_si128(pixels, _mm_sll_epi32(_mm_srl_epi32(toByte(green), greenLoss), greenShift));
+				pixels = _mm_or_si128(pixels, _mm_sll_epi32(_mm_srl_epi32(toByte(blue), blueLoss), blueShift));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pRow + px), pixels);
+			}
+#endif
+			for (; px < m_Width; ++px)
+			{
+				ColorRGB color{ pRed[px], pGreen[px], pBlue[px] };
+				color.MaxToOne();
+
+				const float red{ std::clamp(color.r, 0.f, 1.f) };
+				const float green{ std::clamp(color.g, 0.f, 1.f) };
+				const float blue{ std::clamp(color.b, 0.f, 1.f) };
+
+				if (applyGamma)
+				{
+					pRow[px] = PackPixel(gammaTable[static_cast<uint32_t>(red * (GammaTableSize - 1) + 0.5f)],
+						gammaTable[static_cast<uint32_t>(green * (GammaTableSize - 1) + 0.5f)],
+						gammaTable[static_cast<uint32_t>(blue * (GammaTableSize - 1) + 0.5f)], format);
+				}
+				else
+				{
+					pRow[px] = PackPixel(static_cast<uint32_t>(red * 255), static_cast<uint32_t>(green * 255), static_cast<uint32_t>(blue * 255), format);
+				}
+			}
+		}
+	}
+
+	bool FrameBuffer::SaveToFile(const std::string& path, bool applyGamma) const
+	{
+		const std::string extension{ GetLowerCaseExtension(path) };
+
+		if (extension == "ppm") return SavePPM(path, applyGamma);
+		if (extension == "png") return SavePNG(path, applyGamma);
+		if (extension == "pfm") return SavePFM(path);
+		if (extension == "hdr") return SaveHDR(path);
+
+		return false;
+	}
+
+	std::vector<uint8_t> FrameBuffer::ToRGB8(bool applyGamma) const
+	{
+		std::vector<uint32_t> packedPixels(size_t(m_Width) * m_Height);
+		const PackedPixelFormat byteOrder{ 0, 8, 16, 0, 0, 0, 0 };
+		Resolve(0, m_Height, byteOrder, applyGamma, packedPixels.data(), m_Width);
+
+		std::vector<uint8_t> pixels{};
+		pixels.reserve(packedPixels.size() * 3);
+		for (uint32_t pixel : packedPixels)
+		{
+			pixels.push_back(static_cast<uint8_t>(pixel));
+			pixels.push_back(static_cast<uint8_t>(pixel >> 8));
+			pixels.push_back(static_cast<uint8_t>(pixel >> 16));
+		}
+		return pixels;
+	}
+
+	bool FrameBuffer::SavePPM(const std::string& path, bool applyGamma) const
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		const std::vector<uint8_t> pixels{ ToRGB8(applyGamma) };
+		file << "P6\n" << m_Width << " " << m_Height << "\n255\n";
+		file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+
+		return static_cast<bool>(file);
+	}
+
+	bool FrameBuffer::SavePNG(const std::string& path, bool applyGamma) const
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		const std::vector<uint8_t> pixels{ ToRGB8(applyGamma) };
+		const size_t rowSize{ size_t(m_Width) * 3 };
+
+		//Every scanline gets filter type 0 (none)
+		std::vector<uint8_t> scanlines{};
+		scanlines.reserve((rowSize + 1) * m_Height);
+		for (uint32_t py = 0; py < m_Height; ++py)
+		{
+			scanlines.push_back(0);
+			scanlines.insert(scanlines.end(), pixels.begin() + py * rowSize, pixels.begin() + (py + 1) * rowSize);
+		}
+
+		//zlib stream made of stored (uncompressed) deflate blocks, so no compressor is needed
+		std::vector<uint8_t> imageData{ 0x78, 0x01 };
+		constexpr size_t maxBlockSize{ 65535 };
+		size_t offset{ 0 };
+		do
+		{
+			const size_t blockSize{ std::min(maxBlockSize, scanlines.size() - offset) };
+			const bool isFinalBlock{ offset + blockSize == scanlines.size() };
+
+			imageData.push_back(isFinalBlock ? 1 : 0);
+			imageData.push_back(static_cast<uint8_t>(blockSize));
+			imageData.push_back(static_cast<uint8_t>(blockSize >> 8));
+			imageData.push_back(static_cast<uint8_t>(~blockSize));
+			imageData.push_back(static_cast<uint8_t>(~blockSize >> 8));
+			imageData.insert(imageData.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+
+			offset += blockSize;
+		} while (offset < scanlines.size());
+
+		uint32_t adlerA{ 1 }, adlerB{ 0 };
+		for (uint8_t byte : scanlines)
+		{
+			adlerA = (adlerA + byte) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+		AppendBigEndian(imageData, (adlerB << 16) | adlerA);
+
+		std::vector<uint8_t> header{};
+		AppendBigEndian(header, m_Width);
+		AppendBigEndian(header, m_Height);
+		header.insert(header.end(), { 8, 2, 0, 0, 0 }); //8-bit RGB, deflate, adaptive filtering, no interlace
+
+		const uint8_t signature[8]{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+		WritePNGChunk(file, "IHDR", header);
+		WritePNGChunk(file, "IDAT", imageData);
+		WritePNGChunk(file, "IEND", {});
+
+		return static_cast<bool>(file);
+	}
+
+	bool FrameBuffer::SavePFM(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		//A negative scale marks little-endian data, rows are stored bottom to top
+		file << "PF\n" << m_Width << " " << m_Height << "\n-1.0\n";
+
+		std::vector<float> row(size_t(m_Width) * 3);
+		for (uint32_t py = m_Height; py-- > 0;)
+		{
+			for (uint32_t px = 0; px < m_Width; ++px)
+			{
+				const size_t index{ px + size_t(py) * m_Stride };
+				row[px * 3] = m_Red[index];
+				row[px * 3 + 1] = m_Green[index];
+				row[px * 3 + 2] = m_Blue[index];
+			}
+			file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+		}
+
+		return static_cast<bool>(file);
+	}
+
+	bool FrameBuffer::SaveHDR(const std::string& path) const
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << m_Height << " +X " << m_Width << "\n";
+
+		//Readers only accept run-length encoded scanlines for widths in [8, 32767], anything else is written flat
+		const bool useRunLength{ m_Width >= 8 && m_Width <= 0x7FFF };
+
+		std::vector<uint8_t> rgbe(size_t(m_Width) * 4);
+		std::vector<uint8_t> scanline{};
+		for (uint32_t py = 0; py < m_Height; ++py)
+		{
+			for (uint32_t px = 0; px < m_Width; ++px)
+			{
+				const size_t index{ px + size_t(py) * m_Stride };
+				const std::array<uint8_t, 4> pixel{ ToRGBE(m_Red[index], m_Green[index], m_Blue[index]) };
+				std::copy(pixel.begin(), pixel.end(), rgbe.begin() + px * 4);
+			}
+
+			if (!useRunLength)
+			{
+				file.write(reinterpret_cast<const char*>(rgbe.data()), rgbe.size());
+				continue;
+			}
+
+			//Channels one after the other, as literal runs of at most 128 bytes
+			scanline.assign({ 2, 2, static_cast<uint8_t>(m_Width >> 8), static_cast<uint8_t>(m_Width & 0xFF) });
+			for (int channel = 0; channel < 4; ++channel)
+			{
+				for (uint32_t runStart = 0; runStart < m_Width; runStart += 128)
+				{
+					const uint32_t runLength{ std::min(128u, m_Width - runStart) };
+					scanline.push_back(static_cast<uint8_t>(runLength));
+					for (uint32_t px = runStart; px < runStart + runLength; ++px)
+						scanline.push_back(rgbe[px * 4 + channel]);
+				}
+			}
+			file.write(reinterpret_cast<const char*>(scanline.data()), scanline.size());
+		}
+
+		return static_cast<bool>(file);
+	}
+}
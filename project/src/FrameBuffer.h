@@ -0,0 +1,142 @@
+#pragma once
+
+//Standard includes
+#include <cstdint>
+#include <new>
+#include <string>
+#include <vector>
+
+//Project includes
+#include "ColorRGB.h"
+
+namespace dae
+{
+	//Allocator for SIMD friendly storage, the start of every allocation is Alignment byte aligned
+	template<typename T, size_t Alignment>
+	struct AlignedAllocator
+	{
+		using value_type = T;
+
+		template<typename U>
+		struct rebind
+		{
+			using other = AlignedAllocator<U, Alignment>;
+		};
+
+		AlignedAllocator() = default;
+		template<typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+		T* allocate(size_t count)
+		{
+			return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{ Alignment }));
+		}
+
+		void deallocate(T* pData, size_t)
+		{
+			::operator delete(pData, std::align_val_t{ Alignment });
+		}
+
+		template<typename U>
+		bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+		template<typename U>
+		bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+	};
+
+	//Where the 8-bit channels end up in a packed 32-bit pixel, read once per frame from the target surface format
+	struct PackedPixelFormat
+	{
+		uint32_t redShift{ 16 };
+		uint32_t greenShift{ 8 };
+		uint32_t blueShift{ 0 };
+		//Bits dropped from each 8-bit channel for formats with fewer bits per channel
+		uint32_t redLoss{ 0 };
+		uint32_t greenLoss{ 0 };
+		uint32_t blueLoss{ 0 };
+		uint32_t alphaMask{ 0xFF000000 };
+	};
+
+	//Linear, unclamped float image the renderer writes into, stored as one plane per channel
+	class FrameBuffer final
+	{
+	public:
+		//Row stride in floats is a multiple of this, so every row starts aligned for 8-wide loads
+		static constexpr uint32_t RowAlignment{ 8 };
+
+		FrameBuffer() = default;
+		FrameBuffer(uint32_t width, uint32_t height);
+		~FrameBuffer() = default;
+
+		FrameBuffer(const FrameBuffer&) = delete;
+		FrameBuffer(FrameBuffer&&) noexcept = delete;
+		FrameBuffer& operator=(const FrameBuffer&) = delete;
+		FrameBuffer& operator=(FrameBuffer&&) noexcept = delete;
+
+		void Resize(uint32_t width, uint32_t height);
+		void Clear();
+
+		void SetPixel(uint32_t px, uint32_t py, const ColorRGB& color)
+		{
+			const size_t index{ px + size_t(py) * m_Stride };
+			m_Red[index] = color.r;
+			m_Green[index] = color.g;
+			m_Blue[index] = color.b;
+		}
+
+		ColorRGB GetPixel(uint32_t px, uint32_t py) const
+		{
+			const size_t index{ px + size_t(py) * m_Stride };
+			return { m_Red[index], m_Green[index], m_Blue[index] };
+		}
+
+		/**
+		 * \brief Tonemaps (MaxToOne), optionally gamma-encodes and packs a band of rows into 32-bit pixels
+		 * \param firstRow first row to resolve
+		 * \param lastRow one past the last row to resolve
+		 * \param format channel layout of the target pixels
+		 * \param applyGamma encode with the sRGB curve instead of writing linear values
+		 * \param pPixels target image, row py starts at pPixels + py * pixelsPerRow
+		 * \param pixelsPerRow row pitch of the target in pixels
+		 */
+		void Resolve(uint32_t firstRow, uint32_t lastRow, const PackedPixelFormat& format, bool applyGamma, uint32_t* pPixels, uint32_t pixelsPerRow) const;
+
+		/**
+		 * \brief Bilinear resample of a band of rows from a smaller image, pixel centers line up so the image doesn't shift
+		 * \param source image covering the same view at a lower resolution
+		 * \param firstRow first row of this buffer to fill
+		 * \param lastRow one past the last row to fill
+		 */
+		void Upscale(const FrameBuffer& source, uint32_t firstRow, uint32_t lastRow);
+
+		/**
+		 * \brief Writes the image, the format is picked from the extension
+		 * .ppm/.png go through Resolve like the window does, .pfm/.hdr keep the unclamped linear floats
+		 * \param path output file
+		 * \param applyGamma sRGB encode the 8-bit formats
+		 * \return true when the file was written
+		 */
+		bool SaveToFile(const std::string& path, bool applyGamma = false) const;
+
+		uint32_t GetWidth() const { return m_Width; }
+		uint32_t GetHeight() const { return m_Height; }
+
+	private:
+		using FloatPlane = std::vector<float, AlignedAllocator<float, 32>>;
+
+		uint32_t m_Width{};
+		uint32_t m_Height{};
+		uint32_t m_Stride{};
+
+		FloatPlane m_Red{};
+		FloatPlane m_Green{};
+		FloatPlane m_Blue{};
+
+		bool SavePPM(const std::string& path, bool applyGamma) const;
+		bool SavePNG(const std::string& path, bool applyGamma) const;
+		bool SavePFM(const std::string& path) const;
+		bool SaveHDR(const std::string& path) const;
+
+		//8-bit RGB rows top to bottom, converted exactly like the windowed output
+		std::vector<uint8_t> ToRGB8(bool applyGamma) const;
+	};
+}
@@ -0,0 +1,635 @@
+#include "GeometryKernels.h"
+#include "Instrumentation.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DAE_SIMD_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+//GCC and Clang only allow AVX2 intrinsics in functions compiled for that target, MSVC allows them anywhere
+#if defined(DAE_SIMD_X64) && (defined(__GNUC__) || defined(__clang__))
+#define DAE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DAE_TARGET_AVX2
+#endif
+
+namespace dae
+{
+#pragma region Packed Geometry
+	void PackedSpheres::Clear()
+	{
+		originX.clear(); originY.clear(); originZ.clear();
+		radiusSquared.clear();
+		materialIndex.clear();
+		count = 0;
+	}
+
+	void PackedSpheres::Add(const Sphere& sphere)
+	{
+		originX.push_back(sphere.origin.x);
+		originY.push_back(sphere.origin.y);
+		originZ.push_back(sphere.origin.z);
+		radiusSquared.push_back(sphere.radius * sphere.radius);
+		materialIndex.push_back(sphere.materialIndex);
+		++count;
+	}
+
+	void PackedSpheres::Pad()
+	{
+		const size_t paddedSize{ count + size_t(MaxKernelWidth) };
+		originX.resize(paddedSize); originY.resize(paddedSize); originZ.resize(paddedSize);
+		radiusSquared.resize(paddedSize);
+	}
+
+	void PackedPlanes::Clear()
+	{
+		originX.clear(); originY.clear(); originZ.clear();
+		normalX.clear(); normalY.clear(); normalZ.clear();
+		materialIndex.clear();
+		count = 0;
+	}
+
+	void PackedPlanes::Add(const Plane& plane)
+	{
+		originX.push_back(plane.origin.x);
+		originY.push_back(plane.origin.y);
+		originZ.push_back(plane.origin.z);
+		normalX.push_back(plane.normal.x);
+		normalY.push_back(plane.normal.y);
+		normalZ.push_back(plane.normal.z);
+		materialIndex.push_back(plane.materialIndex);
+		++count;
+	}
+
+	void PackedPlanes::Pad()
+	{
+		const size_t paddedSize{ count + size_t(MaxKernelWidth) };
+		originX.resize(paddedSize); originY.resize(paddedSize); originZ.resize(paddedSize);
+		normalX.resize(paddedSize); normalY.resize(paddedSize); normalZ.resize(paddedSize);
+	}
+
+	void PackedTriangles::Clear()
+	{
+		v0X.clear(); v0Y.clear(); v0Z.clear();
+		edge1X.clear(); edge1Y.clear(); edge1Z.clear();
+		edge2X.clear(); edge2Y.clear(); edge2Z.clear();
+		acceptFrontFace.clear(); acceptBackFace.clear();
+		materialIndex.clear();
+		count = 0;
+	}
+
+	void PackedTriangles::Add(const Triangle& triangle)
+	{
+		const Vector3 edge1{ triangle.v1 - triangle.v0 };
+		const Vector3 edge2{ triangle.v2 - triangle.v0 };
+
+		v0X.push_back(triangle.v0.x); v0Y.push_back(triangle.v0.y); v0Z.push_back(triangle.v0.z);
+		edge1X.push_back(edge1.x); edge1Y.push_back(edge1.y); edge1Z.push_back(edge1.z);
+		edge2X.push_back(edge2.x); edge2Y.push_back(edge2.y); edge2Z.push_back(edge2.z);
+
+		acceptFrontFace.push_back(triangle.cullMode != TriangleCullMode::FrontFaceCulling ? UINT32_MAX : 0u);
+		acceptBackFace.push_back(triangle.cullMode != TriangleCullMode::BackFaceCulling ? UINT32_MAX : 0u);
+
+		materialIndex.push_back(triangle.materialIndex);
+		++count;
+	}
+
+	void PackedTriangles::Pad()
+	{
+		const size_t paddedSize{ count + size_t(MaxKernelWidth) };
+		v0X.resize(paddedSize); v0Y.resize(paddedSize); v0Z.resize(paddedSize);
+		edge1X.resize(paddedSize); edge1Y.resize(paddedSize); edge1Z.resize(paddedSize);
+		edge2X.resize(paddedSize); edge2Y.resize(paddedSize); edge2Z.resize(paddedSize);
+		acceptFrontFace.resize(paddedSize); acceptBackFace.resize(paddedSize);
+	}
+#pragma endregion
+
+	namespace
+	{
+#pragma region Scalar Kernels
+		//Same math as GeometryUtils::HitTest_Sphere/Plane/Triangle, one primitive at a time
+		template<bool IsAnyHit>
+		uint32_t ClosestSphere_Scalar(const PackedSpheres& spheres, uint32_t first, uint32_t count, const Ray& ray, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::SphereTests, count);
+
+			const float A{ Vector3::Dot(ray.direction, ray.direction) };
+			uint32_t closestIndex{ NoKernelHit };
+
+			for (uint32_t inx = first; inx < first + count; ++inx)
+			{
+				const float Lx{ ray.origin.x - spheres.originX[inx] };
+				const float Ly{ ray.origin.y - spheres.originY[inx] };
+				const float Lz{ ray.origin.z - spheres.originZ[inx] };
+
+				const float B{ 2 * (ray.direction.x * Lx + ray.direction.y * Ly + ray.direction.z * Lz) };
+				const float C{ Lx * Lx + Ly * Ly + Lz * Lz - spheres.radiusSquared[inx] };
+				const float D{ B * B - 4 * A * C };
+				if (D <= 0)
+					continue;
+
+				float t{ (-B - sqrtf(D)) / (2 * A) };
+				if (t < ray.min)
+					t = (-B + sqrtf(D)) / (2 * A);
+
+				if (t >= ray.min && t < closestT)
+				{
+					closestT = t;
+					closestIndex = inx;
+					if constexpr (IsAnyHit)
+						return closestIndex;
+				}
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		uint32_t ClosestPlane_Scalar(const PackedPlanes& planes, uint32_t first, uint32_t count, const Ray& ray, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::PlaneTests, count);
+
+			uint32_t closestIndex{ NoKernelHit };
+
+			for (uint32_t inx = first; inx < first + count; ++inx)
+			{
+				const float numerator{ (planes.originX[inx] - ray.origin.x) * planes.normalX[inx] + (planes.originY[inx] - ray.origin.y) * planes.normalY[inx] + (planes.originZ[inx] - ray.origin.z) * planes.normalZ[inx] };
+				const float denominator{ ray.direction.x * planes.normalX[inx] + ray.direction.y * planes.normalY[inx] + ray.direction.z * planes.normalZ[inx] };
+				const float t{ numerator / denominator };
+
+				if (t >= ray.min && t < closestT)
+				{
+					closestT = t;
+					closestIndex = inx;
+					if constexpr (IsAnyHit)
+						return closestIndex;
+				}
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		uint32_t ClosestTriangle_Scalar(const PackedTriangles& triangles, uint32_t first, uint32_t count, const Ray& ray, bool isShadowRay, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::TriangleTests, count);
+
+			const std::vector<uint32_t>& acceptPositive{ isShadowRay ? triangles.acceptBackFace : triangles.acceptFrontFace };
+			const std::vector<uint32_t>& acceptNegative{ isShadowRay ? triangles.acceptFrontFace : triangles.acceptBackFace };
+			uint32_t closestIndex{ NoKernelHit };
+
+			for (uint32_t inx = first; inx < first + count; ++inx)
+			{
+				const Vector3 v0{ triangles.v0X[inx], triangles.v0Y[inx], triangles.v0Z[inx] };
+				const Vector3 edge1{ triangles.edge1X[inx], triangles.edge1Y[inx], triangles.edge1Z[inx] };
+				const Vector3 edge2{ triangles.edge2X[inx], triangles.edge2Y[inx], triangles.edge2Z[inx] };
+
+				const Vector3 p{ Vector3::Cross(ray.direction, edge2) };
+				const float determinant{ Vector3::Dot(edge1, p) };
+				if (!((determinant > 0.f && acceptPositive[inx]) || (determinant < 0.f && acceptNegative[inx])))
+					continue;
+
+				const float inverseDeterminant{ 1.f / determinant };
+				const Vector3 s{ ray.origin - v0 };
+				const float u{ Vector3::Dot(s, p) * inverseDeterminant };
+				if (u < 0.f || u > 1.f)
+					continue;
+
+				const Vector3 q{ Vector3::Cross(s, edge1) };
+				const float v{ Vector3::Dot(ray.direction, q) * inverseDeterminant };
+				if (v < 0.f || u + v > 1.f)
+					continue;
+
+				const float t{ Vector3::Dot(edge2, q) * inverseDeterminant };
+				if (t >= ray.min && t <= closestT)
+				{
+					closestT = t;
+					closestIndex = inx;
+					if constexpr (IsAnyHit)
+						return closestIndex;
+				}
+			}
+			return closestIndex;
+		}
+#pragma endregion
+
+#if defined(DAE_SIMD_X64)
+#pragma region SSE2 Kernels
+		//Only lanes below count are real primitives of this range, the rest belong to the next range or padding
+		inline __m128 LaneMask_SSE2(uint32_t base, uint32_t count)
+		{
+			const __m128i laneIndex{ _mm_add_epi32(_mm_set_epi32(3, 2, 1, 0), _mm_set1_epi32(static_cast<int>(base))) };
+			return _mm_castsi128_ps(_mm_cmplt_epi32(laneIndex, _mm_set1_epi32(static_cast<int>(count))));
+		}
+
+		inline __m128 Select_SSE2(__m128 mask, __m128 a, __m128 b)
+		{
+			return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+		}
+
+		//Picks the closest lane out of a hit mask, lanes are only ever accepted closer than closestT
+		inline uint32_t ResolveLanes(int hitBits, const float* pLaneT, uint32_t firstIndex, uint32_t laneCount, bool inclusive, float& closestT, uint32_t closestIndex)
+		{
+			for (uint32_t lane = 0; hitBits != 0 && lane < laneCount; ++lane)
+			{
+				if ((hitBits & (1 << lane)) && (pLaneT[lane] < closestT || (inclusive && pLaneT[lane] == closestT)))
+				{
+					closestT = pLaneT[lane];
+					closestIndex = firstIndex + lane;
+				}
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		uint32_t ClosestSphere_SSE2(const PackedSpheres& spheres, uint32_t first, uint32_t count, const Ray& ray, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::SphereTests, count);
+
+			const float a{ Vector3::Dot(ray.direction, ray.direction) };
+			const __m128 fourA{ _mm_set1_ps(4 * a) }, twoA{ _mm_set1_ps(2 * a) };
+			const __m128 dirX{ _mm_set1_ps(ray.direction.x) }, dirY{ _mm_set1_ps(ray.direction.y) }, dirZ{ _mm_set1_ps(ray.direction.z) };
+			const __m128 orgX{ _mm_set1_ps(ray.origin.x) }, orgY{ _mm_set1_ps(ray.origin.y) }, orgZ{ _mm_set1_ps(ray.origin.z) };
+			const __m128 rayMin{ _mm_set1_ps(ray.min) };
+			const __m128 two{ _mm_set1_ps(2.f) }, zero{ _mm_setzero_ps() };
+
+			uint32_t closestIndex{ NoKernelHit };
+			alignas(16) float laneT[4];
+
+			for (uint32_t base = 0; base < count; base += 4)
+			{
+				const uint32_t inx{ first + base };
+				const __m128 Lx{ _mm_sub_ps(orgX, _mm_loadu_ps(&spheres.originX[inx])) };
+				const __m128 Ly{ _mm_sub_ps(orgY, _mm_loadu_ps(&spheres.originY[inx])) };
+				const __m128 Lz{ _mm_sub_ps(orgZ, _mm_loadu_ps(&spheres.originZ[inx])) };
+
+				const __m128 B{ _mm_mul_ps(two, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, Lx), _mm_mul_ps(dirY, Ly)), _mm_mul_ps(dirZ, Lz))) };
+				const __m128 C{ _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Lx, Lx), _mm_mul_ps(Ly, Ly)), _mm_mul_ps(Lz, Lz)), _mm_loadu_ps(&spheres.radiusSquared[inx])) };
+				const __m128 D{ _mm_sub_ps(_mm_mul_ps(B, B), _mm_mul_ps(fourA, C)) };
+
+				const __m128 sqrtD{ _mm_sqrt_ps(_mm_max_ps(D, zero)) };
+				const __m128 nearT{ _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, B), sqrtD), twoA) };
+				const __m128 farT{ _mm_div_ps(_mm_add_ps(_mm_sub_ps(zero, B), sqrtD), twoA) };
+				const __m128 t{ Select_SSE2(_mm_cmplt_ps(nearT, rayMin), farT, nearT) };
+
+				__m128 hit{ _mm_and_ps(_mm_cmpgt_ps(D, zero), LaneMask_SSE2(base, count)) };
+				hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, rayMin), _mm_cmplt_ps(t, _mm_set1_ps(closestT))));
+
+				const int hitBits{ _mm_movemask_ps(hit) };
+				if (hitBits == 0)
+					continue;
+
+				_mm_store_ps(laneT, t);
+				closestIndex = ResolveLanes(hitBits, laneT, inx, 4, false, closestT, closestIndex);
+				if constexpr (IsAnyHit)
+					return closestIndex;
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		uint32_t ClosestPlane_SSE2(const PackedPlanes& planes, uint32_t first, uint32_t count, const Ray& ray, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::PlaneTests, count);
+
+			const __m128 dirX{ _mm_set1_ps(ray.direction.x) }, dirY{ _mm_set1_ps(ray.direction.y) }, dirZ{ _mm_set1_ps(ray.direction.z) };
+			const __m128 orgX{ _mm_set1_ps(ray.origin.x) }, orgY{ _mm_set1_ps(ray.origin.y) }, orgZ{ _mm_set1_ps(ray.origin.z) };
+			const __m128 rayMin{ _mm_set1_ps(ray.min) };
+
+			uint32_t closestIndex{ NoKernelHit };
+			alignas(16) float laneT[4];
+
+			for (uint32_t base = 0; base < count; base += 4)
+			{
+				const uint32_t inx{ first + base };
+				const __m128 nX{ _mm_loadu_ps(&planes.normalX[inx]) };
+				const __m128 nY{ _mm_loadu_ps(&planes.normalY[inx]) };
+				const __m128 nZ{ _mm_loadu_ps(&planes.normalZ[inx]) };
+
+				const __m128 numerator{ _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&planes.originX[inx]), orgX), nX),
+					_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&planes.originY[inx]), orgY), nY)),
+					_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&planes.originZ[inx]), orgZ), nZ)) };
+				const __m128 denominator{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, nX), _mm_mul_ps(dirY, nY)), _mm_mul_ps(dirZ, nZ)) };
+				const __m128 t{ _mm_div_ps(numerator, denominator) };
+
+				//NaN from parallel planes or zeroed padding fails every ordered compare
+				__m128 hit{ _mm_and_ps(_mm_cmpge_ps(t, rayMin), _mm_cmplt_ps(t, _mm_set1_ps(closestT))) };
+				hit = _mm_and_ps(hit, LaneMask_SSE2(base, count));
+
+				const int hitBits{ _mm_movemask_ps(hit) };
+				if (hitBits == 0)
+					continue;
+
+				_mm_store_ps(laneT, t);
+				closestIndex = ResolveLanes(hitBits, laneT, inx, 4, false, closestT, closestIndex);
+				if constexpr (IsAnyHit)
+					return closestIndex;
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		uint32_t ClosestTriangle_SSE2(const PackedTriangles& triangles, uint32_t first, uint32_t count, const Ray& ray, bool isShadowRay, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::TriangleTests, count);
+
+			const __m128 dirX{ _mm_set1_ps(ray.direction.x) }, dirY{ _mm_set1_ps(ray.direction.y) }, dirZ{ _mm_set1_ps(ray.direction.z) };
+			const __m128 orgX{ _mm_set1_ps(ray.origin.x) }, orgY{ _mm_set1_ps(ray.origin.y) }, orgZ{ _mm_set1_ps(ray.origin.z) };
+			const __m128 rayMin{ _mm_set1_ps(ray.min) };
+			const __m128 zero{ _mm_setzero_ps() }, one{ _mm_set1_ps(1.f) };
+
+			const uint32_t* pAcceptPositive{ isShadowRay ? triangles.acceptBackFace.data() : triangles.acceptFrontFace.data() };
+			const uint32_t* pAcceptNegative{ isShadowRay ? triangles.acceptFrontFace.data() : triangles.acceptBackFace.data() };
+
+			uint32_t closestIndex{ NoKernelHit };
+			alignas(16) float laneT[4];
+
+			for (uint32_t base = 0; base < count; base += 4)
+			{
+				const uint32_t inx{ first + base };
+				const __m128 e1X{ _mm_loadu_ps(&triangles.edge1X[inx]) }, e1Y{ _mm_loadu_ps(&triangles.edge1Y[inx]) }, e1Z{ _mm_loadu_ps(&triangles.edge1Z[inx]) };
+				const __m128 e2X{ _mm_loadu_ps(&triangles.edge2X[inx]) }, e2Y{ _mm_loadu_ps(&triangles.edge2Y[inx]) }, e2Z{ _mm_loadu_ps(&triangles.edge2Z[inx]) };
+
+				//p = Cross(direction, edge2)
+				const __m128 pX{ _mm_sub_ps(_mm_mul_ps(dirY, e2Z), _mm_mul_ps(dirZ, e2Y)) };
+				const __m128 pY{ _mm_sub_ps(_mm_mul_ps(dirZ, e2X), _mm_mul_ps(dirX, e2Z)) };
+				const __m128 pZ{ _mm_sub_ps(_mm_mul_ps(dirX, e2Y), _mm_mul_ps(dirY, e2X)) };
+				const __m128 determinant{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1X, pX), _mm_mul_ps(e1Y, pY)), _mm_mul_ps(e1Z, pZ)) };
+
+				const __m128 acceptPositive{ _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pAcceptPositive + inx))) };
+				const __m128 acceptNegative{ _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pAcceptNegative + inx))) };
+				__m128 hit{ _mm_or_ps(_mm_and_ps(_mm_cmpgt_ps(determinant, zero), acceptPositive), _mm_and_ps(_mm_cmplt_ps(determinant, zero), acceptNegative)) };
+				hit = _mm_and_ps(hit, LaneMask_SSE2(base, count));
+				if (_mm_movemask_ps(hit) == 0)
+					continue;
+
+				const __m128 inverseDeterminant{ _mm_div_ps(one, determinant) };
+				const __m128 sX{ _mm_sub_ps(orgX, _mm_loadu_ps(&triangles.v0X[inx])) };
+				const __m128 sY{ _mm_sub_ps(orgY, _mm_loadu_ps(&triangles.v0Y[inx])) };
+				const __m128 sZ{ _mm_sub_ps(orgZ, _mm_loadu_ps(&triangles.v0Z[inx])) };
+
+				const __m128 u{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, pX), _mm_mul_ps(sY, pY)), _mm_mul_ps(sZ, pZ)), inverseDeterminant) };
+
+				//q = Cross(s, edge1)
+				const __m128 qX{ _mm_sub_ps(_mm_mul_ps(sY, e1Z), _mm_mul_ps(sZ, e1Y)) };
+				const __m128 qY{ _mm_sub_ps(_mm_mul_ps(sZ, e1X), _mm_mul_ps(sX, e1Z)) };
+				const __m128 qZ{ _mm_sub_ps(_mm_mul_ps(sX, e1Y), _mm_mul_ps(sY, e1X)) };
+
+				const __m128 v{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dirX, qX), _mm_mul_ps(dirY, qY)), _mm_mul_ps(dirZ, qZ)), inverseDeterminant) };
+				const __m128 t{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2X, qX), _mm_mul_ps(e2Y, qY)), _mm_mul_ps(e2Z, qZ)), inverseDeterminant) };
+
+				hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+				hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+				hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, rayMin), _mm_cmple_ps(t, _mm_set1_ps(closestT))));
+
+				const int hitBits{ _mm_movemask_ps(hit) };
+				if (hitBits == 0)
+					continue;
+
+				_mm_store_ps(laneT, t);
+				closestIndex = ResolveLanes(hitBits, laneT, inx, 4, true, closestT, closestIndex);
+				if constexpr (IsAnyHit)
+					return closestIndex;
+			}
+			return closestIndex;
+		}
+#pragma endregion
+
+#pragma region AVX2 Kernels
+		DAE_TARGET_AVX2 inline __m256 LaneMask_AVX2(uint32_t base, uint32_t count)
+		{
+			const __m256i laneIndex{ _mm256_add_epi32(_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0), _mm256_set1_epi32(static_cast<int>(base))) };
+			return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)), laneIndex));
+		}
+
+		template<bool IsAnyHit>
+		DAE_TARGET_AVX2 uint32_t ClosestSphere_AVX2(const PackedSpheres& spheres, uint32_t first, uint32_t count, const Ray& ray, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::SphereTests, count);
+
+			const float a{ Vector3::Dot(ray.direction, ray.direction) };
+			const __m256 fourA{ _mm256_set1_ps(4 * a) }, twoA{ _mm256_set1_ps(2 * a) };
+			const __m256 dirX{ _mm256_set1_ps(ray.direction.x) }, dirY{ _mm256_set1_ps(ray.direction.y) }, dirZ{ _mm256_set1_ps(ray.direction.z) };
+			const __m256 orgX{ _mm256_set1_ps(ray.origin.x) }, orgY{ _mm256_set1_ps(ray.origin.y) }, orgZ{ _mm256_set1_ps(ray.origin.z) };
+			const __m256 rayMin{ _mm256_set1_ps(ray.min) };
+			const __m256 two{ _mm256_set1_ps(2.f) }, zero{ _mm256_setzero_ps() };
+
+			uint32_t closestIndex{ NoKernelHit };
+			alignas(32) float laneT[8];
+
+			for (uint32_t base = 0; base < count; base += 8)
+			{
+				const uint32_t inx{ first + base };
+				const __m256 Lx{ _mm256_sub_ps(orgX, _mm256_loadu_ps(&spheres.originX[inx])) };
+				const __m256 Ly{ _mm256_sub_ps(orgY, _mm256_loadu_ps(&spheres.originY[inx])) };
+				const __m256 Lz{ _mm256_sub_ps(orgZ, _mm256_loadu_ps(&spheres.originZ[inx])) };
+
+				const __m256 B{ _mm256_mul_ps(two, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, Lx), _mm256_mul_ps(dirY, Ly)), _mm256_mul_ps(dirZ, Lz))) };
+				const __m256 C{ _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(Lx, Lx), _mm256_mul_ps(Ly, Ly)), _mm256_mul_ps(Lz, Lz)), _mm256_loadu_ps(&spheres.radiusSquared[inx])) };
+				const __m256 D{ _mm256_sub_ps(_mm256_mul_ps(B, B), _mm256_mul_ps(fourA, C)) };
+
+				const __m256 sqrtD{ _mm256_sqrt_ps(_mm256_max_ps(D, zero)) };
+				const __m256 nearT{ _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, B), sqrtD), twoA) };
+				const __m256 farT{ _mm256_div_ps(_mm256_add_ps(_mm256_sub_ps(zero, B), sqrtD), twoA) };
+				const __m256 t{ _mm256_blendv_ps(nearT, farT, _mm256_cmp_ps(nearT, rayMin, _CMP_LT_OQ)) };
+
+				__m256 hit{ _mm256_and_ps(_mm256_cmp_ps(D, zero, _CMP_GT_OQ), LaneMask_AVX2(base, count)) };
+				hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, rayMin, _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ)));
+
+				const int hitBits{ _mm256_movemask_ps(hit) };
+				if (hitBits == 0)
+					continue;
+
+				_mm256_store_ps(laneT, t);
+				closestIndex = ResolveLanes(hitBits, laneT, inx, 8, false, closestT, closestIndex);
+				if constexpr (IsAnyHit)
+					return closestIndex;
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		DAE_TARGET_AVX2 uint32_t ClosestPlane_AVX2(const PackedPlanes& planes, uint32_t first, uint32_t count, const Ray& ray, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::PlaneTests, count);
+
+			const __m256 dirX{ _mm256_set1_ps(ray.direction.x) }, dirY{ _mm256_set1_ps(ray.direction.y) }, dirZ{ _mm256_set1_ps(ray.direction.z) };
+			const __m256 orgX{ _mm256_set1_ps(ray.origin.x) }, orgY{ _mm256_set1_ps(ray.origin.y) }, orgZ{ _mm256_set1_ps(ray.origin.z) };
+			const __m256 rayMin{ _mm256_set1_ps(ray.min) };
+
+			uint32_t closestIndex{ NoKernelHit };
+			alignas(32) float laneT[8];
+
+			for (uint32_t base = 0; base < count; base += 8)
+			{
+				const uint32_t inx{ first + base };
+				const __m256 nX{ _mm256_loadu_ps(&planes.normalX[inx]) };
+				const __m256 nY{ _mm256_loadu_ps(&planes.normalY[inx]) };
+				const __m256 nZ{ _mm256_loadu_ps(&planes.normalZ[inx]) };
+
+				const __m256 numerator{ _mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&planes.originX[inx]), orgX), nX),
+					_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&planes.originY[inx]), orgY), nY)),
+					_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&planes.originZ[inx]), orgZ), nZ)) };
+				const __m256 denominator{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, nX), _mm256_mul_ps(dirY, nY)), _mm256_mul_ps(dirZ, nZ)) };
+				const __m256 t{ _mm256_div_ps(numerator, denominator) };
+
+				__m256 hit{ _mm256_and_ps(_mm256_cmp_ps(t, rayMin, _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LT_OQ)) };
+				hit = _mm256_and_ps(hit, LaneMask_AVX2(base, count));
+
+				const int hitBits{ _mm256_movemask_ps(hit) };
+				if (hitBits == 0)
+					continue;
+
+				_mm256_store_ps(laneT, t);
+				closestIndex = ResolveLanes(hitBits, laneT, inx, 8, false, closestT, closestIndex);
+				if constexpr (IsAnyHit)
+					return closestIndex;
+			}
+			return closestIndex;
+		}
+
+		template<bool IsAnyHit>
+		DAE_TARGET_AVX2 uint32_t ClosestTriangle_AVX2(const PackedTriangles& triangles, uint32_t first, uint32_t count, const Ray& ray, bool isShadowRay, float& closestT)
+		{
+			Instrumentation::Add(Instrumentation::Counter::TriangleTests, count);
+
+			const __m256 dirX{ _mm256_set1_ps(ray.direction.x) }, dirY{ _mm256_set1_ps(ray.direction.y) }, dirZ{ _mm256_set1_ps(ray.direction.z) };
+			const __m256 orgX{ _mm256_set1_ps(ray.origin.x) }, orgY{ _mm256_set1_ps(ray.origin.y) }, orgZ{ _mm256_set1_ps(ray.origin.z) };
+			const __m256 rayMin{ _mm256_set1_ps(ray.min) };
+			const __m256 zero{ _mm256_setzero_ps() }, one{ _mm256_set1_ps(1.f) };
+
+			const uint32_t* pAcceptPositive{ isShadowRay ? triangles.acceptBackFace.data() : triangles.acceptFrontFace.data() };
+			const uint32_t* pAcceptNegative{ isShadowRay ? triangles.acceptFrontFace.data() : triangles.acceptBackFace.data() };
+
+			uint32_t closestIndex{ NoKernelHit };
+			alignas(32) float laneT[8];
+
+			for (uint32_t base = 0; base < count; base += 8)
+			{
+				const uint32_t inx{ first + base };
+				const __m256 e1X{ _mm256_loadu_ps(&triangles.edge1X[inx]) }, e1Y{ _mm256_loadu_ps(&triangles.edge1Y[inx]) }, e1Z{ _mm256_loadu_ps(&triangles.edge1Z[inx]) };
+				const __m256 e2X{ _mm256_loadu_ps(&triangles.edge2X[inx]) }, e2Y{ _mm256_loadu_ps(&triangles.edge2Y[inx]) }, e2Z{ _mm256_loadu_ps(&triangles.edge2Z[inx]) };
+
+				//p = Cross(direction, edge2)
+				const __m256 pX{ _mm256_sub_ps(_mm256_mul_ps(dirY, e2Z), _mm256_mul_ps(dirZ, e2Y)) };
+				const __m256 pY{ _mm256_sub_ps(_mm256_mul_ps(dirZ, e2X), _mm256_mul_ps(dirX, e2Z)) };
+				const __m256 pZ{ _mm256_sub_ps(_mm256_mul_ps(dirX, e2Y), _mm256_mul_ps(dirY, e2X)) };
+				const __m256 determinant{ _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, pX), _mm256_mul_ps(e1Y, pY)), _mm256_mul_ps(e1Z, pZ)) };
+
+				const __m256 acceptPositive{ _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pAcceptPositive + inx))) };
+				const __m256 acceptNegative{ _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pAcceptNegative + inx))) };
+				__m256 hit{ _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(determinant, zero, _CMP_GT_OQ), acceptPositive), _mm256_and_ps(_mm256_cmp_ps(determinant, zero, _CMP_LT_OQ), acceptNegative)) };
+				hit = _mm256_and_ps(hit, LaneMask_AVX2(base, count));
+				if (_mm256_movemask_ps(hit) == 0)
+					continue;
+
+				const __m256 inverseDeterminant{ _mm256_div_ps(one, determinant) };
+				const __m256 sX{ _mm256_sub_ps(orgX, _mm256_loadu_ps(&triangles.v0X[inx])) };
+				const __m256 sY{ _mm256_sub_ps(orgY, _mm256_loadu_ps(&triangles.v0Y[inx])) };
+				const __m256 sZ{ _mm256_sub_ps(orgZ, _mm256_loadu_ps(&triangles.v0Z[inx])) };
+
+				const __m256 u{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sX, pX), _mm256_mul_ps(sY, pY)), _mm256_mul_ps(sZ, pZ)), inverseDeterminant) };
+
+				//q = Cross(s, edge1)
+				const __m256 qX{ _mm256_sub_ps(_mm256_mul_ps(sY, e1Z), _mm256_mul_ps(sZ, e1Y)) };
+				const __m256 qY{ _mm256_sub_ps(_mm256_mul_ps(sZ, e1X), _mm256_mul_ps(sX, e1Z)) };
+				const __m256 qZ{ _mm256_sub_ps(_mm256_mul_ps(sX, e1Y), _mm256_mul_ps(sY, e1X)) };
+
+				const __m256 v{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, qX), _mm256_mul_ps(dirY, qY)), _mm256_mul_ps(dirZ, qZ)), inverseDeterminant) };
+				const __m256 t{ _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2X, qX), _mm256_mul_ps(e2Y, qY)), _mm256_mul_ps(e2Z, qZ)), inverseDeterminant) };
+
+				hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+				hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+				hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, rayMin, _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(closestT), _CMP_LE_OQ)));
+
+				const int hitBits{ _mm256_movemask_ps(hit) };
+				if (hitBits == 0)
+					continue;
+
+				_mm256_store_ps(laneT, t);
+				closestIndex = ResolveLanes(hitBits, laneT, inx, 8, true, closestT, closestIndex);
+				if constexpr (IsAnyHit)
+					return closestIndex;
+			}
+			return closestIndex;
+		}
+#pragma endregion
+#endif
+
+		SIMDLevel DetectSIMDLevel()
+		{
+#if defined(DAE_SIMD_X64)
+			//SSE2 is part of the x64 baseline, AVX2 also needs the OS to save the YMM registers
+#if defined(_MSC_VER)
+			int cpuInfo[4]{};
+			__cpuid(cpuInfo, 0);
+			if (cpuInfo[0] >= 7)
+			{
+				__cpuid(cpuInfo, 1);
+				const bool hasOSXSave{ (cpuInfo[2] & (1 << 27)) != 0 };
+				const bool hasAVX{ (cpuInfo[2] & (1 << 28)) != 0 };
+				if (hasOSXSave && hasAVX && (_xgetbv(0) & 0x6) == 0x6)
+				{
+					__cpuidex(cpuInfo, 7, 0);
+					if (cpuInfo[1] & (1 << 5))
+						return SIMDLevel::AVX2;
+				}
+			}
+#else
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2"))
+				return SIMDLevel::AVX2;
+#endif
+			return SIMDLevel::SSE2;
+#else
+			return SIMDLevel::Scalar;
+#endif
+		}
+
+		GeometryKernels SelectKernels()
+		{
+			GeometryKernels kernels{};
+			kernels.level = DetectSIMDLevel();
+
+			switch (kernels.level)
+			{
+#if defined(DAE_SIMD_X64)
+			case SIMDLevel::AVX2:
+				kernels.closestSphere = &ClosestSphere_AVX2<false>;
+				kernels.closestPlane = &ClosestPlane_AVX2<false>;
+				kernels.closestTriangle = &ClosestTriangle_AVX2<false>;
+				kernels.anySphere = &ClosestSphere_AVX2<true>;
+				kernels.anyPlane = &ClosestPlane_AVX2<true>;
+				kernels.anyTriangle = &ClosestTriangle_AVX2<true>;
+				break;
+			case SIMDLevel::SSE2:
+				kernels.closestSphere = &ClosestSphere_SSE2<false>;
+				kernels.closestPlane = &ClosestPlane_SSE2<false>;
+				kernels.closestTriangle = &ClosestTriangle_SSE2<false>;
+				kernels.anySphere = &ClosestSphere_SSE2<true>;
+				kernels.anyPlane = &ClosestPlane_SSE2<true>;
+				kernels.anyTriangle = &ClosestTriangle_SSE2<true>;
+				break;
+#endif
+			default:
+				kernels.closestSphere = &ClosestSphere_Scalar<false>;
+				kernels.closestPlane = &ClosestPlane_Scalar<false>;
+				kernels.closestTriangle = &ClosestTriangle_Scalar<false>;
+				kernels.anySphere = &ClosestSphere_Scalar<true>;
+				kernels.anyPlane = &ClosestPlane_Scalar<true>;
+				kernels.anyTriangle = &ClosestTriangle_Scalar<true>;
+				break;
+			}
+			return kernels;
+		}
+	}
+
+	const GeometryKernels& GetGeometryKernels()
+	{
+		static const GeometryKernels kernels{ SelectKernels() };
+		return kernels;
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "DataTypes.h"
+
+namespace dae
+{
+	//Widest kernel lane count, every packed array is padded with this many extra entries so loads never go out of bounds
+	constexpr uint32_t MaxKernelWidth{ 8 };
+	constexpr uint32_t NoKernelHit{ UINT32_MAX };
+
+#pragma region Packed Geometry
+	//Structure-of-arrays copies of the scene primitives, rebuilt from the AoS vectors in Scene::UpdateAccelerationStructure
+	struct PackedSpheres
+	{
+		std::vector<float> originX{}, originY{}, originZ{};
+		std::vector<float> radiusSquared{};
+		std::vector<MaterialHandle> materialIndex{};
+		uint32_t count{};
+
+		void Clear();
+		void Add(const Sphere& sphere);
+		void Pad();
+	};
+
+	struct PackedPlanes
+	{
+		std::vector<float> originX{}, originY{}, originZ{};
+		std::vector<float> normalX{}, normalY{}, normalZ{};
+		std::vector<MaterialHandle> materialIndex{};
+		uint32_t count{};
+
+		void Clear();
+		void Add(const Plane& plane);
+		void Pad();
+	};
+
+	struct PackedTriangles
+	{
+		std::vector<float> v0X{}, v0Y{}, v0Z{};
+		std::vector<float> edge1X{}, edge1Y{}, edge1Z{};
+		std::vector<float> edge2X{}, edge2Y{}, edge2Z{};
+		//All bits set when a positive/negative determinant (front/back face) may be hit, encodes the cull mode per lane
+		std::vector<uint32_t> acceptFrontFace{}, acceptBackFace{};
+		std::vector<MaterialHandle> materialIndex{};
+		uint32_t count{};
+
+		void Clear();
+		void Add(const Triangle& triangle);
+		void Pad();
+	};
+#pragma endregion
+
+#pragma region Kernels
+	enum class SIMDLevel
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	/**
+	 * \brief Ray vs. a range of packed primitives, 4 or 8 at a time depending on the selected SIMD level
+	 * Each kernel tests [first, first + count) and returns the index of the closest hit closer than closestT,
+	 * or NoKernelHit. closestT is updated on a hit, so passing ray.max in and checking the result also works as an any-hit test
+	 */
+	struct GeometryKernels
+	{
+		SIMDLevel level{ SIMDLevel::Scalar };
+
+		uint32_t(*closestSphere)(const PackedSpheres& spheres, uint32_t first, uint32_t count, const Ray& ray, float& closestT) {};
+		uint32_t(*closestPlane)(const PackedPlanes& planes, uint32_t first, uint32_t count, const Ray& ray, float& closestT) {};
+		//Shadow rays swap the accepted faces, see GeometryUtils::GetShadowCullMode
+		uint32_t(*closestTriangle)(const PackedTriangles& triangles, uint32_t first, uint32_t count, const Ray& ray, bool isShadowRay, float& closestT) {};
+
+		//Occlusion variants, same signatures but they return the first primitive hit closer than closestT instead of the closest one
+		uint32_t(*anySphere)(const PackedSpheres& spheres, uint32_t first, uint32_t count, const Ray& ray, float& closestT) {};
+		uint32_t(*anyPlane)(const PackedPlanes& planes, uint32_t first, uint32_t count, const Ray& ray, float& closestT) {};
+		uint32_t(*anyTriangle)(const PackedTriangles& triangles, uint32_t first, uint32_t count, const Ray& ray, bool isShadowRay, float& closestT) {};
+	};
+
+	//Picks the widest kernel set the CPU supports, detection only runs once
+	const GeometryKernels& GetGeometryKernels();
+#pragma endregion
+}
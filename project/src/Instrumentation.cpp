@@ -0,0 +1,148 @@
+#include "Instrumentation.h"
+
+//Standard includes
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+namespace dae
+{
+	namespace Instrumentation
+	{
+		namespace
+		{
+			struct Registry
+			{
+				std::mutex mutex{};
+				std::vector<ThreadCounters*> threadCounters{};
+				//Counts of the threads that exited during the current frame
+				std::array<uint64_t, CounterCount> retiredCounts{};
+				std::array<double, StageCount> stageMilliseconds{};
+				FrameStatistics lastFrame{};
+				uint64_t frameIndex{};
+			};
+
+			//Constructed by the first ThreadCounters, so it outlives every one of them
+			Registry& GetRegistry()
+			{
+				static Registry registry{};
+				return registry;
+			}
+
+			constexpr const char* CounterNames[CounterCount]{ "primary_rays", "shadow_rays", "slab_tests", "triangle_tests", "sphere_tests", "plane_tests", "shading_calls" };
+			constexpr const char* StageNames[StageCount]{ "scene_update", "render", "resolve", "present" };
+		}
+
+		ThreadCounters::ThreadCounters()
+		{
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+			registry.threadCounters.push_back(this);
+		}
+
+		ThreadCounters::~ThreadCounters()
+		{
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+			for (size_t inx = 0; inx < CounterCount; ++inx)
+			{
+				registry.retiredCounts[inx] += counts[inx];
+			}
+			registry.threadCounters.erase(std::find(registry.threadCounters.begin(), registry.threadCounters.end(), this));
+		}
+
+		void AddStageTime(Stage stage, double milliseconds)
+		{
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+			registry.stageMilliseconds[static_cast<size_t>(stage)] += milliseconds;
+		}
+
+		void EndFrame()
+		{
+			if constexpr (!IsEnabled)
+				return;
+
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+
+			FrameStatistics& frame = registry.lastFrame;
+			frame.frameIndex = registry.frameIndex++;
+			frame.counters = registry.retiredCounts;
+			frame.stageMilliseconds = registry.stageMilliseconds;
+			for (ThreadCounters* pCounters : registry.threadCounters)
+			{
+				for (size_t inx = 0; inx < CounterCount; ++inx)
+				{
+					frame.counters[inx] += pCounters->counts[inx];
+				}
+				pCounters->counts = {};
+			}
+
+			registry.retiredCounts = {};
+			registry.stageMilliseconds = {};
+		}
+
+		const FrameStatistics& GetLastFrame()
+		{
+			return GetRegistry().lastFrame;
+		}
+
+		const char* GetCounterName(Counter counter)
+		{
+			return CounterNames[static_cast<size_t>(counter)];
+		}
+
+		const char* GetStageName(Stage stage)
+		{
+			return StageNames[static_cast<size_t>(stage)];
+		}
+
+		void Print(std::ostream& stream, const FrameStatistics& statistics)
+		{
+			stream << "Frame " << statistics.frameIndex << ":";
+			for (size_t inx = 0; inx < CounterCount; ++inx)
+			{
+				stream << ' ' << CounterNames[inx] << '=' << statistics.counters[inx];
+			}
+
+			stream << " |" << std::fixed << std::setprecision(2);
+			for (size_t inx = 0; inx < StageCount; ++inx)
+			{
+				stream << ' ' << StageNames[inx] << '=' << statistics.stageMilliseconds[inx] << "ms";
+			}
+			stream << std::defaultfloat << std::endl;
+		}
+
+		void WriteCsvHeader(std::ostream& stream)
+		{
+			stream << "frame";
+			for (const char* pName : CounterNames)
+			{
+				stream << ',' << pName;
+			}
+			for (const char* pName : StageNames)
+			{
+				stream << ',' << pName << "_ms";
+			}
+			stream << '\n';
+		}
+
+		void WriteCsvRow(std::ostream& stream, const FrameStatistics& statistics)
+		{
+			stream << statistics.frameIndex;
+			for (uint64_t count : statistics.counters)
+			{
+				stream << ',' << count;
+			}
+
+			stream << std::fixed << std::setprecision(4);
+			for (double milliseconds : statistics.stageMilliseconds)
+			{
+				stream << ',' << milliseconds;
+			}
+			stream << std::defaultfloat << '\n';
+		}
+	}
+}
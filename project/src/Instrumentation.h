@@ -0,0 +1,143 @@
+#pragma once
+
+//Standard includes
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "Trace.h"
+
+namespace dae
+{
+	/**
+	 * Per-frame counters and stage timers for the render loop, compiled in by the CMake option ENABLE_INSTRUMENTATION (defines DAE_INSTRUMENTATION).
+	 * Every thread counts into its own block, so a hot-path Add is a plain increment without atomics or locks,
+	 * and EndFrame merges the blocks into the frame totals. Without the define every call below compiles to nothing
+	 */
+	namespace Instrumentation
+	{
+#if defined(DAE_INSTRUMENTATION)
+		constexpr bool IsEnabled{ true };
+#else
+		constexpr bool IsEnabled{ false };
+#endif
+
+		enum class Counter : uint32_t
+		{
+			PrimaryRays,
+			ShadowRays,
+			SlabTests, //ray vs. box, BVH nodes and mesh bounds. Packet tests count one per active lane
+			TriangleTests, //includes the lanes a SIMD kernel was handed
+			SphereTests,
+			PlaneTests,
+			ShadingCalls, //material evaluations, one per lit light per hit
+
+			Count
+		};
+
+		enum class Stage : uint32_t
+		{
+			SceneUpdate, //Scene::Update and the acceleration structure refit/rebuild
+			Render, //tracing and shading, without resolve and present
+			Resolve,
+			Present,
+
+			Count
+		};
+
+		constexpr size_t CounterCount{ static_cast<size_t>(Counter::Count) };
+		constexpr size_t StageCount{ static_cast<size_t>(Stage::Count) };
+
+		struct FrameStatistics
+		{
+			uint64_t frameIndex{};
+			std::array<uint64_t, CounterCount> counters{};
+			std::array<double, StageCount> stageMilliseconds{};
+		};
+
+		//Registers itself on first use in a thread and hands its counts over to the frame totals when the thread exits
+		struct ThreadCounters final
+		{
+			ThreadCounters();
+			~ThreadCounters();
+
+			ThreadCounters(const ThreadCounters&) = delete;
+			ThreadCounters(ThreadCounters&&) noexcept = delete;
+			ThreadCounters& operator=(const ThreadCounters&) = delete;
+			ThreadCounters& operator=(ThreadCounters&&) noexcept = delete;
+
+			std::array<uint64_t, CounterCount> counts{};
+		};
+
+		inline ThreadCounters& GetThreadCounters()
+		{
+			thread_local ThreadCounters counters{};
+			return counters;
+		}
+
+		inline void Add(Counter counter, uint64_t amount = 1)
+		{
+			if constexpr (IsEnabled)
+				GetThreadCounters().counts[static_cast<size_t>(counter)] += amount;
+		}
+
+		void AddStageTime(Stage stage, double milliseconds);
+
+		const char* GetCounterName(Counter counter);
+		const char* GetStageName(Stage stage);
+
+		//Adds the time until Stop or destruction to the stage, whichever comes first, and marks it on the trace timeline
+		class ScopedStageTimer final
+		{
+		public:
+			explicit ScopedStageTimer(Stage stage) :
+				m_Stage{ stage }
+			{
+				if constexpr (IsEnabled)
+					m_Start = std::chrono::steady_clock::now();
+			}
+			~ScopedStageTimer()
+			{
+				Stop();
+			}
+
+			ScopedStageTimer(const ScopedStageTimer&) = delete;
+			ScopedStageTimer(ScopedStageTimer&&) noexcept = delete;
+			ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+			ScopedStageTimer& operator=(ScopedStageTimer&&) noexcept = delete;
+
+			void Stop()
+			{
+				if constexpr (IsEnabled)
+				{
+					if (m_IsStopped)
+						return;
+
+					m_IsStopped = true;
+					const std::chrono::steady_clock::time_point end{ std::chrono::steady_clock::now() };
+					AddStageTime(m_Stage, std::chrono::duration<double, std::milli>(end - m_Start).count());
+					Trace::Record(GetStageName(m_Stage), m_Start, end);
+				}
+			}
+
+		private:
+			Stage m_Stage;
+			std::chrono::steady_clock::time_point m_Start{};
+			bool m_IsStopped{ false };
+		};
+
+		/**
+		 * \brief Merges every thread's counters and the stage times into GetLastFrame and starts the next frame from zero
+		 * Call it between frames on the render loop's thread, while the worker threads are idle
+		 */
+		void EndFrame();
+		const FrameStatistics& GetLastFrame();
+
+		//One line per frame for the console
+		void Print(std::ostream& stream, const FrameStatistics& statistics);
+		//Per-frame statistics file (--stats), one header and then a row per EndFrame
+		void WriteCsvHeader(std::ostream& stream);
+		void WriteCsvRow(std::ostream& stream, const FrameStatistics& statistics);
+	}
+}
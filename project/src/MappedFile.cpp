@@ -0,0 +1,75 @@
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace dae
+{
+#if defined(_WIN32)
+	MappedFile::MappedFile(const std::string& path)
+	{
+		const HANDLE file{ CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr) };
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		m_FileHandle = file;
+
+		LARGE_INTEGER fileSize{};
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			return;
+
+		//A mapping of an empty file fails, so the size check above also covers that
+		m_MappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_MappingHandle)
+			return;
+
+		m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_MappingHandle, FILE_MAP_READ, 0, 0, 0));
+		if (m_pData)
+			m_Size = static_cast<size_t>(fileSize.QuadPart);
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_pData)
+			UnmapViewOfFile(m_pData);
+		if (m_MappingHandle)
+			CloseHandle(m_MappingHandle);
+		if (m_FileHandle)
+			CloseHandle(m_FileHandle);
+	}
+#else
+	MappedFile::MappedFile(const std::string& path)
+	{
+		const int fileDescriptor{ open(path.c_str(), O_RDONLY) };
+		if (fileDescriptor < 0)
+			return;
+
+		struct stat fileStatus {};
+		if (fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0)
+		{
+			void* pMapping{ mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_PRIVATE, fileDescriptor, 0) };
+			if (pMapping != MAP_FAILED)
+			{
+				m_pData = static_cast<const uint8_t*>(pMapping);
+				m_Size = static_cast<size_t>(fileStatus.st_size);
+			}
+		}
+
+		//The mapping keeps its own reference to the file
+		close(fileDescriptor);
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (m_pData)
+			munmap(const_cast<uint8_t*>(m_pData), m_Size);
+	}
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+//Standard includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	//Read-only view of a whole file through the OS page cache, nothing is copied until the data is touched
+	class MappedFile final
+	{
+	public:
+		//Maps the file, IsOpen is false when it doesn't exist, is empty or can't be mapped
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile(MappedFile&&) noexcept = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile& operator=(MappedFile&&) noexcept = delete;
+
+		bool IsOpen() const { return m_pData != nullptr; }
+		const uint8_t* GetData() const { return m_pData; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const uint8_t* m_pData{};
+		size_t m_Size{};
+
+#if defined(_WIN32)
+		void* m_FileHandle{};
+		void* m_MappingHandle{};
+#endif
+	};
+}
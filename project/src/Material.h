@@ -1,112 +1,125 @@
 #pragma once
+#include <cstdint>
+#include <memory_resource>
+#include <stdexcept>
+#include <vector>
+
 #include "Maths.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
+#include "Instrumentation.h"
 
 namespace dae
 {
 #pragma region Material BASE
-	class Material
+	//Closed set of material types, the material table keeps one parameter block per type and switches on it instead of going through a vtable
+	enum class MaterialType : uint8_t
 	{
-	public:
-		Material() = default;
-		virtual ~Material() = default;
+		SolidColor,
+		Lambert,
+		LambertPhong,
+		CookTorrence
+	};
 
-		Material(const Material&) = delete;
-		Material(Material&&) noexcept = delete;
-		Material& operator=(const Material&) = delete;
-		Material& operator=(Material&&) noexcept = delete;
+	//MaterialHandle layout: the material type in the top 8 bits, the slot in that type's parameter arrays in the low 24
+	constexpr uint32_t MaterialSlotBits{ 24 };
+	constexpr uint32_t MaxMaterialSlots{ 1u << MaterialSlotBits };
 
-		/**
-		 * \brief Function used to calculate the correct color for the specific material and its parameters
-		 * \param hitRecord current hitrecord
-		 * \param l light direction
-		 * \param v view direction
-		 * \return color
-		 */
-		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
-	};
+	constexpr MaterialHandle MakeMaterialHandle(MaterialType type, uint32_t slot)
+	{
+		return (static_cast<uint32_t>(type) << MaterialSlotBits) | slot;
+	}
+
+	constexpr MaterialType GetMaterialType(MaterialHandle handle)
+	{
+		return static_cast<MaterialType>(handle >> MaterialSlotBits);
+	}
+
+	constexpr uint32_t GetMaterialSlot(MaterialHandle handle)
+	{
+		return handle & (MaxMaterialSlots - 1);
+	}
 #pragma endregion
 
 #pragma region Material SOLID COLOR
 	//SOLID COLOR
 	//===========
-	class Material_SolidColor final : public Material
+	struct Material_SolidColor final
 	{
-	public:
-		Material_SolidColor(const ColorRGB& color) : m_Color(color)
+		static constexpr MaterialType Type{ MaterialType::SolidColor };
+
+		Material_SolidColor(const ColorRGB& _color) : color(_color)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
 		{
-			return m_Color;
+			return color;
 		}
 
-	private:
-		ColorRGB m_Color{ colors::White };
+		ColorRGB color{ colors::White };
 	};
 #pragma endregion
 
 #pragma region Material LAMBERT
 	//LAMBERT
 	//=======
-	class Material_Lambert final : public Material
+	struct Material_Lambert final
 	{
-	public:
-		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance) {}
+		static constexpr MaterialType Type{ MaterialType::Lambert };
+
+		Material_Lambert(const ColorRGB& _diffuseColor, float _diffuseReflectance) :
+			diffuseColor(_diffuseColor), diffuseReflectance(_diffuseReflectance) {}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) const
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			return BRDF::Lambert(diffuseReflectance, diffuseColor);
 		}
 
-	private:
-		ColorRGB m_DiffuseColor{ colors::White };
-		float m_DiffuseReflectance{ 1.f }; //kd
+		ColorRGB diffuseColor{ colors::White };
+		float diffuseReflectance{ 1.f }; //kd
 	};
 #pragma endregion
 
 #pragma region Material LAMBERT PHONG
 	//LAMBERT-PHONG
 	//=============
-	class Material_LambertPhong final : public Material
+	struct Material_LambertPhong final
 	{
-	public:
-		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(kd), m_SpecularReflectance(ks),
-			m_PhongExponent(phongExponent)
+		static constexpr MaterialType Type{ MaterialType::LambertPhong };
+
+		Material_LambertPhong(const ColorRGB& _diffuseColor, float kd, float ks, float _phongExponent) :
+			diffuseColor(_diffuseColor), diffuseReflectance(kd), specularReflectance(ks), phongExponent(_phongExponent)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) const
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor) + BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, -v, hitRecord.normal);
+			return BRDF::Lambert(diffuseReflectance, diffuseColor) + BRDF::Phong(specularReflectance, phongExponent, l, -v, hitRecord.normal);
 		}
 
-	private:
-		ColorRGB m_DiffuseColor{ colors::White };
-		float m_DiffuseReflectance{ 0.5f }; //kd
-		float m_SpecularReflectance{ 0.5f }; //ks
-		float m_PhongExponent{ 1.f }; //Phong Exponent
+		ColorRGB diffuseColor{ colors::White };
+		float diffuseReflectance{ 0.5f }; //kd
+		float specularReflectance{ 0.5f }; //ks
+		float phongExponent{ 1.f }; //Phong Exponent
 	};
 #pragma endregion
 
 #pragma region Material COOK TORRENCE
 	//COOK TORRENCE
-	class Material_CookTorrence final : public Material
+	struct Material_CookTorrence final
 	{
-	public:
-		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness) :
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+		static constexpr MaterialType Type{ MaterialType::CookTorrence };
+
+		Material_CookTorrence(const ColorRGB& _albedo, float _metalness, float _roughness) :
+			albedo(_albedo), metalness(_metalness), roughness(_roughness)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) const
 		{
-			auto f0 = m_Albedo;
-			if (m_Metalness == 0.f)
+			auto f0 = albedo;
+			if (metalness == 0.f)
 			{
 				f0 = ColorRGB(0.04f, 0.04f, 0.04f);
 			}
@@ -114,30 +127,194 @@ namespace dae
 			auto h = Vector3(v + l) / Vector3(v + l).Magnitude();
 
 			const auto F = BRDF::FresnelFunction_Schlick(h, v, f0);
-			const auto D = BRDF::NormalDistribution_GGX(hitRecord.normal, h, m_Roughness);
-			const auto G = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, m_Roughness);
+			const auto D = BRDF::NormalDistribution_GGX(hitRecord.normal, h, roughness);
+			const auto G = BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, roughness);
 
 
 			const auto CT = ColorRGB((D * F * G)) / (4 * Vector3::Dot(v, hitRecord.normal) * Vector3::Dot(l, hitRecord.normal));
 
 			auto kd = ColorRGB(1.f, 1.f, 1.f) - F;
 
-			if (m_Metalness == 1.0f)
+			if (metalness == 1.0f)
 			{
 				kd = ColorRGB(0.f, 0.f, 0.f);
 			}
 
 			
-			auto finalColor = BRDF::Lambert(kd, m_Albedo) + CT;
+			auto finalColor = BRDF::Lambert(kd, albedo) + CT;
 
 			return finalColor;
 		
 		}
 
+		ColorRGB albedo{ 0.955f, 0.637f, 0.538f }; //Copper
+		float metalness{ 1.0f };
+		float roughness{ 0.1f }; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+	};
+#pragma endregion
+
+#pragma region Material TABLE
+	//Per channel arrays, so a parameter block stays structure-of-arrays down to the colors
+	struct PackedColors
+	{
+		explicit PackedColors(std::pmr::memory_resource* pResource) :
+			r(pResource), g(pResource), b(pResource) {}
+
+		std::pmr::vector<float> r, g, b;
+
+		void Add(const ColorRGB& color)
+		{
+			r.push_back(color.r);
+			g.push_back(color.g);
+			b.push_back(color.b);
+		}
+
+		ColorRGB Get(uint32_t slot) const
+		{
+			return ColorRGB{ r[slot], g[slot], b[slot] };
+		}
+	};
+
+	/**
+	 * Every material of a scene, stored by value without a heap object per material. Each type has its own parameter block
+	 * with one array per parameter, so the table stays sorted by type and a handle only needs the type and a slot.
+	 * Handles stay valid as materials are added, at most MaxMaterialSlots materials per type
+	 */
+	class MaterialTable final
+	{
+	public:
+		//Every parameter array is allocated from pResource, a scene passes its arena
+		explicit MaterialTable(std::pmr::memory_resource* pResource = std::pmr::get_default_resource()) :
+			m_SolidColors(pResource), m_Lamberts(pResource), m_LambertPhongs(pResource), m_CookTorrences(pResource)
+		{
+		}
+		~MaterialTable() = default;
+
+		MaterialTable(const MaterialTable&) = delete;
+		MaterialTable(MaterialTable&&) noexcept = delete;
+		MaterialTable& operator=(const MaterialTable&) = delete;
+		MaterialTable& operator=(MaterialTable&&) noexcept = delete;
+
+		MaterialHandle Add(const Material_SolidColor& material)
+		{
+			const MaterialHandle handle{ CreateHandle(MaterialType::SolidColor, m_SolidColors.color.r.size()) };
+			m_SolidColors.color.Add(material.color);
+			return handle;
+		}
+
+		MaterialHandle Add(const Material_Lambert& material)
+		{
+			const MaterialHandle handle{ CreateHandle(MaterialType::Lambert, m_Lamberts.diffuseReflectance.size()) };
+			m_Lamberts.diffuseColor.Add(material.diffuseColor);
+			m_Lamberts.diffuseReflectance.push_back(material.diffuseReflectance);
+			return handle;
+		}
+
+		MaterialHandle Add(const Material_LambertPhong& material)
+		{
+			const MaterialHandle handle{ CreateHandle(MaterialType::LambertPhong, m_LambertPhongs.diffuseReflectance.size()) };
+			m_LambertPhongs.diffuseColor.Add(material.diffuseColor);
+			m_LambertPhongs.diffuseReflectance.push_back(material.diffuseReflectance);
+			m_LambertPhongs.specularReflectance.push_back(material.specularReflectance);
+			m_LambertPhongs.phongExponent.push_back(material.phongExponent);
+			return handle;
+		}
+
+		MaterialHandle Add(const Material_CookTorrence& material)
+		{
+			const MaterialHandle handle{ CreateHandle(MaterialType::CookTorrence, m_CookTorrences.metalness.size()) };
+			m_CookTorrences.albedo.Add(material.albedo);
+			m_CookTorrences.metalness.push_back(material.metalness);
+			m_CookTorrences.roughness.push_back(material.roughness);
+			return handle;
+		}
+
+		uint32_t GetCount() const
+		{
+			return static_cast<uint32_t>(m_SolidColors.color.r.size() + m_Lamberts.diffuseReflectance.size()
+				+ m_LambertPhongs.diffuseReflectance.size() + m_CookTorrences.metalness.size());
+		}
+
+		/**
+		 * \brief Gathers the parameters of a material from its block and shades with them, the switch replaces the virtual call
+		 * \param handle material to shade, as returned by Add
+		 * \param hitRecord current hitrecord
+		 * \param l light direction
+		 * \param v view direction
+		 * \return color
+		 */
+		ColorRGB Shade(MaterialHandle handle, const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			Instrumentation::Add(Instrumentation::Counter::ShadingCalls);
+
+			const uint32_t slot{ GetMaterialSlot(handle) };
+			switch (GetMaterialType(handle))
+			{
+			case MaterialType::SolidColor:
+				return Material_SolidColor{ m_SolidColors.color.Get(slot) }.Shade(hitRecord, l, v);
+			case MaterialType::Lambert:
+				return Material_Lambert{ m_Lamberts.diffuseColor.Get(slot), m_Lamberts.diffuseReflectance[slot] }.Shade(hitRecord, l, v);
+			case MaterialType::LambertPhong:
+				return Material_LambertPhong{ m_LambertPhongs.diffuseColor.Get(slot), m_LambertPhongs.diffuseReflectance[slot],
+					m_LambertPhongs.specularReflectance[slot], m_LambertPhongs.phongExponent[slot] }.Shade(hitRecord, l, v);
+			case MaterialType::CookTorrence:
+				return Material_CookTorrence{ m_CookTorrences.albedo.Get(slot), m_CookTorrences.metalness[slot], m_CookTorrences.roughness[slot] }.Shade(hitRecord, l, v);
+			}
+			return ColorRGB{};
+		}
+
 	private:
-		ColorRGB m_Albedo{ 0.955f, 0.637f, 0.538f }; //Copper
-		float m_Metalness{ 1.0f };
-		float m_Roughness{ 0.1f }; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		struct SolidColorBlock
+		{
+			explicit SolidColorBlock(std::pmr::memory_resource* pResource) :
+				color(pResource) {}
+
+			PackedColors color;
+		};
+
+		struct LambertBlock
+		{
+			explicit LambertBlock(std::pmr::memory_resource* pResource) :
+				diffuseColor(pResource), diffuseReflectance(pResource) {}
+
+			PackedColors diffuseColor;
+			std::pmr::vector<float> diffuseReflectance;
+		};
+
+		struct LambertPhongBlock
+		{
+			explicit LambertPhongBlock(std::pmr::memory_resource* pResource) :
+				diffuseColor(pResource), diffuseReflectance(pResource), specularReflectance(pResource), phongExponent(pResource) {}
+
+			PackedColors diffuseColor;
+			std::pmr::vector<float> diffuseReflectance;
+			std::pmr::vector<float> specularReflectance;
+			std::pmr::vector<float> phongExponent;
+		};
+
+		struct CookTorrenceBlock
+		{
+			explicit CookTorrenceBlock(std::pmr::memory_resource* pResource) :
+				albedo(pResource), metalness(pResource), roughness(pResource) {}
+
+			PackedColors albedo;
+			std::pmr::vector<float> metalness;
+			std::pmr::vector<float> roughness;
+		};
+
+		SolidColorBlock m_SolidColors;
+		LambertBlock m_Lamberts;
+		LambertPhongBlock m_LambertPhongs;
+		CookTorrenceBlock m_CookTorrences;
+
+		static MaterialHandle CreateHandle(MaterialType type, size_t slot)
+		{
+			//A wrapped slot would silently shade with another material
+			if (slot >= MaxMaterialSlots)
+				throw std::length_error("MaterialTable: too many materials of one type");
+
+			return MakeMaterialHandle(type, static_cast<uint32_t>(slot));
+		}
 	};
 #pragma endregion
 }
@@ -1,8 +1,10 @@
 #include <cassert>
+#include <cfloat>
 #include <stdexcept>
 #include <cmath>
 
 #include "Matrix.h"
+#include "MathHelpers.h"
 
 namespace dae {
 	Matrix::Matrix(const Vector3& xAxis, const Vector3& yAxis, const Vector3& zAxis, const Vector3& t) :
@@ -81,6 +83,41 @@ namespace dae {
 		return out;
 	}
 
+	//Assumes an affine matrix (last column 0,0,0,1), which is all the Create* functions produce
+	const Matrix& Matrix::Inverse()
+	{
+		const Vector3 xAxis{ data[0] };
+		const Vector3 yAxis{ data[1] };
+		const Vector3 zAxis{ data[2] };
+
+		//Rows of the inverse 3x3 are the cofactor columns divided by the determinant
+		const Vector3 yCrossZ{ Vector3::Cross(yAxis, zAxis) };
+		const Vector3 zCrossX{ Vector3::Cross(zAxis, xAxis) };
+		const Vector3 xCrossY{ Vector3::Cross(xAxis, yAxis) };
+
+		const float determinant{ Vector3::Dot(xAxis, yCrossZ) };
+		//Relative to the axis lengths, a tiny uniform scale is still invertible while a flattened matrix is not
+		assert(std::abs(determinant) > FLT_EPSILON * xAxis.Magnitude() * yAxis.Magnitude() * zAxis.Magnitude() && "Matrix is not invertible");
+		const float inverseDeterminant{ 1.f / determinant };
+
+		data[0] = { yCrossZ.x * inverseDeterminant, zCrossX.x * inverseDeterminant, xCrossY.x * inverseDeterminant, 0.f };
+		data[1] = { yCrossZ.y * inverseDeterminant, zCrossX.y * inverseDeterminant, xCrossY.y * inverseDeterminant, 0.f };
+		data[2] = { yCrossZ.z * inverseDeterminant, zCrossX.z * inverseDeterminant, xCrossY.z * inverseDeterminant, 0.f };
+
+		const Vector3 translation{ -TransformVector(Vector3{ data[3] }) };
+		data[3] = { translation, 1.f };
+
+		return *this;
+	}
+
+	Matrix Matrix::Inverse(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Inverse();
+
+		return out;
+	}
+
 	Vector3 Matrix::GetAxisX() const
 	{
 		return data[0];
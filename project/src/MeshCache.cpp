@@ -0,0 +1,274 @@
+#include "MeshCache.h"
+
+//Standard includes
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
+#include <numeric>
+#include <system_error>
+#include <vector>
+
+#include "DataTypes.h"
+#include "MappedFile.h"
+#include "ObjParser.h"
+
+namespace dae
+{
+	namespace MeshCache
+	{
+		namespace
+		{
+			constexpr size_t ArrayAlignment{ 16 };
+
+			size_t AlignOffset(size_t offset)
+			{
+				return (offset + ArrayAlignment - 1) & ~(ArrayAlignment - 1);
+			}
+
+			//Byte offset of every array, derived from the counts so the header never stores offsets that could disagree
+			struct CacheLayout
+			{
+				size_t positions{};
+				size_t normals{};
+				size_t vertexNormals{};
+				size_t indices{};
+				size_t nodes{};
+				size_t records{};
+				size_t size{};
+			};
+
+			CacheLayout GetLayout(const MeshCacheHeader& header)
+			{
+				CacheLayout layout{};
+				layout.positions = AlignOffset(sizeof(MeshCacheHeader));
+				layout.normals = AlignOffset(layout.positions + size_t(header.positionCount) * sizeof(Vector3));
+				layout.vertexNormals = AlignOffset(layout.normals + size_t(header.normalCount) * sizeof(Vector3));
+				layout.indices = AlignOffset(layout.vertexNormals + size_t(header.vertexNormalCount) * sizeof(Vector3));
+				layout.nodes = AlignOffset(layout.indices + size_t(header.indexCount) * sizeof(int));
+				layout.records = AlignOffset(layout.nodes + size_t(header.nodeCount) * sizeof(BVHNode));
+				layout.size = layout.records + size_t(header.recordCount) * sizeof(TriangleIntersectionRecord);
+				return layout;
+			}
+
+			bool GetSourceStamp(const std::string& sourcePath, uint64_t& sourceSize, int64_t& sourceWriteTime)
+			{
+				std::error_code error{};
+				sourceSize = std::filesystem::file_size(sourcePath, error);
+				if (error)
+					return false;
+
+				sourceWriteTime = static_cast<int64_t>(std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count());
+				return !error;
+			}
+
+			MeshCacheHeader CreateHeader(uint64_t sourceSize, int64_t sourceWriteTime)
+			{
+				MeshCacheHeader header{};
+				header.vector3Size = sizeof(Vector3);
+				header.nodeSize = sizeof(BVHNode);
+				header.recordSize = sizeof(TriangleIntersectionRecord);
+				header.sourceSize = sourceSize;
+				header.sourceWriteTime = sourceWriteTime;
+				return header;
+			}
+
+			template<typename T>
+			void ReadArray(const uint8_t* pData, size_t offset, uint32_t count, std::pmr::vector<T>& destination)
+			{
+				destination.resize(count);
+				if (count > 0)
+					std::memcpy(destination.data(), pData + offset, size_t(count) * sizeof(T));
+			}
+
+			template<typename T>
+			void WriteArray(std::ofstream& file, size_t offset, const std::pmr::vector<T>& source)
+			{
+				//Zero padding up to the aligned start of the array
+				static constexpr char padding[ArrayAlignment]{};
+				const size_t paddingSize{ offset - static_cast<size_t>(file.tellp()) };
+				file.write(padding, static_cast<std::streamsize>(paddingSize));
+
+				if (!source.empty())
+					file.write(reinterpret_cast<const char*>(source.data()), static_cast<std::streamsize>(source.size() * sizeof(T)));
+			}
+
+			//Everything traversal and the intersection code index with, a damaged cache is rebuilt instead of read out of bounds
+			bool IsConsistent(const std::pmr::vector<int>& indices, uint32_t positionCount, const std::pmr::vector<BVHNode>& nodes, const std::pmr::vector<TriangleIntersectionRecord>& records)
+			{
+				for (int index : indices)
+				{
+					if (index < 0 || uint32_t(index) >= positionCount)
+						return false;
+				}
+
+				for (const BVHNode& node : nodes)
+				{
+					if (node.IsLeaf() ? uint64_t(node.leftFirst) + node.primitiveCount > records.size() : uint64_t(node.leftFirst) + 1 >= nodes.size())
+						return false;
+				}
+
+				for (const TriangleIntersectionRecord& record : records)
+				{
+					if (record.triangleIndex >= records.size())
+						return false;
+				}
+				return true;
+			}
+		}
+
+		std::string GetCachePath(const std::string& objPath)
+		{
+			return std::filesystem::path{ objPath }.replace_extension(".meshcache").string();
+		}
+
+		bool Load(const std::string& cachePath, const std::string& sourcePath, TriangleMesh& mesh)
+		{
+			uint64_t sourceSize{};
+			int64_t sourceWriteTime{};
+			if (!GetSourceStamp(sourcePath, sourceSize, sourceWriteTime))
+				return false;
+
+			const MappedFile file{ cachePath };
+			if (!file.IsOpen() || file.GetSize() < sizeof(MeshCacheHeader))
+				return false;
+
+			MeshCacheHeader header{};
+			std::memcpy(&header, file.GetData(), sizeof(MeshCacheHeader));
+
+			const MeshCacheHeader expectedHeader{ CreateHeader(sourceSize, sourceWriteTime) };
+			if (std::memcmp(header.magic, expectedHeader.magic, sizeof(header.magic)) != 0 || header.version != expectedHeader.version
+				|| header.vector3Size != expectedHeader.vector3Size || header.nodeSize != expectedHeader.nodeSize || header.recordSize != expectedHeader.recordSize
+				|| header.sourceSize != expectedHeader.sourceSize || header.sourceWriteTime != expectedHeader.sourceWriteTime)
+				return false;
+
+			if (header.indexCount % 3 != 0 || header.recordCount != header.indexCount / 3 || header.nodeCount == 0
+				|| (header.vertexNormalCount != 0 && header.vertexNormalCount != header.positionCount))
+				return false;
+
+			const CacheLayout layout{ GetLayout(header) };
+			if (layout.size != file.GetSize())
+				return false;
+
+			//Read with the mesh's allocators, so the moves below hand the arrays over instead of copying them
+			std::pmr::vector<Vector3> positions{ mesh.positions.get_allocator() };
+			std::pmr::vector<Vector3> normals{ mesh.normals.get_allocator() };
+			std::pmr::vector<Vector3> vertexNormals{ mesh.vertexNormals.get_allocator() };
+			std::pmr::vector<int> indices{ mesh.indices.get_allocator() };
+			std::pmr::vector<BVHNode> nodes{ mesh.bvh.nodes.get_allocator() };
+			std::pmr::vector<TriangleIntersectionRecord> records{ mesh.triangleRecords.get_allocator() };
+			ReadArray(file.GetData(), layout.positions, header.positionCount, positions);
+			ReadArray(file.GetData(), layout.normals, header.normalCount, normals);
+			ReadArray(file.GetData(), layout.vertexNormals, header.vertexNormalCount, vertexNormals);
+			ReadArray(file.GetData(), layout.indices, header.indexCount, indices);
+			ReadArray(file.GetData(), layout.nodes, header.nodeCount, nodes);
+			ReadArray(file.GetData(), layout.records, header.recordCount, records);
+
+			if (!IsConsistent(indices, header.positionCount, nodes, records))
+				return false;
+
+			mesh.positions = std::move(positions);
+			mesh.normals = std::move(normals);
+			mesh.vertexNormals = std::move(vertexNormals);
+			mesh.indices = std::move(indices);
+			mesh.triangleRecords = std::move(records);
+
+			//Records are stored in leaf order, same as after TriangleMesh::BuildBVH
+			mesh.bvh.nodes = std::move(nodes);
+			mesh.bvh.primitiveIndices.resize(header.recordCount);
+			std::iota(mesh.bvh.primitiveIndices.begin(), mesh.bvh.primitiveIndices.end(), 0u);
+
+			mesh.UpdateBoundsFromBVH();
+			++mesh.revision;
+			return true;
+		}
+
+		bool Save(const std::string& cachePath, const std::string& sourcePath, const TriangleMesh& mesh)
+		{
+			if (mesh.bvh.IsEmpty() || mesh.triangleRecords.size() * 3 != mesh.indices.size()
+				|| (!mesh.vertexNormals.empty() && mesh.vertexNormals.size() != mesh.positions.size()))
+				return false;
+
+			MeshCacheHeader header{};
+			if (!GetSourceStamp(sourcePath, header.sourceSize, header.sourceWriteTime))
+				return false;
+
+			header = CreateHeader(header.sourceSize, header.sourceWriteTime);
+			header.positionCount = static_cast<uint32_t>(mesh.positions.size());
+			header.normalCount = static_cast<uint32_t>(mesh.normals.size());
+			header.vertexNormalCount = static_cast<uint32_t>(mesh.vertexNormals.size());
+			header.indexCount = static_cast<uint32_t>(mesh.indices.size());
+			header.nodeCount = static_cast<uint32_t>(mesh.bvh.nodes.size());
+			header.recordCount = static_cast<uint32_t>(mesh.triangleRecords.size());
+
+			const CacheLayout layout{ GetLayout(header) };
+			const std::string temporaryPath{ cachePath + ".tmp" };
+			{
+				std::ofstream file{ temporaryPath, std::ios::binary | std::ios::trunc };
+				if (!file)
+					return false;
+
+				file.write(reinterpret_cast<const char*>(&header), sizeof(MeshCacheHeader));
+				WriteArray(file, layout.positions, mesh.positions);
+				WriteArray(file, layout.normals, mesh.normals);
+				WriteArray(file, layout.vertexNormals, mesh.vertexNormals);
+				WriteArray(file, layout.indices, mesh.indices);
+				WriteArray(file, layout.nodes, mesh.bvh.nodes);
+				WriteArray(file, layout.records, mesh.triangleRecords);
+
+				file.close();
+				if (!file)
+				{
+					std::error_code error{};
+					std::filesystem::remove(temporaryPath, error);
+					return false;
+				}
+			}
+
+			std::error_code error{};
+			std::filesystem::rename(temporaryPath, cachePath, error);
+			if (error)
+			{
+				std::filesystem::remove(temporaryPath, error);
+				return false;
+			}
+			return true;
+		}
+
+		bool LoadOBJ(const std::string& objPath, TriangleMesh& mesh)
+		{
+			const std::string cachePath{ GetCachePath(objPath) };
+			if (Load(cachePath, objPath, mesh))
+				return true;
+
+			//Nothing samples uvs, a vt seam would otherwise split the vertices and crease the smooth normals along it
+			ObjMesh objMesh{};
+			if (!Utils::ParseOBJ(objPath, objMesh, false))
+				return false;
+
+			mesh.positions.assign(objMesh.positions.begin(), objMesh.positions.end());
+			mesh.indices.assign(objMesh.indices.begin(), objMesh.indices.end());
+			mesh.normals.clear();
+			mesh.CalculateNormals();
+
+			//Normals from the file win, the vertices it left out get generated ones
+			mesh.vertexNormals.clear();
+			if (objMesh.isSmoothShaded || !objMesh.normals.empty())
+			{
+				mesh.CalculateVertexNormals();
+				for (size_t inx = 0; inx < objMesh.normals.size(); ++inx)
+				{
+					if (objMesh.normals[inx].SqrMagnitude() > 0.f)
+						mesh.vertexNormals[inx] = objMesh.normals[inx].Normalized();
+				}
+			}
+
+			//Built here instead of on the first UpdateTransforms so the cache can store the nodes
+			mesh.BuildBVH();
+
+			//A read-only resource folder only costs the speedup, the parsed mesh is still fine
+			Save(cachePath, objPath, mesh);
+			return true;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+//Standard includes
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	struct TriangleMesh;
+
+	/**
+	 * Binary copy of a parsed OBJ, written next to it so later loads skip the text parsing and the BVH build.
+	 * Layout: MeshCacheHeader, then the positions, face normals, vertex normals, indices, BVH nodes and leaf ordered triangle records,
+	 * every array starting on a 16 byte boundary
+	 */
+	namespace MeshCache
+	{
+		//Bump whenever the layout or the content of any stored array changes, older caches are then rebuilt
+		constexpr uint32_t Version{ 4 };
+
+		struct MeshCacheHeader
+		{
+			char magic[4]{ 'D', 'M', 'S', 'H' };
+			uint32_t version{ Version };
+
+			//A cache written by a build with different struct layouts is rebuilt instead of misread
+			uint32_t vector3Size{};
+			uint32_t nodeSize{};
+			uint32_t recordSize{};
+
+			uint32_t positionCount{};
+			uint32_t normalCount{};
+			uint32_t vertexNormalCount{}; //0 for flat shaded meshes, the position count otherwise
+			uint32_t indexCount{};
+			uint32_t nodeCount{};
+			uint32_t recordCount{};
+
+			//The source OBJ the cache was made from, any change to it makes the cache stale
+			uint64_t sourceSize{};
+			int64_t sourceWriteTime{};
+		};
+
+		//"resources/lowpoly_bunny.obj" -> "resources/lowpoly_bunny.meshcache"
+		std::string GetCachePath(const std::string& objPath);
+
+		//Maps the cache and copies its arrays into the mesh, false when it is missing, stale or malformed
+		bool Load(const std::string& cachePath, const std::string& sourcePath, TriangleMesh& mesh);
+		//Writes a mesh whose BVH is built, through a temporary file so a crash never leaves half a cache behind
+		bool Save(const std::string& cachePath, const std::string& sourcePath, const TriangleMesh& mesh);
+
+		/**
+		 * \brief Utils::ParseOBJ through the cache: loads it when it is up to date, otherwise parses the OBJ,
+		 * builds the mesh BVH and writes the cache for the next run. Vertex normals come from the file's vn,
+		 * are generated with TriangleMesh::CalculateVertexNormals when it has none, and stay empty when it turns smoothing off
+		 * \return false only when the OBJ itself can't be read
+		 */
+		bool LoadOBJ(const std::string& objPath, TriangleMesh& mesh);
+	}
+}
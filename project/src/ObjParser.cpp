@@ -0,0 +1,379 @@
+#include "ObjParser.h"
+
+//Standard includes
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+namespace dae
+{
+	namespace
+	{
+		//Smaller files are parsed on the calling thread, starting the worker threads would cost more than it saves
+		constexpr size_t ParallelFileSize{ 1 << 20 };
+		//Several chunks per thread keep every thread busy when some parts of the file have longer lines
+		constexpr size_t ChunkSize{ 1 << 20 };
+
+		//Element indices of one face corner, raw as written while parsing and 0-based afterwards
+		struct ObjCorner
+		{
+			int position{};
+			int texCoord{};
+			int normal{};
+		};
+
+		struct ObjFace
+		{
+			uint32_t firstCorner{};
+			uint32_t cornerCount{};
+			//Elements the chunk had read before the face, negative indices count back from these
+			uint32_t positionCount{};
+			uint32_t texCoordCount{};
+			uint32_t normalCount{};
+		};
+
+		//Lines [pBegin, pEnd) of the file, parsed independently of the other chunks
+		struct ObjChunk
+		{
+			const char* pBegin{};
+			const char* pEnd{};
+
+			std::vector<Vector3> positions{};
+			std::vector<Vector3> texCoords{};
+			std::vector<Vector3> normals{};
+			std::vector<ObjCorner> corners{};
+			std::vector<ObjFace> faces{};
+
+			//Elements in the chunks before this one
+			uint32_t positionOffset{};
+			uint32_t texCoordOffset{};
+			uint32_t normalOffset{};
+
+			//Three 0-based corners per triangle, -1 for a missing vt or vn
+			std::vector<ObjCorner> triangleCorners{};
+			bool hasTexCoords{};
+			bool hasNormals{};
+
+			//Smoothing group statements, s off / s 0 and s <group>
+			bool hasFlatGroups{};
+			bool hasSmoothGroups{};
+		};
+
+		bool IsSpace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		const char* SkipSpaces(const char* p, const char* pEnd)
+		{
+			while (p < pEnd && IsSpace(*p))
+			{
+				++p;
+			}
+			return p;
+		}
+
+		//Up to three floats, the ones that are missing stay 0
+		Vector3 ParseVector(const char* p, const char* pEnd)
+		{
+			float values[3]{};
+			for (float& value : values)
+			{
+				p = SkipSpaces(p, pEnd);
+				if (p < pEnd && *p == '+')
+					++p;
+
+				const std::from_chars_result result{ std::from_chars(p, pEnd, value) };
+				if (result.ec != std::errc{})
+					break;
+				p = result.ptr;
+			}
+			return Vector3{ values[0], values[1], values[2] };
+		}
+
+		//"a", "a/b", "a//c" or "a/b/c", nullptr when the token doesn't start with an index
+		const char* ParseCorner(const char* p, const char* pEnd, ObjCorner& corner)
+		{
+			std::from_chars_result result{ std::from_chars(p, pEnd, corner.position) };
+			if (result.ec != std::errc{})
+				return nullptr;
+			p = result.ptr;
+
+			if (p == pEnd || *p != '/')
+				return p;
+
+			++p;
+			result = std::from_chars(p, pEnd, corner.texCoord);
+			if (result.ec == std::errc{})
+				p = result.ptr;
+
+			if (p == pEnd || *p != '/')
+				return p;
+
+			++p;
+			result = std::from_chars(p, pEnd, corner.normal);
+			return result.ec == std::errc{} ? result.ptr : p;
+		}
+
+		void ParseLine(const char* p, const char* pEnd, ObjChunk& chunk)
+		{
+			p = SkipSpaces(p, pEnd);
+			if (pEnd - p < 2)
+				return;
+
+			if (p[0] == 'v')
+			{
+				if (IsSpace(p[1]))
+					chunk.positions.push_back(ParseVector(p + 2, pEnd));
+				else if (pEnd - p > 2 && p[1] == 't' && IsSpace(p[2]))
+					chunk.texCoords.push_back(ParseVector(p + 3, pEnd));
+				else if (pEnd - p > 2 && p[1] == 'n' && IsSpace(p[2]))
+					chunk.normals.push_back(ParseVector(p + 3, pEnd));
+				return;
+			}
+
+			if (p[0] == 's' && IsSpace(p[1]))
+			{
+				p = SkipSpaces(p + 2, pEnd);
+				const bool isOff{ (pEnd - p >= 3 && std::memcmp(p, "off", 3) == 0) || (p < pEnd && *p == '0') };
+				chunk.hasFlatGroups |= isOff;
+				chunk.hasSmoothGroups |= !isOff;
+				return;
+			}
+
+			if (p[0] != 'f' || !IsSpace(p[1]))
+				return;
+
+			ObjFace face{};
+			face.firstCorner = static_cast<uint32_t>(chunk.corners.size());
+			face.positionCount = static_cast<uint32_t>(chunk.positions.size());
+			face.texCoordCount = static_cast<uint32_t>(chunk.texCoords.size());
+			face.normalCount = static_cast<uint32_t>(chunk.normals.size());
+
+			p += 2;
+			while ((p = SkipSpaces(p, pEnd)) < pEnd)
+			{
+				ObjCorner corner{};
+				p = ParseCorner(p, pEnd, corner);
+				if (!p)
+					break;
+				chunk.corners.push_back(corner);
+			}
+
+			face.cornerCount = static_cast<uint32_t>(chunk.corners.size()) - face.firstCorner;
+			if (face.cornerCount >= 3)
+				chunk.faces.push_back(face);
+			else
+				chunk.corners.resize(face.firstCorner);
+		}
+
+		void ParseChunk(ObjChunk& chunk)
+		{
+			for (const char* pLine = chunk.pBegin; pLine < chunk.pEnd;)
+			{
+				const char* pLineEnd{ static_cast<const char*>(std::memchr(pLine, '\n', chunk.pEnd - pLine)) };
+				if (!pLineEnd)
+					pLineEnd = chunk.pEnd;
+
+				ParseLine(pLine, pLineEnd, chunk);
+				pLine = pLineEnd + 1;
+			}
+		}
+
+		//OBJ indices are 1-based, negative ones count back from the last element defined before the face. -1 when invalid
+		int ResolveIndex(int index, uint32_t countBefore, uint32_t totalCount)
+		{
+			const int64_t resolvedIndex{ index > 0 ? int64_t(index) - 1 : int64_t(countBefore) + index };
+			return index != 0 && resolvedIndex >= 0 && resolvedIndex < totalCount ? static_cast<int>(resolvedIndex) : -1;
+		}
+
+		void TriangulateChunk(ObjChunk& chunk, uint32_t positionCount, uint32_t texCoordCount, uint32_t normalCount)
+		{
+			std::vector<ObjCorner> faceCorners{};
+			for (const ObjFace& face : chunk.faces)
+			{
+				faceCorners.clear();
+				bool isValid{ true };
+				for (uint32_t inx = face.firstCorner; inx < face.firstCorner + face.cornerCount && isValid; ++inx)
+				{
+					const ObjCorner& corner = chunk.corners[inx];
+					const ObjCorner resolvedCorner{
+						ResolveIndex(corner.position, chunk.positionOffset + face.positionCount, positionCount),
+						corner.texCoord != 0 ? ResolveIndex(corner.texCoord, chunk.texCoordOffset + face.texCoordCount, texCoordCount) : -1,
+						corner.normal != 0 ? ResolveIndex(corner.normal, chunk.normalOffset + face.normalCount, normalCount) : -1 };
+
+					//An index that was written but points nowhere makes the whole face unusable
+					isValid = resolvedCorner.position >= 0 && (corner.texCoord == 0 || resolvedCorner.texCoord >= 0) && (corner.normal == 0 || resolvedCorner.normal >= 0);
+					faceCorners.push_back(resolvedCorner);
+				}
+
+				if (!isValid)
+					continue;
+
+				//Fan around the first corner, exact for the convex polygons exporters write
+				for (size_t inx = 1; inx + 1 < faceCorners.size(); ++inx)
+				{
+					chunk.triangleCorners.push_back(faceCorners[0]);
+					chunk.triangleCorners.push_back(faceCorners[inx]);
+					chunk.triangleCorners.push_back(faceCorners[inx + 1]);
+				}
+
+				for (const ObjCorner& corner : faceCorners)
+				{
+					chunk.hasTexCoords |= corner.texCoord >= 0;
+					chunk.hasNormals |= corner.normal >= 0;
+				}
+			}
+		}
+
+		template<typename Element>
+		std::vector<Element> Concatenate(const std::vector<ObjChunk>& chunks, std::vector<Element> ObjChunk::* pElements)
+		{
+			size_t elementCount{ 0 };
+			for (const ObjChunk& chunk : chunks)
+			{
+				elementCount += (chunk.*pElements).size();
+			}
+
+			std::vector<Element> elements{};
+			elements.reserve(elementCount);
+			for (const ObjChunk& chunk : chunks)
+			{
+				elements.insert(elements.end(), (chunk.*pElements).begin(), (chunk.*pElements).end());
+			}
+			return elements;
+		}
+	}
+
+	namespace Utils
+	{
+		bool ParseOBJ(const std::string& filename, ObjMesh& mesh, bool readTexCoords, uint32_t threadCount)
+		{
+			const MappedFile file{ filename };
+			if (!file.IsOpen())
+				return false;
+
+			const char* pFile{ reinterpret_cast<const char*>(file.GetData()) };
+			const char* pFileEnd{ pFile + file.GetSize() };
+
+			//Chunks start right after a line break, so no line is split between two of them
+			const size_t chunkCount{ file.GetSize() >= ParallelFileSize ? (file.GetSize() + ChunkSize - 1) / ChunkSize : 1 };
+			std::vector<ObjChunk> chunks(chunkCount);
+			for (size_t inx = 0; inx < chunkCount; ++inx)
+			{
+				ObjChunk& chunk = chunks[inx];
+				chunk.pBegin = inx == 0 ? pFile : chunks[inx - 1].pEnd;
+
+				const char* pSplit{ std::max(chunk.pBegin, pFile + file.GetSize() * (inx + 1) / chunkCount) };
+				const char* pLineBreak{ inx + 1 < chunkCount ? static_cast<const char*>(std::memchr(pSplit, '\n', pFileEnd - pSplit)) : nullptr };
+				chunk.pEnd = pLineBreak ? pLineBreak + 1 : pFileEnd;
+			}
+
+			ThreadPool threadPool{ chunkCount > 1 ? threadCount : 1 };
+			threadPool.ParallelFor(static_cast<uint32_t>(chunkCount), [&](uint32_t chunkIndex)
+				{
+					ParseChunk(chunks[chunkIndex]);
+				});
+
+			uint32_t positionCount{ 0 }, texCoordCount{ 0 }, normalCount{ 0 };
+			for (ObjChunk& chunk : chunks)
+			{
+				chunk.positionOffset = positionCount;
+				chunk.texCoordOffset = texCoordCount;
+				chunk.normalOffset = normalCount;
+				positionCount += static_cast<uint32_t>(chunk.positions.size());
+				texCoordCount += static_cast<uint32_t>(chunk.texCoords.size());
+				normalCount += static_cast<uint32_t>(chunk.normals.size());
+			}
+
+			threadPool.ParallelFor(static_cast<uint32_t>(chunkCount), [&](uint32_t chunkIndex)
+				{
+					TriangulateChunk(chunks[chunkIndex], positionCount, texCoordCount, normalCount);
+				});
+
+			bool hasTexCoords{ false }, hasNormals{ false }, hasFlatGroups{ false }, hasSmoothGroups{ false };
+			size_t cornerCount{ 0 };
+			for (const ObjChunk& chunk : chunks)
+			{
+				hasTexCoords |= chunk.hasTexCoords;
+				hasNormals |= chunk.hasNormals;
+				hasFlatGroups |= chunk.hasFlatGroups;
+				hasSmoothGroups |= chunk.hasSmoothGroups;
+				cornerCount += chunk.triangleCorners.size();
+			}
+			hasTexCoords &= readTexCoords;
+
+			std::vector<Vector3> positions{ Concatenate(chunks, &ObjChunk::positions) };
+
+			mesh = ObjMesh{};
+			mesh.isSmoothShaded = !hasFlatGroups || hasSmoothGroups;
+			mesh.indices.reserve(cornerCount);
+
+			//Only positions: every v is a vertex already, the file order is kept
+			if (!hasTexCoords && !hasNormals)
+			{
+				for (const ObjChunk& chunk : chunks)
+				{
+					for (const ObjCorner& corner : chunk.triangleCorners)
+					{
+						mesh.indices.push_back(corner.position);
+					}
+				}
+				mesh.positions = std::move(positions);
+				return true;
+			}
+
+			//One vertex per unique v/vt/vn combination, in order of first use. The vertices sharing a position
+			//are chained, so a lookup only compares against the few that differ in vt or vn
+			const std::vector<Vector3> texCoords{ Concatenate(chunks, &ObjChunk::texCoords) };
+			const std::vector<Vector3> normals{ Concatenate(chunks, &ObjChunk::normals) };
+
+			std::vector<int> firstVertex(positionCount, -1);
+			std::vector<int> nextVertex{};
+			std::vector<ObjCorner> vertices{};
+			for (const ObjChunk& chunk : chunks)
+			{
+				for (ObjCorner corner : chunk.triangleCorners)
+				{
+					//Ignored vt must not split the vertices either
+					if (!hasTexCoords)
+						corner.texCoord = -1;
+
+					int vertexIndex{ firstVertex[corner.position] };
+					while (vertexIndex >= 0 && (vertices[vertexIndex].texCoord != corner.texCoord || vertices[vertexIndex].normal != corner.normal))
+					{
+						vertexIndex = nextVertex[vertexIndex];
+					}
+
+					if (vertexIndex < 0)
+					{
+						vertexIndex = static_cast<int>(vertices.size());
+						vertices.push_back(corner);
+						nextVertex.push_back(firstVertex[corner.position]);
+						firstVertex[corner.position] = vertexIndex;
+					}
+					mesh.indices.push_back(vertexIndex);
+				}
+			}
+
+			mesh.positions.reserve(vertices.size());
+			if (hasTexCoords)
+				mesh.texCoords.reserve(vertices.size());
+			if (hasNormals)
+				mesh.normals.reserve(vertices.size());
+
+			for (const ObjCorner& vertex : vertices)
+			{
+				mesh.positions.push_back(positions[vertex.position]);
+				if (hasTexCoords)
+					mesh.texCoords.push_back(vertex.texCoord >= 0 ? texCoords[vertex.texCoord] : Vector3{});
+				if (hasNormals)
+					mesh.normals.push_back(vertex.normal >= 0 ? normals[vertex.normal] : Vector3{});
+			}
+			return true;
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+//Standard includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Vector3.h"
+
+namespace dae
+{
+	//Indexed triangle list read from an OBJ, every vertex is one unique v/vt/vn combination of the file
+	struct ObjMesh
+	{
+		std::vector<Vector3> positions{};
+		//Per vertex, empty when no face references a vn
+		std::vector<Vector3> normals{};
+		//Per vertex (u, v, w), empty when no face references a vt
+		std::vector<Vector3> texCoords{};
+		std::vector<int> indices{};
+
+		//False when the file switches smoothing groups off (s off / s 0) and never on, faces are meant to look flat then
+		bool isSmoothShaded{ true };
+	};
+
+	namespace Utils
+	{
+		/**
+		 * \brief Reads v, vt, vn and f lines from a memory mapped OBJ, large files are split into chunks that are parsed in parallel.
+		 * Faces may use any of the a, a/b, a//c and a/b/c forms and negative (relative) indices, polygons are fan triangulated.
+		 * Faces that reference a missing element are skipped, s only sets isSmoothShaded and the other statements (o, g, usemtl, ...) are ignored
+		 * \param readTexCoords false ignores every vt, vertices then only differ in v/vn and texCoords stays empty
+		 * \param threadCount threads for large files, 0 uses every hardware thread
+		 * \return false when the file can't be read
+		 */
+		bool ParseOBJ(const std::string& filename, ObjMesh& mesh, bool readTexCoords = true, uint32_t threadCount = 0);
+	}
+}
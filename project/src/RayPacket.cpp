@@ -0,0 +1,158 @@
+#include "RayPacket.h"
+
+#include <bit>
+
+#include "Utils.h"
+
+#if defined(DAE_PACKET_TRACING)
+namespace dae
+{
+	namespace GeometryUtils
+	{
+		namespace
+		{
+			//All bits set in the lanes of laneMask
+			__m128 ExpandLaneMask(uint32_t laneMask)
+			{
+				const __m128i laneBits{ _mm_setr_epi32(1, 2, 4, 8) };
+				return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(static_cast<int>(laneMask)), laneBits), laneBits));
+			}
+
+			/**
+			 * \brief HitTest_TriangleRecord of one triangle against every lane, same operation order so the results match bit for bit
+			 * \param pU, pV RayPacketWidth barycentrics, overwritten for the lanes that hit
+			 * \return the lanes of laneMask that hit closer than their max, their max is set to the hit distance
+			 */
+			uint32_t HitTest_TriangleRecordPacket(const TriangleIntersectionRecord& triangle, TriangleCullMode cullMode, RayPacket& packet, uint32_t laneMask, float* pU, float* pV)
+			{
+				Instrumentation::Add(Instrumentation::Counter::TriangleTests, std::popcount(laneMask));
+
+				const __m128 directionX{ _mm_load_ps(packet.directionX) };
+				const __m128 directionY{ _mm_load_ps(packet.directionY) };
+				const __m128 directionZ{ _mm_load_ps(packet.directionZ) };
+
+				const __m128 edge1X{ _mm_set1_ps(triangle.edge1.x) }, edge1Y{ _mm_set1_ps(triangle.edge1.y) }, edge1Z{ _mm_set1_ps(triangle.edge1.z) };
+				const __m128 edge2X{ _mm_set1_ps(triangle.edge2.x) }, edge2Y{ _mm_set1_ps(triangle.edge2.y) }, edge2Z{ _mm_set1_ps(triangle.edge2.z) };
+
+				//p = Cross(direction, edge2)
+				const __m128 pX{ _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y)) };
+				const __m128 pY{ _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z)) };
+				const __m128 pZ{ _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X)) };
+
+				const __m128 determinant{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)), _mm_mul_ps(edge1Z, pZ)) };
+
+				const __m128 zero{ _mm_setzero_ps() };
+				__m128 valid{};
+				switch (cullMode)
+				{
+				case TriangleCullMode::BackFaceCulling:
+					valid = _mm_cmpgt_ps(determinant, zero);
+					break;
+				case TriangleCullMode::FrontFaceCulling:
+					valid = _mm_cmplt_ps(determinant, zero);
+					break;
+				case TriangleCullMode::NoCulling:
+					valid = _mm_cmpneq_ps(determinant, zero);
+					break;
+				}
+				if (!(_mm_movemask_ps(valid) & laneMask))
+					return 0;
+
+				const __m128 inverseDeterminant{ _mm_div_ps(_mm_set1_ps(1.f), determinant) };
+
+				const __m128 sX{ _mm_sub_ps(_mm_load_ps(packet.originX), _mm_set1_ps(triangle.v0.x)) };
+				const __m128 sY{ _mm_sub_ps(_mm_load_ps(packet.originY), _mm_set1_ps(triangle.v0.y)) };
+				const __m128 sZ{ _mm_sub_ps(_mm_load_ps(packet.originZ), _mm_set1_ps(triangle.v0.z)) };
+
+				const __m128 one{ _mm_set1_ps(1.f) };
+				const __m128 u{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, pX), _mm_mul_ps(sY, pY)), _mm_mul_ps(sZ, pZ)), inverseDeterminant) };
+				valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+				//q = Cross(s, edge1)
+				const __m128 qX{ _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y)) };
+				const __m128 qY{ _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z)) };
+				const __m128 qZ{ _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X)) };
+
+				const __m128 v{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ)), inverseDeterminant) };
+				valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+
+				const __m128 t{ _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ)), inverseDeterminant) };
+				const __m128 rayMax{ _mm_load_ps(packet.max) };
+				valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(t, _mm_load_ps(packet.min)), _mm_cmple_ps(t, rayMax)));
+
+				valid = _mm_and_ps(valid, ExpandLaneMask(laneMask));
+				const uint32_t hitMask{ static_cast<uint32_t>(_mm_movemask_ps(valid)) };
+				if (hitMask)
+				{
+					_mm_store_ps(packet.max, _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, rayMax)));
+					_mm_store_ps(pU, _mm_or_ps(_mm_and_ps(valid, u), _mm_andnot_ps(valid, _mm_load_ps(pU))));
+					_mm_store_ps(pV, _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, _mm_load_ps(pV))));
+				}
+
+				return hitMask;
+			}
+		}
+
+		uint32_t HitTest_PlacedMeshPacket(const TriangleMesh& mesh, const MeshPlacement& placement, RayPacket& packet, uint32_t laneMask, HitRecord* pHits)
+		{
+			float entryDistance{};
+			laneMask = SlabTest_AABBPacket(placement.transformedMinAABB, placement.transformedMaxAABB, packet, laneMask, entryDistance);
+			if (mesh.bvh.IsEmpty() || !laneMask)
+			{
+				return 0;
+			}
+
+			//Same object space rays as the single ray test, the direction stays unnormalized so t carries over
+			RayPacket objectPacket{};
+			for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+			{
+				if (!(laneMask & (1u << lane)))
+					continue;
+
+				const Ray worldRay{ packet.GetRay(lane) };
+				objectPacket.SetRay(lane, Ray{ placement.inverseTransform.TransformPoint(worldRay.origin), placement.inverseTransform.TransformVector(worldRay.direction), worldRay.min, worldRay.max });
+			}
+
+			uint32_t closestRecords[RayPacketWidth]{};
+			alignas(16) float closestU[RayPacketWidth]{};
+			alignas(16) float closestV[RayPacketWidth]{};
+			uint32_t hitMask{ 0 };
+
+			Traverse_BVHLeavesPacket(mesh.bvh, objectPacket, laneMask, [&](uint32_t first, uint32_t count, uint32_t leafMask)
+				{
+					for (uint32_t inx = first; inx < first + count; ++inx)
+					{
+						const uint32_t recordIndex{ mesh.bvh.primitiveIndices[inx] };
+						uint32_t triangleMask{ HitTest_TriangleRecordPacket(mesh.triangleRecords[recordIndex], placement.cullMode, objectPacket, leafMask, closestU, closestV) };
+						hitMask |= triangleMask;
+						while (triangleMask)
+						{
+							const uint32_t lane{ static_cast<uint32_t>(std::countr_zero(triangleMask)) };
+							closestRecords[lane] = recordIndex;
+							triangleMask &= triangleMask - 1;
+						}
+					}
+				});
+
+			for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+			{
+				if (!(hitMask & (1u << lane)))
+					continue;
+
+				const TriangleIntersectionRecord& triangle = mesh.triangleRecords[closestRecords[lane]];
+				const Ray worldRay{ packet.GetRay(lane) };
+
+				HitRecord& hitRecord = pHits[lane];
+				hitRecord.didHit = true;
+				hitRecord.t = objectPacket.max[lane];
+				hitRecord.materialIndex = placement.materialIndex;
+				hitRecord.origin = worldRay.origin + hitRecord.t * worldRay.direction;
+				hitRecord.normal = placement.TransformNormal(mesh.GetObjectHitNormal(triangle, closestU[lane], closestV[lane]));
+
+				packet.max[lane] = hitRecord.t;
+			}
+			return hitMask;
+		}
+	}
+}
+#endif
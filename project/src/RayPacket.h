@@ -0,0 +1,235 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cstdint>
+
+#include "BVH.h"
+#include "DataTypes.h"
+#include "Instrumentation.h"
+
+//Packets are 4 wide SSE2, which every x64 CPU has, other targets trace single rays
+#if defined(_M_X64) || defined(__x86_64__)
+#define DAE_PACKET_TRACING
+#include <emmintrin.h>
+#endif
+
+namespace dae
+{
+	constexpr uint32_t RayPacketWidth{ 4 };
+	constexpr uint32_t AllPacketLanes{ (1u << RayPacketWidth) - 1 };
+
+	//Up to RayPacketWidth rays in SoA form, lanes outside the active mask hold no ray and are never reported
+	struct alignas(16) RayPacket
+	{
+		float originX[RayPacketWidth]{}, originY[RayPacketWidth]{}, originZ[RayPacketWidth]{};
+		float directionX[RayPacketWidth]{}, directionY[RayPacketWidth]{}, directionZ[RayPacketWidth]{};
+		float inverseDirectionX[RayPacketWidth]{}, inverseDirectionY[RayPacketWidth]{}, inverseDirectionZ[RayPacketWidth]{};
+		float min[RayPacketWidth]{}, max[RayPacketWidth]{};
+		uint32_t activeMask{};
+
+		void SetRay(uint32_t lane, const Ray& ray)
+		{
+			originX[lane] = ray.origin.x;
+			originY[lane] = ray.origin.y;
+			originZ[lane] = ray.origin.z;
+			directionX[lane] = ray.direction.x;
+			directionY[lane] = ray.direction.y;
+			directionZ[lane] = ray.direction.z;
+			inverseDirectionX[lane] = 1.f / ray.direction.x;
+			inverseDirectionY[lane] = 1.f / ray.direction.y;
+			inverseDirectionZ[lane] = 1.f / ray.direction.z;
+			min[lane] = ray.min;
+			max[lane] = ray.max;
+			activeMask |= 1u << lane;
+		}
+
+		Ray GetRay(uint32_t lane) const
+		{
+			return Ray{ { originX[lane], originY[lane], originZ[lane] }, { directionX[lane], directionY[lane], directionZ[lane] }, min[lane], max[lane] };
+		}
+
+		//All active rays point into the same octant, so they walk a BVH in roughly the same order
+		bool IsCoherent() const
+		{
+			uint32_t positiveX{}, positiveY{}, positiveZ{};
+			for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+			{
+				if (!(activeMask & (1u << lane)))
+					continue;
+				positiveX |= 1u << (directionX[lane] >= 0.f);
+				positiveY |= 1u << (directionY[lane] >= 0.f);
+				positiveZ |= 1u << (directionZ[lane] >= 0.f);
+			}
+			return positiveX != 3 && positiveY != 3 && positiveZ != 3;
+		}
+
+		//Largest max among the lanes in laneMask, a node entered beyond it can't hold a closer hit for any of them
+		float GetFurthestMax(uint32_t laneMask) const
+		{
+			float furthestMax{ 0.f };
+			for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+			{
+				if (laneMask & (1u << lane))
+					furthestMax = std::max(furthestMax, max[lane]);
+			}
+			return furthestMax;
+		}
+	};
+
+#if defined(DAE_PACKET_TRACING)
+	namespace GeometryUtils
+	{
+		/**
+		 * \brief SlabTest_AABB for every lane at once, the min/max operand order matches std::min/std::max so NaNs behave the same
+		 * \param laneMask lanes to test
+		 * \param nearestDistance entry distance of the closest lane that hits, FLT_MAX when none does
+		 * \return the lanes of laneMask that enter the box before their max
+		 */
+		inline uint32_t SlabTest_AABBPacket(const Vector3& minAABB, const Vector3& maxAABB, const RayPacket& packet, uint32_t laneMask, float& nearestDistance)
+		{
+			Instrumentation::Add(Instrumentation::Counter::SlabTests, std::popcount(laneMask));
+
+			const __m128 originX{ _mm_load_ps(packet.originX) };
+			const __m128 inverseDirectionX{ _mm_load_ps(packet.inverseDirectionX) };
+			const __m128 tx1{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minAABB.x), originX), inverseDirectionX) };
+			const __m128 tx2{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxAABB.x), originX), inverseDirectionX) };
+
+			__m128 tmin{ _mm_min_ps(tx2, tx1) };
+			__m128 tmax{ _mm_max_ps(tx2, tx1) };
+
+			const __m128 originY{ _mm_load_ps(packet.originY) };
+			const __m128 inverseDirectionY{ _mm_load_ps(packet.inverseDirectionY) };
+			const __m128 ty1{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minAABB.y), originY), inverseDirectionY) };
+			const __m128 ty2{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxAABB.y), originY), inverseDirectionY) };
+
+			tmin = _mm_max_ps(_mm_min_ps(ty2, ty1), tmin);
+			tmax = _mm_min_ps(_mm_max_ps(ty2, ty1), tmax);
+
+			const __m128 originZ{ _mm_load_ps(packet.originZ) };
+			const __m128 inverseDirectionZ{ _mm_load_ps(packet.inverseDirectionZ) };
+			const __m128 tz1{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minAABB.z), originZ), inverseDirectionZ) };
+			const __m128 tz2{ _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxAABB.z), originZ), inverseDirectionZ) };
+
+			tmin = _mm_max_ps(_mm_min_ps(tz2, tz1), tmin);
+			tmax = _mm_min_ps(_mm_max_ps(tz2, tz1), tmax);
+
+			const __m128 didHit{ _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpge_ps(tmax, _mm_load_ps(packet.min))),
+				_mm_cmplt_ps(tmin, _mm_load_ps(packet.max))) };
+			const uint32_t hitMask{ static_cast<uint32_t>(_mm_movemask_ps(didHit)) & laneMask };
+
+			nearestDistance = FLT_MAX;
+			if (hitMask)
+			{
+				alignas(16) float entryDistances[RayPacketWidth];
+				_mm_store_ps(entryDistances, tmin);
+				for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+				{
+					if (hitMask & (1u << lane))
+						nearestDistance = std::min(nearestDistance, entryDistances[lane]);
+				}
+			}
+			return hitMask;
+		}
+
+		/**
+		 * \brief Traverse_BVHLeaves for a packet, every node is fetched and slab tested once for all lanes
+		 * \param laneMask lanes to trace, a child is only visited by the lanes that enter it
+		 * \param testLeaf void(uint32_t first, uint32_t count, uint32_t laneMask), shrinks packet.max of the lanes it hits
+		 */
+		template<typename LeafTest>
+		inline void Traverse_BVHLeavesPacket(const BVH& bvh, RayPacket& packet, uint32_t laneMask, LeafTest&& testLeaf)
+		{
+			if (bvh.IsEmpty())
+			{
+				return;
+			}
+
+			uint32_t nodeStack[BVH::MaxDepth];
+			uint32_t maskStack[BVH::MaxDepth];
+			float distanceStack[BVH::MaxDepth];
+			uint32_t stackSize{ 0 };
+
+			const BVHNode* pNode = &bvh.nodes[0];
+			float rootDistance{};
+			laneMask = SlabTest_AABBPacket(pNode->minAABB, pNode->maxAABB, packet, laneMask, rootDistance);
+			if (!laneMask)
+			{
+				return;
+			}
+
+			while (true)
+			{
+				if (pNode->IsLeaf())
+				{
+					testLeaf(pNode->leftFirst, pNode->primitiveCount, laneMask);
+				}
+				else
+				{
+					const BVHNode* pNear = &bvh.nodes[pNode->leftFirst];
+					const BVHNode* pFar = &bvh.nodes[pNode->leftFirst + 1];
+
+					float nearDistance{}, farDistance{};
+					uint32_t nearMask{ SlabTest_AABBPacket(pNear->minAABB, pNear->maxAABB, packet, laneMask, nearDistance) };
+					uint32_t farMask{ SlabTest_AABBPacket(pFar->minAABB, pFar->maxAABB, packet, laneMask, farDistance) };
+
+					if (farDistance < nearDistance)
+					{
+						std::swap(pNear, pFar);
+						std::swap(nearDistance, farDistance);
+						std::swap(nearMask, farMask);
+					}
+
+					if (nearMask)
+					{
+						if (farMask)
+						{
+							nodeStack[stackSize] = static_cast<uint32_t>(pFar - bvh.nodes.data());
+							maskStack[stackSize] = farMask;
+							distanceStack[stackSize] = farDistance;
+							++stackSize;
+						}
+
+						pNode = pNear;
+						laneMask = nearMask;
+						continue;
+					}
+				}
+
+				//Pop until we find a node that can still contain something closer for at least one of its lanes
+				while (stackSize > 0 && distanceStack[stackSize - 1] >= packet.GetFurthestMax(maskStack[stackSize - 1]))
+				{
+					--stackSize;
+				}
+
+				if (stackSize == 0)
+				{
+					break;
+				}
+
+				--stackSize;
+				pNode = &bvh.nodes[nodeStack[stackSize]];
+				laneMask = maskStack[stackSize];
+			}
+		}
+
+		/**
+		 * \brief HitTest_PlacedMesh for the lanes of a packet, the mesh BVH is walked once for all of them
+		 * \param packet world space rays, max shrinks for the lanes that hit
+		 * \param pHits RayPacketWidth records, only written for the lanes that hit
+		 * \return the lanes that hit the mesh closer than their max
+		 */
+		uint32_t HitTest_PlacedMeshPacket(const TriangleMesh& mesh, const MeshPlacement& placement, RayPacket& packet, uint32_t laneMask, HitRecord* pHits);
+
+		inline uint32_t HitTest_TriangleMeshPacket(const TriangleMesh& mesh, RayPacket& packet, uint32_t laneMask, HitRecord* pHits)
+		{
+			return HitTest_PlacedMeshPacket(mesh, mesh, packet, laneMask, pHits);
+		}
+
+		inline uint32_t HitTest_MeshInstancePacket(const MeshInstance& instance, RayPacket& packet, uint32_t laneMask, HitRecord* pHits)
+		{
+			return HitTest_PlacedMeshPacket(*instance.pMesh, instance, packet, laneMask, pHits);
+		}
+	}
+#endif
+}
@@ -1,31 +1,112 @@
 //External includes
 #include "SDL.h"
 #include "SDL_surface.h"
-#include <execution>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
 
 //Project includes
 #include "Renderer.h"
+#include "FrameBuffer.h"
+#include "Instrumentation.h"
 #include "Maths.h"
 #include "Matrix.h"
 #include "Material.h"
+#include "RayPacket.h"
 #include "Scene.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include "Utils.h"
 
 #define PARALLEL_EXECUTION
 
 using namespace dae;
 
-Renderer::Renderer(SDL_Window * pWindow) :
+namespace
+{
+	//Rec. 709 weights of linear RGB
+	float GetLuminance(const ColorRGB& color)
+	{
+		return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+	}
+
+	//Order the 1 in 4 pattern visits the pixels of a 2x2 block in, diagonal ones back to back spread each frame's pixels evenly
+	constexpr uint32_t QuadInterleaveOrder[4]{ 0, 3, 1, 2 };
+}
+
+Renderer::Renderer(SDL_Window * pWindow, uint32_t threadCount, uint32_t tileSize) :
 	m_pWindow(pWindow),
-	m_pBuffer(SDL_GetWindowSurface(pWindow))
+	m_pBuffer(SDL_GetWindowSurface(pWindow)),
+	m_pThreadPool(std::make_unique<ThreadPool>(threadCount))
 {
 	//Initialize
 	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
+	m_RenderWidth = uint32_t(m_Width);
+	m_RenderHeight = uint32_t(m_Height);
 	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
+	m_pFrameBuffer = std::make_unique<FrameBuffer>(uint32_t(m_Width), uint32_t(m_Height));
+	SetTileSize(tileSize);
+}
+
+Renderer::Renderer(uint32_t width, uint32_t height, uint32_t threadCount, uint32_t tileSize) :
+	m_Width(int(width)),
+	m_Height(int(height)),
+	m_RenderWidth(width),
+	m_RenderHeight(height),
+	m_pFrameBuffer(std::make_unique<FrameBuffer>(width, height)),
+	m_pThreadPool(std::make_unique<ThreadPool>(threadCount))
+{
+	SetTileSize(tileSize);
+}
+
+Renderer::~Renderer() = default;
+
+void Renderer::SetThreadCount(uint32_t threadCount)
+{
+	m_pThreadPool = std::make_unique<ThreadPool>(threadCount);
+}
+
+void Renderer::SetFrameTimeBudget(float seconds)
+{
+	m_FrameTimeBudget = std::max(seconds, 0.f);
+	m_AdaptiveRenderScale = 1.f;
+	m_SecondsPerPixel = 0.f;
+}
+
+void Renderer::ReportFrameTime(float seconds)
+{
+	//A still camera keeps most tiles and makes the frame look almost free, the render scale would jump to 1 once it moves again
+	if (m_FrameTimeBudget <= 0.f || seconds <= 0.f || m_WasLastFrameIncremental)
+		return;
+
+	//Tracing dominates a frame and scales with the pixel count, so the budget translates to an area and the scale to its square root.
+	//An interleaved frame only traced one pixel in m_ActiveInterleaveFactor, the rest was reprojected
+	const float tracedPixelCount{ float(m_RenderWidth) * m_RenderHeight / float(m_ActiveInterleaveFactor) };
+	const float secondsPerPixel{ seconds / tracedPixelCount };
+	m_SecondsPerPixel = m_SecondsPerPixel > 0.f ? m_SecondsPerPixel + (secondsPerPixel - m_SecondsPerPixel) * FrameCostSmoothing : secondsPerPixel;
+
+	const float fittingScale{ std::sqrt(m_FrameTimeBudget / (m_SecondsPerPixel * float(m_Width) * m_Height)) };
+	m_AdaptiveRenderScale = std::clamp(std::floor(fittingScale / RenderScaleStep) * RenderScaleStep, MinRenderScale, 1.f);
+}
+
+void Renderer::SetRenderResolution(uint32_t width, uint32_t height)
+{
+	if (width == m_RenderWidth && height == m_RenderHeight)
+		return;
+
+	m_RenderWidth = width;
+	m_RenderHeight = height;
+	m_pFrameBuffer->Resize(width, height);
+	ResetAccumulation();
 }
 
-void Renderer::Render(Scene* pScene) const
+void Renderer::Render(Scene* pScene)
 {
+	Instrumentation::ScopedStageTimer renderTimer{ Instrumentation::Stage::Render };
+
 	Camera& camera = pScene->GetCamera();
 	const Matrix cameraToWorld = camera.CalculateCameraToWorld();
 
@@ -33,112 +114,663 @@ void Renderer::Render(Scene* pScene) const
 
     float FOV = tan(camera.fovAngle * (PI / 180.f) / 2.f);
 
-	//uint32_t amountOfPixels{ uint32_t(m_Width * m_Height) };
+	const bool isCameraMoving{ !(m_PreviousCameraToWorld == cameraToWorld) || m_PreviousFOV != FOV };
+	if (m_FrameTimeBudget > 0.f)
+	{
+		//The first frame after the camera stops is traced at full size, so a still view is never left blurry
+		const float renderScale{ isCameraMoving ? m_AdaptiveRenderScale : 1.f };
+		SetRenderResolution(std::max(1u, uint32_t(std::lround(m_Width * renderScale))), std::max(1u, uint32_t(std::lround(m_Height * renderScale))));
+	}
+	else
+	{
+		SetRenderResolution(uint32_t(m_Width), uint32_t(m_Height));
+	}
 
-	//for (uint32_t pixelIndex{}; pixelIndex < amountOfPixels; ++pixelIndex)
-	//{
-	//	RenderPixel(pScene, pixelIndex, FOV, aspectRatio, cameraToWorld, camera.origin);
-	//}
+	const bool isHistoryUsable{ !m_IsProgressive && m_IsHistoryValid && m_pHistoryScene == pScene };
 
-#if defined(PARALLEL_EXECUTION)
-	uint32_t amountOfPixels{ uint32_t(m_Width * m_Height) };
-	std::vector<uint32_t> pixelIndices{};
+	//Interleaved frames fill what they skip from the previous frame, so that one moves to the history buffer.
+	//Like dynamic resolution, the first frame after the camera stops traces every pixel again
+	const bool isInterleaved{ m_InterleaveFactor > 1 && isCameraMoving && isHistoryUsable };
+	if (isInterleaved)
+	{
+		if (!m_pHistoryBuffer)
+			m_pHistoryBuffer = std::make_unique<FrameBuffer>(m_RenderWidth, m_RenderHeight);
+
+		std::swap(m_pFrameBuffer, m_pHistoryBuffer);
+		std::swap(m_HitDistances, m_HistoryHitDistances);
+		if (m_pFrameBuffer->GetWidth() != m_RenderWidth || m_pFrameBuffer->GetHeight() != m_RenderHeight)
+			m_pFrameBuffer->Resize(m_RenderWidth, m_RenderHeight);
+		m_InterleavePhase = (m_InterleavePhase + 1) % m_InterleaveFactor;
+	}
+	m_ActiveInterleaveFactor = isInterleaved ? m_InterleaveFactor : 1;
+	if (!m_IsProgressive)
+		m_HitDistances.resize(size_t(m_RenderWidth) * m_RenderHeight);
+
+	//Incremental frames keep every tile no moved object can reach. The changed boxes only cover one scene update,
+	//a revision that skipped ahead means updates went unrendered, and a change without boxes was a rebuild
+	const uint64_t sceneRevision{ pScene->GetRevision() };
+	const bool hasSceneChanged{ sceneRevision != m_HistorySceneRevision };
+	const bool isIncremental{ m_IsIncrementalRendering && !isCameraMoving && isHistoryUsable && !m_IsHistoryReconstructed
+		&& m_SamplesPerPixel == 1 && sceneRevision - m_HistorySceneRevision <= 1 && !(hasSceneChanged && pScene->GetChangedBoundsMin().empty()) };
+
+	if (m_IsProgressive)
+	{
+		const bool hasViewChanged{ m_pAccumulatedScene != pScene || m_AccumulatedSceneRevision != pScene->GetRevision()
+			|| !(m_AccumulatedCameraToWorld == cameraToWorld) || m_AccumulatedFOV != FOV };
 
-	pixelIndices.reserve(amountOfPixels);
-	for (uint32_t index{}; index < amountOfPixels; ++index) pixelIndices.emplace_back(index);
+		if (!m_IsAccumulationValid || hasViewChanged)
+		{
+			m_Accumulation.assign(size_t(m_RenderWidth) * m_RenderHeight, PixelAccumulation{});
+			m_pAccumulatedScene = pScene;
+			m_AccumulatedSceneRevision = pScene->GetRevision();
+			m_AccumulatedCameraToWorld = cameraToWorld;
+			m_AccumulatedFOV = FOV;
+			m_IsAccumulationValid = true;
+		}
+	}
+	else if (m_IsOccluderCaching)
+	{
+		const size_t cacheSize{ size_t(m_RenderWidth) * m_RenderHeight * pScene->GetLights().size() };
+		if (m_pOccluderCacheScene != pScene || m_OccluderCache.size() != cacheSize)
+		{
+			m_OccluderCache.assign(cacheSize, Occluder{});
+			m_pOccluderCacheScene = pScene;
+		}
+	}
+	std::atomic<uint32_t> activePixelCount{ 0 };
+	std::atomic<uint64_t> primaryRayCount{ 0 };
+	std::atomic<uint64_t> shadowRayCount{ 0 };
 
-	std::for_each(std::execution::par, pixelIndices.begin(), pixelIndices.end(), [&](int i) {
-		RenderPixel(pScene, i, FOV, aspectRatio, cameraToWorld, camera.origin);
-	});
-#else 
-	uint32_t amountOfPixels{ uint32_t(m_Width * m_Height) };
+	//Square tiles keep the rays of one task close together, so they walk mostly the same BVH nodes
+	const uint32_t tileCountX{ (m_RenderWidth + m_TileSize - 1) / m_TileSize };
+	const uint32_t tileCountY{ (m_RenderHeight + m_TileSize - 1) / m_TileSize };
 
-	for (uint32_t pixelIndex{}; pixelIndex < amountOfPixels; ++pixelIndex)
+	const auto renderTile = [&](uint32_t tileIndex)
 	{
-		RenderPixel(pScene, pixelIndex, FOV, aspectRatio, cameraToWorld, camera.origin);
+		const Trace::ScopedEvent tileEvent{ "Tile", tileIndex };
+
+		const uint32_t startX{ (tileIndex % tileCountX) * m_TileSize };
+		const uint32_t startY{ (tileIndex / tileCountX) * m_TileSize };
+		const uint32_t endX{ std::min(startX + m_TileSize, m_RenderWidth) };
+		const uint32_t endY{ std::min(startY + m_TileSize, m_RenderHeight) };
+
+		if (!m_IsProgressive)
+		{
+			if (isIncremental && (!hasSceneChanged || !IsTileAffected(pScene, startX, startY, endX, endY, FOV, aspectRatio, cameraToWorld, camera.origin)))
+				return;
+
+			const RenderStatistics tileStatistics{ RenderTile(pScene, startX, startY, endX, endY, FOV, aspectRatio, cameraToWorld, camera.origin) };
+			primaryRayCount.fetch_add(tileStatistics.primaryRayCount, std::memory_order_relaxed);
+			shadowRayCount.fetch_add(tileStatistics.shadowRayCount, std::memory_order_relaxed);
+			Instrumentation::Add(Instrumentation::Counter::PrimaryRays, tileStatistics.primaryRayCount);
+			Instrumentation::Add(Instrumentation::Counter::ShadowRays, tileStatistics.shadowRayCount);
+			return;
+		}
+
+		//Converged pixels cost a flag check, so the threads spend the frame on the pixels that are still noisy
+		uint32_t tileActivePixelCount{ 0 };
+		uint32_t tileTracedPixelCount{ 0 };
+		for (uint32_t py{ startY }; py < endY; ++py)
+		{
+			for (uint32_t px{ startX }; px < endX; ++px)
+			{
+				if (!m_Accumulation[px + size_t(py) * m_RenderWidth].isConverged)
+					++tileTracedPixelCount;
+
+				if (AccumulatePixel(pScene, px, py, FOV, aspectRatio, cameraToWorld, camera.origin))
+					++tileActivePixelCount;
+			}
+		}
+		activePixelCount.fetch_add(tileActivePixelCount, std::memory_order_relaxed);
+		primaryRayCount.fetch_add(uint64_t(tileTracedPixelCount) * m_SamplesPerPixel, std::memory_order_relaxed);
+		Instrumentation::Add(Instrumentation::Counter::PrimaryRays, uint64_t(tileTracedPixelCount) * m_SamplesPerPixel);
+	};
+
+#if defined(PARALLEL_EXECUTION)
+	m_pThreadPool->ParallelFor(tileCountX * tileCountY, renderTile);
+#else 
+	for (uint32_t tileIndex{}; tileIndex < tileCountX * tileCountY; ++tileIndex)
+	{
+		renderTile(tileIndex);
 	}
 #endif
 
-    SDL_UpdateWindowSurface(m_pWindow);
+	if (isInterleaved)
+		ReconstructSkippedPixels(FOV, aspectRatio, cameraToWorld, camera.origin);
+
+	m_IsHistoryValid = !m_IsProgressive;
+	m_IsHistoryReconstructed = isInterleaved;
+	m_WasLastFrameIncremental = isIncremental;
+	m_pHistoryScene = pScene;
+	m_HistorySceneRevision = sceneRevision;
+	m_PreviousCameraToWorld = cameraToWorld;
+	m_PreviousFOV = FOV;
+
+	m_ActivePixelCount = activePixelCount.load();
+
+	m_LastFrameStatistics.primaryRayCount = primaryRayCount.load();
+	m_LastFrameStatistics.shadowRayCount = shadowRayCount.load();
+	renderTimer.Stop();
+
+	if (!IsHeadless())
+	{
+		ResolveFrame();
 
+		const Instrumentation::ScopedStageTimer presentTimer{ Instrumentation::Stage::Present };
+		SDL_UpdateWindowSurface(m_pWindow);
+	}
 }
 
-void Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float FOV, float aspectRatio, const Matrix cameraToWorld, const Vector3 cameraOrigin) const
+void Renderer::RenderPixel(Scene* pScene, uint32_t px, uint32_t py, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const
 {
-    auto materials{ pScene->GetMaterials() };
-    const uint32_t px{ pixelIndex % m_Width }, py{ pixelIndex / m_Width };
+	ColorRGB pixelColor{};
+	for (uint32_t sample{}; sample < m_SamplesPerPixel; ++sample)
+	{
+		//R2 low-discrepancy offsets inside the pixel, the first sample sits in the center
+		const float offsetX{ 0.5f + sample * 0.7548776662f };
+		const float offsetY{ 0.5f + sample * 0.5698402909f };
 
-    float rx{ px + 0.5f }, ry{ py + 0.5f };
-    float  cx{ (2 * (rx / float(m_Width)) - 1) * aspectRatio * FOV };
-    float cy{ (1 - (2 * (ry / float(m_Height)))) * FOV };
+		pixelColor += TraceViewRay(pScene, px + (offsetX - std::floor(offsetX)), py + (offsetY - std::floor(offsetY)), FOV, aspectRatio, cameraToWorld, cameraOrigin);
+	}
 
+	m_pFrameBuffer->SetPixel(px, py, pixelColor / float(m_SamplesPerPixel));
+}
 
-	Vector3 rayDirection{ (2 * (px + 0.5f) / m_Width - 1) * aspectRatio * FOV ,   (1 - 2 * (py + 0.5f) / m_Height) * FOV, 1.f };
+bool Renderer::AccumulatePixel(Scene* pScene, uint32_t px, uint32_t py, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	PixelAccumulation& accumulation = m_Accumulation[px + size_t(py) * m_RenderWidth];
+	if (accumulation.isConverged)
+		return false;
 
-	rayDirection.Normalize();
+	ColorRGB mean{ accumulation.sampleCount > 0 ? m_pFrameBuffer->GetPixel(px, py) : ColorRGB{} };
+	for (uint32_t sample{}; sample < m_SamplesPerPixel; ++sample)
+	{
+		//Same R2 sequence as RenderPixel, continued over the frames, so the first frame matches the non-progressive image
+		const float offsetX{ 0.5f + accumulation.sampleCount * 0.7548776662f };
+		const float offsetY{ 0.5f + accumulation.sampleCount * 0.5698402909f };
+
+		const ColorRGB color{ TraceViewRay(pScene, px + (offsetX - std::floor(offsetX)), py + (offsetY - std::floor(offsetY)), FOV, aspectRatio, cameraToWorld, cameraOrigin) };
+		++accumulation.sampleCount;
+
+		const float luminance{ GetLuminance(color) };
+		const float previousMeanLuminance{ GetLuminance(mean) };
+		mean += (color - mean) * (1.f / accumulation.sampleCount);
+		const float meanLuminance{ GetLuminance(mean) };
+		accumulation.luminanceM2 += (luminance - previousMeanLuminance) * (luminance - meanLuminance);
+	}
+	m_pFrameBuffer->SetPixel(px, py, mean);
+
+	const uint32_t sampleCount{ accumulation.sampleCount };
+	if (sampleCount >= m_MaxSamplesPerPixel)
+	{
+		accumulation.isConverged = true;
+	}
+	else if (sampleCount >= MinConvergenceSamples)
+	{
+		const float meanLuminance{ GetLuminance(mean) };
+		const float variance{ accumulation.luminanceM2 / (sampleCount - 1) };
+		const float standardError{ std::sqrt(variance / sampleCount) };
+		accumulation.isConverged = standardError <= m_ConvergenceThreshold * std::max(meanLuminance, 1.f);
+	}
+
+	return !accumulation.isConverged;
+}
 
-	Ray viewRay{ cameraOrigin, cameraToWorld.TransformVector(rayDirection) };
+struct Renderer::ShadowRay
+{
+	Ray ray{};
+	//Added to the target's color when nothing blocks the ray
+	ColorRGB contribution{};
+	uint32_t target{};
+};
+
+RenderStatistics Renderer::RenderTile(Scene* pScene, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	const uint32_t tileWidth{ endX - startX };
+	const uint32_t pixelCount{ tileWidth * (endY - startY) };
+
+	//The first sample goes through the pixel center, the next interleaved or incremental frame starts from its hit distance
+	const auto recordHitDistance = [&](uint32_t sample, uint32_t target, const HitRecord& closestHit)
+	{
+		if (sample == 0)
+			m_HitDistances[(startX + target % tileWidth) + size_t(startY + target / tileWidth) * m_RenderWidth] = closestHit.didHit ? closestHit.t : FLT_MAX;
+	};
+
+	//Scratch of the worker thread, reused by every tile it renders so a frame stops allocating once the buffers fit the largest tile
+	thread_local std::vector<ColorRGB> pixelColors{};
+	thread_local std::vector<ColorRGB> sampleColors{};
+	//One queue per light, the second pass then traces all rays towards the same light back to back
+	thread_local std::vector<std::vector<ShadowRay>> shadowQueues{};
+	pixelColors.assign(pixelCount, ColorRGB{});
+	sampleColors.assign(pixelCount, ColorRGB{});
+	shadowQueues.resize(pScene->GetLights().size());
+	uint32_t shadowRayCount{ 0 };
+
+	for (uint32_t sample{}; sample < m_SamplesPerPixel; ++sample)
+	{
+		//Same offsets as RenderPixel
+		const float offsetX{ 0.5f + sample * 0.7548776662f };
+		const float offsetY{ 0.5f + sample * 0.5698402909f };
+		const float jitterX{ offsetX - std::floor(offsetX) };
+		const float jitterY{ offsetY - std::floor(offsetY) };
+
+		for (std::vector<ShadowRay>& shadowQueue : shadowQueues)
+		{
+			shadowQueue.clear();
+		}
+
+		//First pass: primary rays and shading, the shadow rays only get queued
+		if (m_IsPacketTracing)
+		{
+			//2x2 blocks go through the scene as one ray packet, odd tile edges make smaller blocks
+			for (uint32_t py{ startY }; py < endY; py += 2)
+			{
+				for (uint32_t px{ startX }; px < endX; px += 2)
+				{
+					const uint32_t blockWidth{ std::min(2u, endX - px) };
+					const uint32_t blockPixelCount{ blockWidth * std::min(2u, endY - py) };
+
+					//Pixels an interleaved frame skips are left out of the packet
+					Ray viewRays[RayPacketWidth]{};
+					uint32_t targets[RayPacketWidth]{};
+					uint32_t rayCount{ 0 };
+					for (uint32_t inx{}; inx < blockPixelCount; ++inx)
+					{
+						const uint32_t x{ px + inx % blockWidth };
+						const uint32_t y{ py + inx / blockWidth };
+						if (!IsPixelTraced(x, y))
+							continue;
+
+						viewRays[rayCount] = GenerateViewRay(x + jitterX, y + jitterY, FOV, aspectRatio, cameraToWorld, cameraOrigin);
+						targets[rayCount] = (x - startX) + (y - startY) * tileWidth;
+						++rayCount;
+					}
+					if (rayCount == 0)
+						continue;
+
+					HitRecord closestHits[RayPacketWidth]{};
+					pScene->GetClosestHits(viewRays, rayCount, closestHits);
+
+					for (uint32_t inx{}; inx < rayCount; ++inx)
+					{
+						sampleColors[targets[inx]] = ShadeHit(pScene, closestHits[inx], cameraOrigin, &shadowQueues, targets[inx]);
+						recordHitDistance(sample, targets[inx], closestHits[inx]);
+					}
+				}
+			}
+		}
+		else
+		{
+			for (uint32_t py{ startY }; py < endY; ++py)
+			{
+				for (uint32_t px{ startX }; px < endX; ++px)
+				{
+					if (!IsPixelTraced(px, py))
+						continue;
+
+					HitRecord closestHit{};
+					pScene->GetClosestHit(GenerateViewRay(px + jitterX, py + jitterY, FOV, aspectRatio, cameraToWorld, cameraOrigin), closestHit);
+
+					const uint32_t target{ (px - startX) + (py - startY) * tileWidth };
+					sampleColors[target] = ShadeHit(pScene, closestHit, cameraOrigin, &shadowQueues, target);
+					recordHitDistance(sample, target, closestHit);
+				}
+			}
+		}
+
+		//Second pass: occlusion only, light by light. Every pixel still gets its lights added in the same order as ShadeHit would
+		for (uint32_t lightIndex{}; lightIndex < shadowQueues.size(); ++lightIndex)
+		{
+			const Trace::ScopedEvent shadowEvent{ "Shadow pass", lightIndex };
+			shadowRayCount += static_cast<uint32_t>(shadowQueues[lightIndex].size());
+			Occluder* pLightOccluders{ m_IsOccluderCaching ? &m_OccluderCache[size_t(lightIndex) * m_RenderWidth * m_RenderHeight] : nullptr };
+			for (const ShadowRay& shadowRay : shadowQueues[lightIndex])
+			{
+				bool isOccluded{};
+				if (pLightOccluders)
+				{
+					const size_t pixelIndex{ (startX + shadowRay.target % tileWidth) + size_t(startY + shadowRay.target / tileWidth) * m_RenderWidth };
+					isOccluded = pScene->DoesHit(shadowRay.ray, pLightOccluders[pixelIndex]);
+				}
+				else
+				{
+					isOccluded = pScene->DoesHit(shadowRay.ray);
+				}
+
+				if (!isOccluded)
+					sampleColors[shadowRay.target] += shadowRay.contribution;
+			}
+		}
+
+		for (uint32_t inx{}; inx < pixelCount; ++inx)
+		{
+			pixelColors[inx] += sampleColors[inx];
+		}
+	}
+
+	uint32_t tracedPixelCount{ 0 };
+	for (uint32_t inx{}; inx < pixelCount; ++inx)
+	{
+		const uint32_t px{ startX + inx % tileWidth };
+		const uint32_t py{ startY + inx / tileWidth };
+		if (!IsPixelTraced(px, py))
+			continue;
+
+		m_pFrameBuffer->SetPixel(px, py, pixelColors[inx] / float(m_SamplesPerPixel));
+		++tracedPixelCount;
+	}
+	return RenderStatistics{ uint64_t(tracedPixelCount) * m_SamplesPerPixel, shadowRayCount };
+}
+
+bool Renderer::IsPixelTraced(uint32_t px, uint32_t py) const
+{
+	switch (m_ActiveInterleaveFactor)
+	{
+	case 2:
+		return ((px + py + m_InterleavePhase) & 1) == 0;
+	case 4:
+		return ((px & 1) | ((py & 1) << 1)) == QuadInterleaveOrder[m_InterleavePhase];
+	}
+	return true;
+}
+
+bool Renderer::IsTileAffected(const Scene* pScene, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const
+{
+	const std::vector<Vector3>& changedMin{ pScene->GetChangedBoundsMin() };
+	const std::vector<Vector3>& changedMax{ pScene->GetChangedBoundsMax() };
+	const std::pmr::vector<Light>& lights{ pScene->GetLights() };
+
+	//Every box is tested with the whole segment, so the pixel is caught whether the object moved in front of its old hit or away from it
+	const auto crossesChangedBounds = [&](const Ray& ray, float maxDistance)
+	{
+		const Vector3 inverseDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
+		for (size_t inx{}; inx < changedMin.size(); ++inx)
+		{
+			if (GeometryUtils::SlabTest_AABB(changedMin[inx], changedMax[inx], ray, inverseDirection, maxDistance) != FLT_MAX)
+				return true;
+		}
+		return false;
+	};
+
+	for (uint32_t py{ startY }; py < endY; ++py)
+	{
+		for (uint32_t px{ startX }; px < endX; ++px)
+		{
+			const float distance{ m_HitDistances[px + size_t(py) * m_RenderWidth] };
+			const Ray viewRay{ GenerateViewRay(px + 0.5f, py + 0.5f, FOV, aspectRatio, cameraToWorld, cameraOrigin) };
+			//A hit on the face of its own box enters the box at exactly its distance, the margin keeps that a crossing
+			if (crossesChangedBounds(viewRay, distance == FLT_MAX ? FLT_MAX : distance * 1.001f))
+				return true;
+
+			if (distance == FLT_MAX || !m_ShadowsEnabled)
+				continue;
+
+			//Same shadow rays as ShadeHit, whether they were blocked or not
+			const Vector3 hitOrigin{ cameraOrigin + viewRay.direction * distance };
+			for (const Light& light : lights)
+			{
+				Vector3 lightDirection{ LightUtils::GetDirectionToLight(light, hitOrigin) };
+				const float distanceToLight{ lightDirection.Magnitude() };
+				lightDirection /= distanceToLight;
+
+				if (crossesChangedBounds(Ray{ hitOrigin, lightDirection, 0.0001f, distanceToLight }, distanceToLight))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+void Renderer::ReconstructSkippedPixels(float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin)
+{
+	const Matrix worldToPreviousCamera{ Matrix::Inverse(m_PreviousCameraToWorld) };
+
+	//Every skipped pixel only reads traced ones, so the bands can run in any order
+	const uint32_t bandCount{ (m_RenderHeight + ResolveBandHeight - 1) / ResolveBandHeight };
+	m_pThreadPool->ParallelFor(bandCount, [&](uint32_t bandIndex)
+		{
+			const uint32_t firstRow{ bandIndex * ResolveBandHeight };
+			const uint32_t lastRow{ std::min(firstRow + ResolveBandHeight, m_RenderHeight) };
+			for (uint32_t py{ firstRow }; py < lastRow; ++py)
+			{
+				for (uint32_t px{}; px < m_RenderWidth; ++px)
+				{
+					if (!IsPixelTraced(px, py))
+						ReconstructPixel(px, py, FOV, aspectRatio, cameraToWorld, cameraOrigin, worldToPreviousCamera);
+				}
+			}
+		});
+}
+
+void Renderer::ReconstructPixel(uint32_t px, uint32_t py, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin, const Matrix& worldToPreviousCamera)
+{
+	//Every traced neighbour that hit something is a guess for how far away the surface behind this pixel is
+	std::array<float, 8> candidateDistances{};
+	uint32_t candidateCount{ 0 };
+	ColorRGB neighbourSum{};
+	ColorRGB neighbourMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+	ColorRGB neighbourMax{};
+	uint32_t neighbourCount{ 0 };
+	for (uint32_t y{ py > 0 ? py - 1 : 0 }; y <= std::min(py + 1, m_RenderHeight - 1); ++y)
+	{
+		for (uint32_t x{ px > 0 ? px - 1 : 0 }; x <= std::min(px + 1, m_RenderWidth - 1); ++x)
+		{
+			if (!IsPixelTraced(x, y))
+				continue;
+
+			const ColorRGB color{ m_pFrameBuffer->GetPixel(x, y) };
+			neighbourSum += color;
+			neighbourMin = ColorRGB{ std::min(neighbourMin.r, color.r), std::min(neighbourMin.g, color.g), std::min(neighbourMin.b, color.b) };
+			neighbourMax = ColorRGB{ std::max(neighbourMax.r, color.r), std::max(neighbourMax.g, color.g), std::max(neighbourMax.b, color.b) };
+			++neighbourCount;
+
+			const float distance{ m_HitDistances[x + size_t(y) * m_RenderWidth] };
+			if (distance < FLT_MAX)
+				candidateDistances[candidateCount++] = distance;
+		}
+	}
+	//Nearest first, at a silhouette the foreground is tried before the surface behind it. At most 8, an insertion sort is enough
+	for (uint32_t inx{ 1 }; inx < candidateCount; ++inx)
+	{
+		const float distance{ candidateDistances[inx] };
+		uint32_t slot{ inx };
+		for (; slot > 0 && candidateDistances[slot - 1] > distance; --slot)
+		{
+			candidateDistances[slot] = candidateDistances[slot - 1];
+		}
+		candidateDistances[slot] = distance;
+	}
+
+	const size_t pixelIndex{ px + size_t(py) * m_RenderWidth };
+	const Vector3 viewDirection{ GenerateViewRay(px + 0.5f, py + 0.5f, FOV, aspectRatio, cameraToWorld, cameraOrigin).direction };
+	const Vector3 previousOrigin{ m_PreviousCameraToWorld.GetTranslation() };
+	for (uint32_t inx{}; inx < candidateCount; ++inx)
+	{
+		const float distance{ candidateDistances[inx] };
+		const Vector3 point{ cameraOrigin + viewDirection * distance };
+
+		//Inverse of GenerateViewRay with the previous view
+		const Vector3 previousViewPoint{ worldToPreviousCamera.TransformPoint(point) };
+		if (previousViewPoint.z <= 0.f)
+			continue;
+
+		const float previousX{ (previousViewPoint.x / (previousViewPoint.z * aspectRatio * m_PreviousFOV) + 1.f) * 0.5f * m_RenderWidth };
+		const float previousY{ (1.f - previousViewPoint.y / (previousViewPoint.z * m_PreviousFOV)) * 0.5f * m_RenderHeight };
+		if (previousX < 0.f || previousY < 0.f || previousX >= m_RenderWidth || previousY >= m_RenderHeight)
+			continue;
+
+		const uint32_t previousPx{ uint32_t(previousX) };
+		const uint32_t previousPy{ uint32_t(previousY) };
+		const float previousDistance{ m_HistoryHitDistances[previousPx + size_t(previousPy) * m_RenderWidth] };
+		if (previousDistance == FLT_MAX)
+			continue;
+
+		//The previous frame has to have seen the same surface there, otherwise the point was hidden or the guess is off
+		const Vector3 previousDirection{ GenerateViewRay(previousPx + 0.5f, previousPy + 0.5f, m_PreviousFOV, aspectRatio, m_PreviousCameraToWorld, previousOrigin).direction };
+		const Vector3 previousPoint{ previousOrigin + previousDirection * previousDistance };
+		const float tolerance{ ReprojectionTolerance * distance };
+		if ((previousPoint - point).SqrMagnitude() > tolerance * tolerance)
+			continue;
+
+		//Clamped to the range of the traced neighbours, moving objects and shadows would otherwise keep their stale shading
+		const ColorRGB previousColor{ m_pHistoryBuffer->GetPixel(previousPx, previousPy) };
+		m_pFrameBuffer->SetPixel(px, py, ColorRGB{ std::clamp(previousColor.r, neighbourMin.r, neighbourMax.r),
+			std::clamp(previousColor.g, neighbourMin.g, neighbourMax.g), std::clamp(previousColor.b, neighbourMin.b, neighbourMax.b) });
+		m_HitDistances[pixelIndex] = distance;
+		return;
+	}
+
+	//Disoccluded or off the previous image: the traced neighbours' average, black between misses like the background
+	m_pFrameBuffer->SetPixel(px, py, neighbourCount > 0 ? neighbourSum / float(neighbourCount) : ColorRGB{});
+	m_HitDistances[pixelIndex] = candidateCount > 0 ? candidateDistances[0] : FLT_MAX;
+}
+
+ColorRGB Renderer::TraceViewRay(Scene* pScene, float rx, float ry, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const
+{
+	const Ray viewRay{ GenerateViewRay(rx, ry, FOV, aspectRatio, cameraToWorld, cameraOrigin) };
 
-	ColorRGB finalColor{  };
 	HitRecord closestHit{ };
+	pScene->GetClosestHit(viewRay, closestHit);
 
-	pScene->GetClosestHit(viewRay, closestHit);;
+	return ShadeHit(pScene, closestHit, cameraOrigin);
+}
+
+Ray Renderer::GenerateViewRay(float rx, float ry, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const
+{
+	Vector3 rayDirection{ (2 * rx / m_RenderWidth - 1) * aspectRatio * FOV ,   (1 - 2 * ry / m_RenderHeight) * FOV, 1.f };
+
+	rayDirection.Normalize();
+
+	return Ray{ cameraOrigin, cameraToWorld.TransformVector(rayDirection) };
+}
+
+ColorRGB Renderer::ShadeHit(Scene* pScene, const HitRecord& closestHit, const Vector3& cameraOrigin, std::vector<std::vector<ShadowRay>>* pShadowQueues, uint32_t target) const
+{
+	const MaterialTable& materials{ pScene->GetMaterials() };
+
+	ColorRGB finalColor{  };
 
 	if (closestHit.didHit)
 	{
 
 		//finalColor = materials[closestHit.materialIndex]->Shade();
-		for (const Light& lightPtr : pScene->GetLights())
+		const std::pmr::vector<Light>& lights{ pScene->GetLights() };
+		for (uint32_t lightIndex{}; lightIndex < lights.size(); ++lightIndex)
 		{
+			const Light& lightPtr = lights[lightIndex];
 			float distanceFromHitToLight;
 
 			Vector3 lightDirection{ LightUtils::GetDirectionToLight(lightPtr, closestHit.origin) };
 			distanceFromHitToLight = lightDirection.Magnitude();
 			lightDirection.Normalize();
 
-			if (m_ShadowsEnabled)
-			{
-				if (pScene->DoesHit(Ray(closestHit.origin, lightDirection, 0.0001f, distanceFromHitToLight))) continue;
-			}
-
+			//Lights behind the surface add nothing, so they don't need a shadow ray either
 			float cosOfAngle{ Vector3::Dot(closestHit.normal, lightDirection) };
 			if (cosOfAngle < 0) continue;
 
+			const Ray shadowRay{ closestHit.origin, lightDirection, 0.0001f, distanceFromHitToLight };
+			if (m_ShadowsEnabled && !pShadowQueues)
+			{
+				Instrumentation::Add(Instrumentation::Counter::ShadowRays);
+				if (pScene->DoesHit(shadowRay)) continue;
+			}
 
 			//finalColor = ColorRGB(cosOfAngle, cosOfAngle, cosOfAngle);
 			Vector3 hitToCameraDirection = (closestHit.origin, cameraOrigin).Normalized();
 
-			ColorRGB brdf{ materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, hitToCameraDirection) };
+			ColorRGB brdf{ materials.Shade(closestHit.materialIndex, closestHit, lightDirection, hitToCameraDirection) };
 
-			if (m_CurrentLightingMode == LightingMode::ObservedArea)
+			ColorRGB lightColor{};
+			switch (m_CurrentLightingMode)
 			{
-				finalColor += ColorRGB(cosOfAngle, cosOfAngle, cosOfAngle);
+			case LightingMode::ObservedArea:
+				lightColor = ColorRGB(cosOfAngle, cosOfAngle, cosOfAngle);
+				break;
+			case LightingMode::Radiance:
+				lightColor = LightUtils::GetRadiance(lightPtr, closestHit.origin);
+				break;
+			case LightingMode::BRDF:
+				lightColor = brdf;
+				break;
+			case LightingMode::Combined:
+				lightColor = cosOfAngle * LightUtils::GetRadiance(lightPtr, closestHit.origin) * brdf;
+				break;
 			}
 
-			if (m_CurrentLightingMode == LightingMode::Radiance)
+			if (m_ShadowsEnabled && pShadowQueues)
 			{
-				finalColor += LightUtils::GetRadiance(lightPtr, closestHit.origin);
+				(*pShadowQueues)[lightIndex].push_back({ shadowRay, lightColor, target });
+				continue;
 			}
 
-			if (m_CurrentLightingMode == LightingMode::BRDF)
+			finalColor += lightColor;
+		}
+	}
+
+	return finalColor;
+}
+
+void Renderer::ResolveFrame()
+{
+	const Instrumentation::ScopedStageTimer resolveTimer{ Instrumentation::Stage::Resolve };
+
+	const uint32_t bandCount{ (uint32_t(m_Height) + ResolveBandHeight - 1) / ResolveBandHeight };
+
+	//A scaled down frame is resampled to the window size first, everything below then resolves that copy
+	const FrameBuffer* pOutputBuffer{ m_pFrameBuffer.get() };
+	if (m_RenderWidth != uint32_t(m_Width) || m_RenderHeight != uint32_t(m_Height))
+	{
+		if (!m_pUpscaledBuffer)
+			m_pUpscaledBuffer = std::make_unique<FrameBuffer>(uint32_t(m_Width), uint32_t(m_Height));
+
+		m_pThreadPool->ParallelFor(bandCount, [&](uint32_t bandIndex)
 			{
-				finalColor += brdf;
-			}
+				const uint32_t firstRow{ bandIndex * ResolveBandHeight };
+				const uint32_t lastRow{ std::min(firstRow + ResolveBandHeight, uint32_t(m_Height)) };
+				m_pUpscaledBuffer->Upscale(*m_pFrameBuffer, firstRow, lastRow);
+			});
+		pOutputBuffer = m_pUpscaledBuffer.get();
+	}
 
-			if (m_CurrentLightingMode == LightingMode::Combined)
+	const SDL_PixelFormat* pFormat{ m_pBuffer->format };
+	if (pFormat->BytesPerPixel != 4)
+	{
+		//Uncommon surface layouts, not worth a packed path
+		for (uint32_t py{}; py < uint32_t(m_Height); ++py)
+		{
+			for (uint32_t px{}; px < uint32_t(m_Width); ++px)
 			{
-				finalColor += cosOfAngle * LightUtils::GetRadiance(lightPtr, closestHit.origin) * brdf;
+				ColorRGB finalColor{ pOutputBuffer->GetPixel(px, py) };
+				finalColor.MaxToOne();
+
+				const Uint32 pixel{ SDL_MapRGB(pFormat,
+					static_cast<uint8_t>(std::clamp(finalColor.r, 0.f, 1.f) * 255),
+					static_cast<uint8_t>(std::clamp(finalColor.g, 0.f, 1.f) * 255),
+					static_cast<uint8_t>(std::clamp(finalColor.b, 0.f, 1.f) * 255)) };
+				std::memcpy(static_cast<uint8_t*>(m_pBuffer->pixels) + py * m_pBuffer->pitch + px * pFormat->BytesPerPixel, &pixel, pFormat->BytesPerPixel);
 			}
 		}
-		finalColor.MaxToOne();
+		return;
+	}
 
-		m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-			static_cast<uint8_t>(finalColor.r * 255),
-			static_cast<uint8_t>(finalColor.g * 255),
-			static_cast<uint8_t>(finalColor.b * 255));
+	//The surface layout is looked up once here instead of once per pixel in SDL_MapRGB
+	PackedPixelFormat packedFormat{};
+	packedFormat.redShift = pFormat->Rshift;
+	packedFormat.greenShift = pFormat->Gshift;
+	packedFormat.blueShift = pFormat->Bshift;
+	packedFormat.redLoss = pFormat->Rloss;
+	packedFormat.greenLoss = pFormat->Gloss;
+	packedFormat.blueLoss = pFormat->Bloss;
+	packedFormat.alphaMask = pFormat->Amask;
 
-    }
+	const uint32_t pixelsPerRow{ uint32_t(m_pBuffer->pitch) / 4 };
 
+	m_pThreadPool->ParallelFor(bandCount, [&](uint32_t bandIndex)
+		{
+			const uint32_t firstRow{ bandIndex * ResolveBandHeight };
+			const uint32_t lastRow{ std::min(firstRow + ResolveBandHeight, uint32_t(m_Height)) };
+			pOutputBuffer->Resolve(firstRow, lastRow, packedFormat, m_ApplyGamma, m_pBufferPixels, pixelsPerRow);
+		});
 }
 
 bool Renderer::SaveBufferToImage() const
@@ -146,6 +778,11 @@ bool Renderer::SaveBufferToImage() const
 	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
 }
 
+bool Renderer::SaveBufferToImage(const std::string& path) const
+{
+	return m_pFrameBuffer->SaveToFile(path, m_ApplyGamma);
+}
+
 void Renderer::CycleLightingMode()
 {
 	switch (m_CurrentLightingMode)
@@ -163,4 +800,5 @@ void Renderer::CycleLightingMode()
 		m_CurrentLightingMode = LightingMode::Combined;
 		break;
 	}
+	ResetAccumulation();
 }
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -8,35 +13,220 @@ struct SDL_Surface;
 namespace dae
 {
 	class Scene;
-	class Matrix;
-	class Vector3;
+	struct Ray;
+	struct HitRecord;
+	class ThreadPool;
+	class FrameBuffer;
+	struct ColorRGB;
+	struct Occluder;
+
+	//Work done by one Render call
+	struct RenderStatistics
+	{
+		uint64_t primaryRayCount{};
+		//Occlusion rays towards the lights, progressive frames trace them inline while shading and leave this at 0
+		uint64_t shadowRayCount{};
+	};
 
 	class Renderer final
 	{
 	public:
-		Renderer(SDL_Window* pWindow);
-		~Renderer() = default;
+		/**
+		 * \param threadCount threads rendering a frame, 0 uses every hardware thread
+		 * \param tileSize width and height in pixels of the square tiles a frame is split into
+		 */
+		Renderer(SDL_Window* pWindow, uint32_t threadCount = 0, uint32_t tileSize = 32);
+		//Headless: only renders into the framebuffer, no window or SDL video subsystem is needed
+		Renderer(uint32_t width, uint32_t height, uint32_t threadCount = 0, uint32_t tileSize = 32);
+		~Renderer();
 
 		Renderer(const Renderer&) = delete;
 		Renderer(Renderer&&) noexcept = delete;
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float FOV, float aspectRatio, const Matrix cameraToWorld, const Vector3 cameraOrigin) const;
+		void Render(Scene* pScene);
+		void RenderPixel(Scene* pScene, uint32_t px, uint32_t py, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const;
 		bool SaveBufferToImage() const;
+		//Writes the float framebuffer, see FrameBuffer::SaveToFile for the supported formats
+		bool SaveBufferToImage(const std::string& path) const;
+
+		const FrameBuffer& GetFrameBuffer() const { return *m_pFrameBuffer; }
+		const RenderStatistics& GetLastFrameStatistics() const { return m_LastFrameStatistics; }
+		bool IsHeadless() const { return m_pWindow == nullptr; }
 
 		void CycleLightingMode();
-		void ToogleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; }
+		void ToogleShadows() { m_ShadowsEnabled = !m_ShadowsEnabled; ResetAccumulation(); }
+
+		void SetThreadCount(uint32_t threadCount);
+		void SetTileSize(uint32_t tileSize) { m_TileSize = tileSize > 0 ? tileSize : 1; }
+		uint32_t GetTileSize() const { return m_TileSize; }
+		void SetSamplesPerPixel(uint32_t samplesPerPixel) { m_SamplesPerPixel = samplesPerPixel > 0 ? samplesPerPixel : 1; m_IsHistoryValid = false; }
+		uint32_t GetSamplesPerPixel() const { return m_SamplesPerPixel; }
+		//sRGB encode the window and the 8-bit image formats, off keeps the linear output
+		void SetGammaCorrection(bool applyGamma) { m_ApplyGamma = applyGamma; }
+		bool GetGammaCorrection() const { return m_ApplyGamma; }
+
+		//Progressive: every frame adds jittered samples to a running average instead of replacing the image.
+		//The average restarts when the camera, the scene or the lighting settings change
+		void SetProgressive(bool isProgressive) { m_IsProgressive = isProgressive; ResetAccumulation(); }
+		bool IsProgressive() const { return m_IsProgressive; }
+		//A pixel stops sampling once the standard error of its mean luminance drops below this, relative to max(mean, 1)
+		void SetConvergenceThreshold(float threshold) { m_ConvergenceThreshold = threshold; }
+		void SetMaxSamplesPerPixel(uint32_t maxSamples) { m_MaxSamplesPerPixel = maxSamples > 0 ? maxSamples : 1; }
+		//Also drops the frame interleaved rendering reprojects from, it was shaded with the old settings
+		void ResetAccumulation() { m_IsAccumulationValid = false; m_IsHistoryValid = false; }
+		//True when the last progressive frame had no pixel left to sample
+		bool IsConverged() const { return m_IsProgressive && m_IsAccumulationValid && m_ActivePixelCount == 0; }
+		uint32_t GetActivePixelCount() const { return m_ActivePixelCount; }
+
+		//Trace 2x2 pixel blocks as one SSE ray packet, progressive frames always trace single rays
+		void SetPacketTracing(bool isPacketTracing) { m_IsPacketTracing = isPacketTracing; }
+		bool IsPacketTracing() const { return m_IsPacketTracing; }
+		//Remember per pixel and light what blocked the last shadow ray and test that first on the next frame, progressive frames don't use it
+		void SetOccluderCaching(bool isOccluderCaching) { m_IsOccluderCaching = isOccluderCaching; }
+		bool IsOccluderCaching() const { return m_IsOccluderCaching; }
+
+		//Dynamic resolution: while the camera moves, frames are traced at a reduced internal resolution picked to fit the budget
+		//and upscaled to the window. A camera that stops gets a full resolution frame again. 0 turns it off
+		void SetFrameTimeBudget(float seconds);
+		float GetFrameTimeBudget() const { return m_FrameTimeBudget; }
+		//Duration of the last whole frame (Timer::GetElapsed), the next render scale is picked from it
+		void ReportFrameTime(float seconds);
+		//Fraction of the output width and height the last frame was traced at
+		float GetRenderScale() const { return float(m_RenderWidth) / m_Width; }
+		uint32_t GetRenderWidth() const { return m_RenderWidth; }
+		uint32_t GetRenderHeight() const { return m_RenderHeight; }
+
+		//Interleaved rendering: while the camera moves, a frame traces one in every factor pixels, in a pattern that rotates over
+		//the frames (2 is a checkerboard, 4 one pixel per 2x2 block). The skipped pixels are reprojected from the previous frame.
+		//A static camera and progressive frames trace every pixel, 1 turns it off
+		void SetInterleaveFactor(uint32_t factor) { m_InterleaveFactor = factor == 2 || factor == 4 ? factor : 1; }
+		uint32_t GetInterleaveFactor() const { return m_InterleaveFactor; }
+
+		//Incremental rendering: with a static camera, only the tiles where a pixel sees an object that moved, or has a shadow ray
+		//crossing one (Scene::GetChangedBoundsMin/Max), are traced again. The other tiles keep the previous frame.
+		//Decided at the pixel centers, so frames with more than one sample per pixel trace everything
+		void SetIncrementalRendering(bool isIncremental) { m_IsIncrementalRendering = isIncremental; }
+		bool IsIncrementalRendering() const { return m_IsIncrementalRendering; }
 	private:
+		//Rows per task when the framebuffer is resolved to the window surface
+		static constexpr uint32_t ResolveBandHeight{ 16 };
+		//Dynamic resolution never goes below this fraction of the output size, and moves in steps of RenderScaleStep
+		//so small frame time jitter doesn't resize the framebuffer every frame
+		static constexpr float MinRenderScale{ 0.25f };
+		static constexpr float RenderScaleStep{ 0.125f };
+		//Weight of the newest frame in the running per-pixel cost
+		static constexpr float FrameCostSmoothing{ 0.25f };
+
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pBuffer{};
 		uint32_t* m_pBufferPixels{};
 
+		//Output size, the window or the headless image
 		int m_Width{};
 		int m_Height{};
+		//Size the rays are traced at, the output size unless dynamic resolution scaled it down
+		uint32_t m_RenderWidth{};
+		uint32_t m_RenderHeight{};
+
+		std::unique_ptr<FrameBuffer> m_pFrameBuffer{};
+		//Output sized copy of a scaled down frame, only allocated once a frame is traced below the window size
+		std::unique_ptr<FrameBuffer> m_pUpscaledBuffer{};
+		std::unique_ptr<ThreadPool> m_pThreadPool{};
+		uint32_t m_TileSize{ 32 };
+		uint32_t m_SamplesPerPixel{ 1 };
+		RenderStatistics m_LastFrameStatistics{};
+		bool m_ApplyGamma{ false };
+		bool m_IsPacketTracing{ true };
+
+		//Light-major, one entry per light and pixel. Entries stay correct across frames on their own: an occluder that
+		//still blocks the ray proves the shadow, one that doesn't falls back to the full query
+		bool m_IsOccluderCaching{ true };
+		std::vector<Occluder> m_OccluderCache{};
+		const Scene* m_pOccluderCacheScene{};
+
+		float m_FrameTimeBudget{ 0.f };
+		float m_AdaptiveRenderScale{ 1.f };
+		//Running average of the frame time per traced pixel, 0 until the first frame is reported
+		float m_SecondsPerPixel{ 0.f };
+		//View of the previous frame, a change means the camera is moving
+		Matrix m_PreviousCameraToWorld{};
+		float m_PreviousFOV{};
+
+		//A reprojected point has to land within this fraction of its distance from the surface the previous frame saw there
+		static constexpr float ReprojectionTolerance{ 0.05f };
+		uint32_t m_InterleaveFactor{ 1 };
+		//Factor and pattern of the frame being traced, 1 when it traces every pixel
+		uint32_t m_ActiveInterleaveFactor{ 1 };
+		uint32_t m_InterleavePhase{};
+		//Frame before the last interleaved one, only allocated once a frame is interleaved
+		std::unique_ptr<FrameBuffer> m_pHistoryBuffer{};
+		//View ray hit distance per pixel through the pixel center, FLT_MAX on a miss. Written by every non-progressive frame
+		std::vector<float> m_HitDistances{};
+		std::vector<float> m_HistoryHitDistances{};
+
+		bool m_IsIncrementalRendering{ false };
+		//What the last non-progressive frame in the framebuffer was rendered from, interleaved and incremental frames build on it
+		bool m_IsHistoryValid{ false };
+		bool m_IsHistoryReconstructed{ false };
+		//Set when the last frame kept tiles from the one before, its time says nothing about the cost of a traced pixel
+		bool m_WasLastFrameIncremental{ false };
+		const Scene* m_pHistoryScene{};
+		uint64_t m_HistorySceneRevision{};
+
+		//Welford running variance of the pixel luminance, the running mean itself lives in the framebuffer
+		struct PixelAccumulation
+		{
+			uint32_t sampleCount{};
+			float luminanceM2{};
+			bool isConverged{};
+		};
+		//Samples taken before the variance estimate is trusted, fewer let flat pixels stop on an unlucky early agreement
+		static constexpr uint32_t MinConvergenceSamples{ 8 };
+
+		bool m_IsProgressive{ false };
+		bool m_IsAccumulationValid{ false };
+		float m_ConvergenceThreshold{ 1.f / 255.f };
+		uint32_t m_MaxSamplesPerPixel{ 256 };
+		uint32_t m_ActivePixelCount{};
+		std::vector<PixelAccumulation> m_Accumulation{};
+
+		//What the accumulated image was rendered with, any difference restarts it
+		const Scene* m_pAccumulatedScene{};
+		uint64_t m_AccumulatedSceneRevision{};
+		Matrix m_AccumulatedCameraToWorld{};
+		float m_AccumulatedFOV{};
+
+		//Traces more samples into the running average of one pixel, returns false once the pixel has converged
+		bool AccumulatePixel(Scene* pScene, uint32_t px, uint32_t py, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		struct ShadowRay;
 
+		//RenderPixel for every pixel of a tile. Per sample, all primary hits are shaded first and their shadow rays are queued,
+		//a second pass then runs only occlusion tests over the queue. Interleaved frames skip the pixels outside the pattern
+		RenderStatistics RenderTile(Scene* pScene, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		//Radiance arriving through one point on the image plane, (rx, ry) in pixels, black on a miss
+		ColorRGB TraceViewRay(Scene* pScene, float rx, float ry, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const;
+		Ray GenerateViewRay(float rx, float ry, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const;
+		/**
+		 * \brief Direct lighting at a primary hit, black on a miss
+		 * \param pShadowQueues when set, lights that need a shadow test are queued per light instead of traced, tagged with target
+		 * \return the contribution of the lights that need no shadow test
+		 */
+		ColorRGB ShadeHit(Scene* pScene, const HitRecord& closestHit, const Vector3& cameraOrigin, std::vector<std::vector<ShadowRay>>* pShadowQueues = nullptr, uint32_t target = 0) const;
+		//Whether the frame being traced covers the pixel, always true unless the frame is interleaved
+		bool IsPixelTraced(uint32_t px, uint32_t py) const;
+		//True when a pixel of the tile has its view ray or one of its shadow rays in the previous frame pass through a changed box
+		bool IsTileAffected(const Scene* pScene, uint32_t startX, uint32_t startY, uint32_t endX, uint32_t endY, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin) const;
+		//Fills the pixels an interleaved frame skipped, from the previous frame where the reprojection finds the same surface
+		//and from the traced neighbours where it doesn't
+		void ReconstructSkippedPixels(float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin);
+		void ReconstructPixel(uint32_t px, uint32_t py, float FOV, float aspectRatio, const Matrix& cameraToWorld, const Vector3& cameraOrigin, const Matrix& worldToPreviousCamera);
+		//Resizes the framebuffer when the traced size changes, dropping what was accumulated at the old size
+		void SetRenderResolution(uint32_t width, uint32_t height);
+		//Converts the finished framebuffer to the window surface, once per frame after every tile is traced
+		void ResolveFrame();
 
 		enum class LightingMode
 		{
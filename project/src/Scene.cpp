@@ -1,119 +1,522 @@
 #include "Scene.h"
+
+#include <algorithm>
+#include <numeric>
+
 #include "Utils.h"
 #include "Material.h"
+#include "MeshCache.h"
+#include "RayPacket.h"
+#include "Trace.h"
 
 namespace dae {
 
 #pragma region Base Scene
-	//Initialize Scene with Default Solid Color Material (RED)
-	Scene::Scene() :
-		m_Materials({ new Material_SolidColor({1,0,0}) })
+	//Initialize Scene with Default Solid Color Material (RED), it gets handle 0
+	Scene::Scene()
 	{
+		m_Materials.Add(Material_SolidColor{ { 1, 0, 0 } });
+
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
 		m_TriangleMeshGeometries.reserve(32);
+		m_MeshInstances.reserve(32);
 		m_Lights.reserve(32);
 	}
 
-	Scene::~Scene()
+	Scene::~Scene() = default;
+
+	void Scene::UpdateAccelerationStructure()
 	{
-		for (auto& pMaterial : m_Materials)
+		const Trace::ScopedEvent traceEvent{ "Scene::UpdateAccelerationStructure" };
+
+		const size_t objectCount{ m_SphereGeometries.size() + m_Triangles.size() + m_TriangleMeshGeometries.size() + m_MeshInstances.size() };
+		const bool needsRebuild{ !m_IsTopLevelBVHBuilt || m_BoundedObjects.size() != objectCount };
+
+		if (needsRebuild)
 		{
-			delete pMaterial;
-			pMaterial = nullptr;
+			m_BoundedObjects.clear();
+			m_BoundedObjects.reserve(objectCount);
+
+			for (uint32_t inx = 0; inx < m_SphereGeometries.size(); ++inx)
+				m_BoundedObjects.push_back({ SceneObjectType::Sphere, inx });
+			for (uint32_t inx = 0; inx < m_Triangles.size(); ++inx)
+				m_BoundedObjects.push_back({ SceneObjectType::Triangle, inx });
+			for (uint32_t inx = 0; inx < m_TriangleMeshGeometries.size(); ++inx)
+				m_BoundedObjects.push_back({ SceneObjectType::TriangleMesh, inx });
+			for (uint32_t inx = 0; inx < m_MeshInstances.size(); ++inx)
+				m_BoundedObjects.push_back({ SceneObjectType::MeshInstance, inx });
 		}
 
-		m_Materials.clear();
-	}
+		//Bounds are gathered every frame, animated meshes only move their AABB so a refit keeps the tree usable
+		m_BoundedObjectsMin.resize(objectCount);
+		m_BoundedObjectsMax.resize(objectCount);
+		m_BoundedObjectsRevision.resize(objectCount);
+		m_ChangedBoundsMin.clear();
+		m_ChangedBoundsMax.clear();
+		for (size_t inx = 0; inx < objectCount; ++inx)
+		{
+			const SceneObject& object = m_BoundedObjects[inx];
+			const Vector3 previousMin{ m_BoundedObjectsMin[inx] };
+			const Vector3 previousMax{ m_BoundedObjectsMax[inx] };
+			const uint32_t previousRevision{ m_BoundedObjectsRevision[inx] };
+			switch (object.type)
+			{
+			case SceneObjectType::Sphere:
+			{
+				const Sphere& sphere = m_SphereGeometries[object.index];
+				const Vector3 radius{ sphere.radius, sphere.radius, sphere.radius };
+				m_BoundedObjectsMin[inx] = sphere.origin - radius;
+				m_BoundedObjectsMax[inx] = sphere.origin + radius;
+				break;
+			}
+			case SceneObjectType::Triangle:
+			{
+				const Triangle& triangle = m_Triangles[object.index];
+				m_BoundedObjectsMin[inx] = Vector3::Min(triangle.v0, Vector3::Min(triangle.v1, triangle.v2));
+				m_BoundedObjectsMax[inx] = Vector3::Max(triangle.v0, Vector3::Max(triangle.v1, triangle.v2));
+				break;
+			}
+			case SceneObjectType::TriangleMesh:
+			case SceneObjectType::MeshInstance:
+			{
+				const MeshPlacement& placement = GetMeshPlacement(object);
+				m_BoundedObjectsMin[inx] = placement.transformedMinAABB;
+				m_BoundedObjectsMax[inx] = placement.transformedMaxAABB;
+				m_BoundedObjectsRevision[inx] = placement.revision;
+				break;
+			}
+			}
 
-	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
-	{
+			//After a rebuild the slots hold other objects, so there is nothing to compare against
+			if (needsRebuild)
+				continue;
 
-		HitRecord closestHitTemp{};
-		
-		for (const Sphere& sphere : m_SphereGeometries)
-		{
-			GeometryUtils::HitTest_Sphere(sphere, ray, closestHit);
-			if (closestHit.t < closestHitTemp.t)
+			const bool hasBoundsChanged{ !(previousMin == m_BoundedObjectsMin[inx]) || !(previousMax == m_BoundedObjectsMax[inx]) };
+			if (!hasBoundsChanged && previousRevision == m_BoundedObjectsRevision[inx])
+				continue;
+
+			m_ChangedBoundsMin.push_back(previousMin);
+			m_ChangedBoundsMax.push_back(previousMax);
+			if (hasBoundsChanged)
 			{
-				closestHitTemp = closestHit;
+				m_ChangedBoundsMin.push_back(m_BoundedObjectsMin[inx]);
+				m_ChangedBoundsMax.push_back(m_BoundedObjectsMax[inx]);
 			}
 		}
-			//throw std::runtime_error("Not Implemented Yet");
 
-		for (const Plane& plane : m_PlaneGeometries)
+		if (needsRebuild)
 		{
-			GeometryUtils::HitTest_Plane(plane, ray, closestHit);
-			if (closestHit.t < closestHitTemp.t)
+			m_TopLevelBVH.Build(m_BoundedObjectsMin, m_BoundedObjectsMax);
+			m_IsTopLevelBVHBuilt = true;
+
+			//Store the objects in leaf order, grouped by type inside every leaf, so the packed spheres and triangles
+			//of a leaf form contiguous runs. The primitive indices then become the identity
+			std::pmr::vector<uint32_t>& order = m_TopLevelBVH.primitiveIndices;
+			for (const BVHNode& node : m_TopLevelBVH.nodes)
 			{
-				closestHitTemp = closestHit;
+				if (!node.IsLeaf())
+					continue;
+
+				const auto first = order.begin() + node.leftFirst;
+				std::stable_sort(first, first + node.primitiveCount, [this](uint32_t a, uint32_t b)
+					{
+						return m_BoundedObjects[a].type < m_BoundedObjects[b].type;
+					});
 			}
+
+			//The bounds and revisions move along, next frame every slot compares against its own object again.
+			//The reordered copies live on the heap, the arena backed objects are copied back into their own storage
+			const auto applyOrder = [&order](auto& values)
+				{
+					std::vector<std::decay_t<decltype(values[0])>> sortedValues{};
+					sortedValues.reserve(order.size());
+					for (uint32_t objectIndex : order)
+					{
+						sortedValues.push_back(values[objectIndex]);
+					}
+					values.assign(sortedValues.begin(), sortedValues.end());
+				};
+			applyOrder(m_BoundedObjects);
+			applyOrder(m_BoundedObjectsMin);
+			applyOrder(m_BoundedObjectsMax);
+			applyOrder(m_BoundedObjectsRevision);
+			std::iota(m_TopLevelBVH.primitiveIndices.begin(), m_TopLevelBVH.primitiveIndices.end(), 0u);
+		}
+		else
+		{
+			m_TopLevelBVH.Refit(m_BoundedObjectsMin, m_BoundedObjectsMax);
 		}
 
-		for (const Triangle& triangle : m_Triangles)
+		PackGeometry();
+
+		if (needsRebuild || !m_ChangedBoundsMin.empty())
+			++m_Revision;
+	}
+
+	void Scene::PackGeometry()
+	{
+		m_PackedSpheres.Clear();
+		m_PackedTriangles.Clear();
+		m_PackedPlanes.Clear();
+
+		for (SceneObject& object : m_BoundedObjects)
 		{
-			GeometryUtils::HitTest_Triangle(triangle, ray, closestHit);
-			if (closestHit.t < closestHitTemp.t)
+			switch (object.type)
 			{
-				closestHitTemp = closestHit;
+			case SceneObjectType::Sphere:
+				object.packedIndex = m_PackedSpheres.count;
+				m_PackedSpheres.Add(m_SphereGeometries[object.index]);
+				break;
+			case SceneObjectType::Triangle:
+				object.packedIndex = m_PackedTriangles.count;
+				m_PackedTriangles.Add(m_Triangles[object.index]);
+				break;
+			case SceneObjectType::TriangleMesh:
+			case SceneObjectType::MeshInstance:
+				break;
 			}
 		}
-		
-		for (const TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+
+		for (const Plane& plane : m_PlaneGeometries)
 		{
-			GeometryUtils::HitTest_TriangleMesh(triangleMesh, ray, closestHit);
-			if (closestHit.t < closestHitTemp.t)
+			m_PackedPlanes.Add(plane);
+		}
+
+		m_PackedSpheres.Pad();
+		m_PackedTriangles.Pad();
+		m_PackedPlanes.Pad();
+	}
+
+	bool Scene::HitTest_Leaf(uint32_t first, uint32_t count, Ray& ray, HitRecord& hitRecord) const
+	{
+		const GeometryKernels& kernels = *m_pGeometryKernels;
+		bool didHit{ false };
+
+		const uint32_t last{ first + count };
+		for (uint32_t runStart = first; runStart < last;)
+		{
+			const SceneObject& object = m_BoundedObjects[runStart];
+
+			uint32_t runEnd{ runStart + 1 };
+			while (runEnd < last && m_BoundedObjects[runEnd].type == object.type)
+			{
+				++runEnd;
+			}
+
+			switch (object.type)
+			{
+			case SceneObjectType::Sphere:
+			{
+				float closestT{ ray.max };
+				const uint32_t sphereIndex{ kernels.closestSphere(m_PackedSpheres, object.packedIndex, runEnd - runStart, ray, closestT) };
+				if (sphereIndex == NoKernelHit)
+					break;
+
+				didHit = true;
+				ray.max = closestT;
+
+				const Vector3 sphereOrigin{ m_PackedSpheres.originX[sphereIndex], m_PackedSpheres.originY[sphereIndex], m_PackedSpheres.originZ[sphereIndex] };
+				hitRecord.didHit = true;
+				hitRecord.t = closestT;
+				hitRecord.materialIndex = m_PackedSpheres.materialIndex[sphereIndex];
+				hitRecord.origin = ray.origin + closestT * ray.direction;
+				hitRecord.normal = (hitRecord.origin - sphereOrigin).Normalized();
+				break;
+			}
+			case SceneObjectType::Triangle:
 			{
-				closestHitTemp = closestHit;
+				float closestT{ ray.max };
+				const uint32_t triangleIndex{ kernels.closestTriangle(m_PackedTriangles, object.packedIndex, runEnd - runStart, ray, false, closestT) };
+				if (triangleIndex == NoKernelHit)
+					break;
+
+				didHit = true;
+				ray.max = closestT;
+
+				const Vector3 edge1{ m_PackedTriangles.edge1X[triangleIndex], m_PackedTriangles.edge1Y[triangleIndex], m_PackedTriangles.edge1Z[triangleIndex] };
+				const Vector3 edge2{ m_PackedTriangles.edge2X[triangleIndex], m_PackedTriangles.edge2Y[triangleIndex], m_PackedTriangles.edge2Z[triangleIndex] };
+				hitRecord.didHit = true;
+				hitRecord.t = closestT;
+				hitRecord.materialIndex = m_PackedTriangles.materialIndex[triangleIndex];
+				hitRecord.origin = ray.origin + closestT * ray.direction;
+				hitRecord.normal = Vector3::Cross(edge1, edge2).Normalized();
+				break;
+			}
+			case SceneObjectType::TriangleMesh:
+			case SceneObjectType::MeshInstance:
+				for (uint32_t inx = runStart; inx < runEnd; ++inx)
+				{
+					//The mesh test clears didHit on a miss, so it writes into a temporary
+					HitRecord meshHit{};
+					const SceneObject& meshObject = m_BoundedObjects[inx];
+					if (!GeometryUtils::HitTest_PlacedMesh(GetMeshData(meshObject), GetMeshPlacement(meshObject), ray, meshHit))
+						continue;
+
+					didHit = true;
+					hitRecord = meshHit;
+					ray.max = meshHit.t;
+				}
+				break;
 			}
+
+			runStart = runEnd;
 		}
 
+		return didHit;
+	}
+
+	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	{
+		//Shrinking max makes every later test reject anything behind the closest hit so far
+		Ray closestRay{ ray };
+		HitRecord closestHitTemp{};
+
+		//Planes first, they usually enclose the scene and give the BVH traversal a tight max to cull against
+		float closestT{ closestRay.max };
+		const uint32_t planeIndex{ m_pGeometryKernels->closestPlane(m_PackedPlanes, 0, m_PackedPlanes.count, closestRay, closestT) };
+		if (planeIndex != NoKernelHit)
+		{
+			closestRay.max = closestT;
+
+			closestHitTemp.didHit = true;
+			closestHitTemp.t = closestT;
+			closestHitTemp.materialIndex = m_PackedPlanes.materialIndex[planeIndex];
+			closestHitTemp.normal = Vector3{ m_PackedPlanes.normalX[planeIndex], m_PackedPlanes.normalY[planeIndex], m_PackedPlanes.normalZ[planeIndex] };
+			closestHitTemp.origin = closestRay.origin + closestT * closestRay.direction;
+		}
+
+		GeometryUtils::Traverse_BVHLeaves(m_TopLevelBVH, closestRay, [&](uint32_t first, uint32_t count)
+			{
+				HitTest_Leaf(first, count, closestRay, closestHitTemp);
+				return false;
+			});
+
 		closestHit = closestHitTemp;
 	}
 
-	bool Scene::DoesHit(const Ray& ray) const
+	void Scene::GetClosestHits(const Ray* pRays, uint32_t rayCount, HitRecord* pClosestHits) const
 	{
-		for (const Sphere& sphere : m_SphereGeometries)
+#if defined(DAE_PACKET_TRACING)
+		RayPacket packet{};
+		for (uint32_t lane = 0; lane < rayCount; ++lane)
 		{
-			if (GeometryUtils::HitTest_Sphere(sphere, ray))
+			packet.SetRay(lane, pRays[lane]);
+		}
+
+		if (rayCount > 1 && packet.IsCoherent())
+		{
+			HitRecord closestHits[RayPacketWidth]{};
+			for (uint32_t lane = 0; lane < rayCount; ++lane)
 			{
-				return true;
+				const Ray& ray = pRays[lane];
+				float closestT{ ray.max };
+				const uint32_t planeIndex{ m_pGeometryKernels->closestPlane(m_PackedPlanes, 0, m_PackedPlanes.count, ray, closestT) };
+				if (planeIndex == NoKernelHit)
+					continue;
+
+				packet.max[lane] = closestT;
+
+				HitRecord& closestHit = closestHits[lane];
+				closestHit.didHit = true;
+				closestHit.t = closestT;
+				closestHit.materialIndex = m_PackedPlanes.materialIndex[planeIndex];
+				closestHit.normal = Vector3{ m_PackedPlanes.normalX[planeIndex], m_PackedPlanes.normalY[planeIndex], m_PackedPlanes.normalZ[planeIndex] };
+				closestHit.origin = ray.origin + closestT * ray.direction;
 			}
+
+			GeometryUtils::Traverse_BVHLeavesPacket(m_TopLevelBVH, packet, packet.activeMask, [&](uint32_t first, uint32_t count, uint32_t laneMask)
+				{
+					HitTest_LeafPacket(first, count, laneMask, packet, closestHits);
+				});
+
+			std::copy(closestHits, closestHits + rayCount, pClosestHits);
+			return;
+		}
+#endif
+		for (uint32_t lane = 0; lane < rayCount; ++lane)
+		{
+			GetClosestHit(pRays[lane], pClosestHits[lane]);
 		}
+	}
 
-		for (const Plane& plane : m_PlaneGeometries)
+	void Scene::HitTest_LeafPacket(uint32_t first, uint32_t count, uint32_t laneMask, RayPacket& packet, HitRecord* pHits) const
+	{
+#if defined(DAE_PACKET_TRACING)
+		const uint32_t last{ first + count };
+		for (uint32_t runStart = first; runStart < last;)
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray))
+			const SceneObjectType type{ m_BoundedObjects[runStart].type };
+
+			uint32_t runEnd{ runStart + 1 };
+			while (runEnd < last && m_BoundedObjects[runEnd].type == type)
 			{
-				return true;
+				++runEnd;
+			}
+
+			if (type == SceneObjectType::TriangleMesh || type == SceneObjectType::MeshInstance)
+			{
+				for (uint32_t inx = runStart; inx < runEnd; ++inx)
+				{
+					const SceneObject& meshObject = m_BoundedObjects[inx];
+					GeometryUtils::HitTest_PlacedMeshPacket(GetMeshData(meshObject), GetMeshPlacement(meshObject), packet, laneMask, pHits);
+				}
+			}
+			else
+			{
+				for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+				{
+					if (!(laneMask & (1u << lane)))
+						continue;
+
+					Ray ray{ packet.GetRay(lane) };
+					if (HitTest_Leaf(runStart, runEnd - runStart, ray, pHits[lane]))
+						packet.max[lane] = ray.max;
+				}
 			}
+
+			runStart = runEnd;
 		}
+#endif
+	}
 
-		for (const Triangle& triangle : m_Triangles)
+	bool Scene::DoesHit_Leaf(uint32_t first, uint32_t count, const Ray& ray, Occluder& occluder) const
+	{
+		const GeometryKernels& kernels = *m_pGeometryKernels;
+
+		const uint32_t last{ first + count };
+		for (uint32_t runStart = first; runStart < last;)
 		{
-	
-			HitRecord triangleHit;
-			if (GeometryUtils::HitTest_Triangle(triangle, ray, triangleHit, true))
+			const SceneObject& object = m_BoundedObjects[runStart];
+
+			uint32_t runEnd{ runStart + 1 };
+			while (runEnd < last && m_BoundedObjects[runEnd].type == object.type)
+			{
+				++runEnd;
+			}
+
+			//The packed copies of a run are contiguous, so a packed index maps straight back to its object
+			float closestT{ ray.max };
+			switch (object.type)
 			{
+			case SceneObjectType::Sphere:
+			{
+				const uint32_t sphereIndex{ kernels.anySphere(m_PackedSpheres, object.packedIndex, runEnd - runStart, ray, closestT) };
+				if (sphereIndex == NoKernelHit)
+					break;
+
+				occluder = { runStart + (sphereIndex - object.packedIndex), 0, 0 };
 				return true;
+			}
+			case SceneObjectType::Triangle:
+			{
+				const uint32_t triangleIndex{ kernels.anyTriangle(m_PackedTriangles, object.packedIndex, runEnd - runStart, ray, true, closestT) };
+				if (triangleIndex == NoKernelHit)
+					break;
 
+				occluder = { runStart + (triangleIndex - object.packedIndex), 0, 0 };
+				return true;
+			}
+			case SceneObjectType::TriangleMesh:
+			case SceneObjectType::MeshInstance:
+				for (uint32_t inx = runStart; inx < runEnd; ++inx)
+				{
+					const MeshPlacement& placement = GetMeshPlacement(m_BoundedObjects[inx]);
+
+					uint32_t recordIndex{};
+					if (!GeometryUtils::DoesHit_PlacedMesh(GetMeshData(m_BoundedObjects[inx]), placement, ray, &recordIndex))
+						continue;
+
+					occluder = { inx, recordIndex, placement.revision };
+					return true;
+				}
+				break;
 			}
+
+			runStart = runEnd;
 		}
 
-		for (const TriangleMesh& triangleMesh : m_TriangleMeshGeometries)
+		return false;
+	}
+
+	bool Scene::DoesHit_Occluder(const Occluder& occluder, const Ray& ray) const
+	{
+		//Same kernels as the full query, so a cached occluder never changes the answer
+		//After a rebuild the index may name another object, a hit on it is still a valid occlusion
+		const GeometryKernels& kernels = *m_pGeometryKernels;
+		float closestT{ ray.max };
+
+		if (occluder.object >= m_BoundedObjects.size())
 		{
-			HitRecord triangleHit;
-	
-			if (GeometryUtils::HitTest_TriangleMesh(triangleMesh, ray, triangleHit, true))
-			{ 
-				return true;
-			}
+			const uint64_t planeIndex{ uint64_t(occluder.object) - m_BoundedObjects.size() };
+			if (occluder.object == Occluder::None || planeIndex >= m_PackedPlanes.count)
+				return false;
+
+			return kernels.anyPlane(m_PackedPlanes, uint32_t(planeIndex), 1, ray, closestT) != NoKernelHit;
 		}
+
+		const SceneObject& object = m_BoundedObjects[occluder.object];
+		switch (object.type)
+		{
+		case SceneObjectType::Sphere:
+			return kernels.anySphere(m_PackedSpheres, object.packedIndex, 1, ray, closestT) != NoKernelHit;
+		case SceneObjectType::Triangle:
+			return kernels.anyTriangle(m_PackedTriangles, object.packedIndex, 1, ray, true, closestT) != NoKernelHit;
+		case SceneObjectType::TriangleMesh:
+		case SceneObjectType::MeshInstance:
+		{
+			const TriangleMesh& mesh = GetMeshData(object);
+			const MeshPlacement& placement = GetMeshPlacement(object);
+			if (placement.revision != occluder.revision || occluder.primitive >= mesh.triangleRecords.size())
+				return false;
+
+			return GeometryUtils::DoesHit_TriangleRecord(mesh, placement, occluder.primitive, ray);
+		}
+		}
+
 		return false;
 	}
 
+	bool Scene::DoesHit(const Ray& ray) const
+	{
+		Occluder occluder{};
+		return DoesHit(ray, occluder);
+	}
+
+	bool Scene::DoesHit(const Ray& ray, Occluder& occluder) const
+	{
+		if (DoesHit_Occluder(occluder, ray))
+		{
+			return true;
+		}
+
+		float closestT{ ray.max };
+		const uint32_t planeIndex{ m_pGeometryKernels->anyPlane(m_PackedPlanes, 0, m_PackedPlanes.count, ray, closestT) };
+		if (planeIndex != NoKernelHit)
+		{
+			occluder = { static_cast<uint32_t>(m_BoundedObjects.size()) + planeIndex, 0, 0 };
+			return true;
+		}
+
+		//The ray never shrinks, any hit inside [min, max] ends the traversal
+		bool didHit{ false };
+		Ray shadowRay{ ray };
+		GeometryUtils::Traverse_BVHLeaves(m_TopLevelBVH, shadowRay, [&](uint32_t first, uint32_t count)
+			{
+				didHit = DoesHit_Leaf(first, count, shadowRay, occluder);
+				return didHit;
+			});
+
+		//Most shadow rays reach their light, skip rewriting entries that are already empty
+		if (!didHit && occluder.object != Occluder::None)
+		{
+			occluder = {};
+		}
+		return didHit;
+	}
+
 #pragma region Scene Helpers
-	Sphere* Scene::AddSphere(const Vector3& origin, float radius, unsigned char materialIndex)
+	Sphere* Scene::AddSphere(const Vector3& origin, float radius, MaterialHandle materialIndex)
 	{
 		Sphere s;
 		s.origin = origin;
@@ -124,7 +527,7 @@ namespace dae {
 		return &m_SphereGeometries.back();
 	}
 
-	Plane* Scene::AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex)
+	Plane* Scene::AddPlane(const Vector3& origin, const Vector3& normal, MaterialHandle materialIndex)
 	{
 		Plane p;
 		p.origin = origin;
@@ -135,14 +538,54 @@ namespace dae {
 		return &m_PlaneGeometries.back();
 	}
 
-	TriangleMesh* Scene::AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex)
+	TriangleMesh* Scene::AddTriangleMesh(TriangleCullMode cullMode, MaterialHandle materialIndex)
 	{
-		TriangleMesh m{};
+		TriangleMesh& m = m_TriangleMeshGeometries.emplace_back(&m_Arena);
 		m.cullMode = cullMode;
 		m.materialIndex = materialIndex;
+		return &m;
+	}
+
+	MeshInstance* Scene::AddMeshInstance(std::shared_ptr<const TriangleMesh> pMesh, TriangleCullMode cullMode, MaterialHandle materialIndex)
+	{
+		MeshInstance instance{};
+		instance.pMesh = std::move(pMesh);
+		instance.cullMode = cullMode;
+		instance.materialIndex = materialIndex;
+
+		m_MeshInstances.emplace_back(std::move(instance));
+		return &m_MeshInstances.back();
+	}
+
+	std::shared_ptr<const TriangleMesh> Scene::LoadSharedMesh(const std::string& objPath)
+	{
+		const auto it = m_SharedMeshes.find(objPath);
+		if (it != m_SharedMeshes.end())
+			return it->second;
+
+		//LoadOBJ also builds the BVH, so the mesh is ready to be shared as is
+		auto pMesh = std::allocate_shared<TriangleMesh>(std::pmr::polymorphic_allocator<TriangleMesh>{ &m_Arena }, &m_Arena);
+		if (!MeshCache::LoadOBJ(objPath, *pMesh))
+			return nullptr;
+
+		m_SharedMeshes.emplace(objPath, pMesh);
+		return pMesh;
+	}
+
+	const TriangleMesh& Scene::GetMeshData(const SceneObject& object) const
+	{
+		if (object.type == SceneObjectType::MeshInstance)
+			return *m_MeshInstances[object.index].pMesh;
 
-		m_TriangleMeshGeometries.emplace_back(m);
-		return &m_TriangleMeshGeometries.back();
+		return m_TriangleMeshGeometries[object.index];
+	}
+
+	const MeshPlacement& Scene::GetMeshPlacement(const SceneObject& object) const
+	{
+		if (object.type == SceneObjectType::MeshInstance)
+			return m_MeshInstances[object.index];
+
+		return m_TriangleMeshGeometries[object.index];
 	}
 
 	Light* Scene::AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color)
@@ -168,25 +611,33 @@ namespace dae {
 		m_Lights.emplace_back(l);
 		return &m_Lights.back();
 	}
+#pragma endregion
+#pragma endregion
 
-	unsigned char Scene::AddMaterial(Material* pMaterial)
+	Scene* CreateScene(const std::string& name)
 	{
-		m_Materials.push_back(pMaterial);
-		return static_cast<unsigned char>(m_Materials.size() - 1);
+		if (name == "w1") return new Scene_W1();
+		if (name == "w2") return new Scene_W2();
+		if (name == "w3") return new Scene_W3();
+		if (name == "w3_test") return new Scene_W3_TestScene();
+		if (name == "w4_test") return new Scene_W4_TestScene();
+		if (name == "reference") return new Scene_W4_ReferenceScene();
+		if (name == "bunny") return new Scene_W4_BunnyScene();
+		if (name == "instances") return new Scene_W4_InstancedBunnyScene();
+
+		return nullptr;
 	}
-#pragma endregion
-#pragma endregion
 
 #pragma region SCENE W1
 	void Scene_W1::Initialize()
 	{
 		//default: Material id0 >> SolidColor Material (RED)
-		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		constexpr MaterialHandle matId_Solid_Red = 0;
+		const MaterialHandle matId_Solid_Blue = AddMaterial(Material_SolidColor{ colors::Blue });
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const MaterialHandle matId_Solid_Yellow = AddMaterial(Material_SolidColor{ colors::Yellow });
+		const MaterialHandle matId_Solid_Green = AddMaterial(Material_SolidColor{ colors::Green });
+		const MaterialHandle matId_Solid_Magenta = AddMaterial(Material_SolidColor{ colors::Magenta });
 
 		//Spheres
 		AddSphere({ -25.f, 0.f, 100.f }, 50.f, matId_Solid_Red);
@@ -206,12 +657,12 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.fovAngle = 45.f;
 		
-		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		constexpr MaterialHandle matId_Solid_Red = 0;
+		const MaterialHandle matId_Solid_Blue = AddMaterial(Material_SolidColor{ colors::Blue });
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow }); 
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green }); 
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const MaterialHandle matId_Solid_Yellow = AddMaterial(Material_SolidColor{ colors::Yellow }); 
+		const MaterialHandle matId_Solid_Green = AddMaterial(Material_SolidColor{ colors::Green }); 
+		const MaterialHandle matId_Solid_Magenta = AddMaterial(Material_SolidColor{ colors::Magenta });
 
 		//Plane
 		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matId_Solid_Green ); 
@@ -236,14 +687,14 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.fovAngle = 45.f;
 
-		const auto matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence{  { .972f, .960f, .915f }, 1.f,  1.f });
-		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence{  { .972f, .960f, .915f },  1.f,  .6f });
-		const auto matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence{  { .972f, .960f, .915f },  1.f, .1f });
-		const auto matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence{  { .75f, .75f, .75f },  0.f,  1.f });
-		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence{  { .75f, .75f, .75f },  0.f, .6f });
-		const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence{  { .75f, .75f, .75f },  0.f, .1f });
+		const auto matCT_GrayRoughMetal = AddMaterial(Material_CookTorrence{  { .972f, .960f, .915f }, 1.f,  1.f });
+		const auto matCT_GrayMediumMetal = AddMaterial(Material_CookTorrence{  { .972f, .960f, .915f },  1.f,  .6f });
+		const auto matCT_GraySmoothMetal = AddMaterial(Material_CookTorrence{  { .972f, .960f, .915f },  1.f, .1f });
+		const auto matCT_GrayRoughPlastic = AddMaterial(Material_CookTorrence{  { .75f, .75f, .75f },  0.f,  1.f });
+		const auto matCT_GrayMediumPlastic = AddMaterial(Material_CookTorrence{  { .75f, .75f, .75f },  0.f, .6f });
+		const auto matCT_GraySmoothPlastic = AddMaterial(Material_CookTorrence{  { .75f, .75f, .75f },  0.f, .1f });
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
 
 		// Planes
 		AddPlane( Vector3{ 0.f, 0.f, 10.f },Vector3{ 0.f, 0.f, -1.f }, matLambert_GrayBlue );  // BACK
@@ -252,9 +703,9 @@ namespace dae {
 		AddPlane( Vector3{ 5.f, 0.f, 0.f }, Vector3{ -1.f, 0.f, 0.f }, matLambert_GrayBlue );  // RIGHT
 		AddPlane( Vector3{ -5.f, 0.f, 0.f },Vector3{ 1.f, 0.f, 0.f }, matLambert_GrayBlue );  // LEFT
 
-		const auto matLambertPhong1 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 3.f));
-		const auto matLambertPhong2 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f));
-		const auto matLambertPhong3 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 50.f));
+		const auto matLambertPhong1 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 3.f));
+		const auto matLambertPhong2 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f));
+		const auto matLambertPhong3 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 50.f));
 
 		// Spheres
 		AddSphere( Vector3{ -1.75f, 1.f, 0.f }, .75f, matCT_GrayRoughMetal);
@@ -275,10 +726,10 @@ namespace dae {
 		m_Camera.origin = { 0.f, 1.f, -5.f };
 		m_Camera.fovAngle = 45.f;
 
-		const auto matLambert_Red = AddMaterial(new Material_Lambert(colors::Red, 1.f));
-		const auto matLambert_Blue = AddMaterial(new Material_Lambert(colors::Blue, 1.f));
-		const auto matLambert_Yellow = AddMaterial(new Material_Lambert(colors::Yellow, 1.f));
-		const auto matLambertPhong_Blue = AddMaterial(new Material_LambertPhong(colors::Blue, 1.f, 1.f, 60.f));
+		const auto matLambert_Red = AddMaterial(Material_Lambert(colors::Red, 1.f));
+		const auto matLambert_Blue = AddMaterial(Material_Lambert(colors::Blue, 1.f));
+		const auto matLambert_Yellow = AddMaterial(Material_Lambert(colors::Yellow, 1.f));
+		const auto matLambertPhong_Blue = AddMaterial(Material_LambertPhong(colors::Blue, 1.f, 1.f, 60.f));
 
 		// Spheres
 		AddSphere({ -.75f, 1.f, 0.f }, 1.f, matLambert_Red);
@@ -299,8 +750,8 @@ namespace dae {
 		m_Camera.fovAngle = 45.f;
 
 		// Materials
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		AddPlane(Vector3{ 0.f, 0.f, 10.f }, Vector3{ 0.f, 0.f, -1.f }, matLambert_GrayBlue);  // BACK
 		AddPlane(Vector3{ 0.f, 0.f, 0.f }, Vector3{ 0.f, 1.f, 0.f }, matLambert_GrayBlue);  // BOTTOM
@@ -317,7 +768,7 @@ namespace dae {
 
 		pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
 
-		Utils::ParseOBJ("resources/simple_cube.obj", pMesh->positions, pMesh->normals, pMesh->indices);
+		MeshCache::LoadOBJ("resources/simple_cube.obj", *pMesh);
 		//pMesh->positions = { { -0.75f, -1.f, 0.f }, { -0.75f, 1.f, .0f }, { 0.75f, 1.f, 1.f }, { 0.75f, -1.f, 0.f } };
 		//
 		//pMesh->indices = {
@@ -351,15 +802,15 @@ namespace dae {
 		m_Camera.fovAngle = 45.f;
 
 
-		const auto matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence{ { .972f, .960f, .915f }, 1.f,  1.f });
-		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence{ { .972f, .960f, .915f },  1.f,  .6f });
-		const auto matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence{ { .972f, .960f, .915f },  1.f, .1f });
-		const auto matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence{ { .75f, .75f, .75f },  0.f,  1.f });
-		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence{ { .75f, .75f, .75f },  0.f, .6f });
-		const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence{ { .75f, .75f, .75f },  0.f, .1f });
+		const auto matCT_GrayRoughMetal = AddMaterial(Material_CookTorrence{ { .972f, .960f, .915f }, 1.f,  1.f });
+		const auto matCT_GrayMediumMetal = AddMaterial(Material_CookTorrence{ { .972f, .960f, .915f },  1.f,  .6f });
+		const auto matCT_GraySmoothMetal = AddMaterial(Material_CookTorrence{ { .972f, .960f, .915f },  1.f, .1f });
+		const auto matCT_GrayRoughPlastic = AddMaterial(Material_CookTorrence{ { .75f, .75f, .75f },  0.f,  1.f });
+		const auto matCT_GrayMediumPlastic = AddMaterial(Material_CookTorrence{ { .75f, .75f, .75f },  0.f, .6f });
+		const auto matCT_GraySmoothPlastic = AddMaterial(Material_CookTorrence{ { .75f, .75f, .75f },  0.f, .1f });
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		// Planes
 		AddPlane(Vector3{ 0.f, 0.f, 10.f }, Vector3{ 0.f, 0.f, -1.f }, matLambert_GrayBlue);  // BACK
@@ -368,9 +819,9 @@ namespace dae {
 		AddPlane(Vector3{ 5.f, 0.f, 0.f }, Vector3{ -1.f, 0.f, 0.f }, matLambert_GrayBlue);  // RIGHT
 		AddPlane(Vector3{ -5.f, 0.f, 0.f }, Vector3{ 1.f, 0.f, 0.f }, matLambert_GrayBlue);  // LEFT
 
-		const auto matLambertPhong1 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 3.f));
-		const auto matLambertPhong2 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f));
-		const auto matLambertPhong3 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 50.f));
+		const auto matLambertPhong1 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 3.f));
+		const auto matLambertPhong2 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f));
+		const auto matLambertPhong3 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 50.f));
 
 		// Spheres
 		AddSphere(Vector3{ -1.75f, 1.f, 0.f }, .75f, matCT_GrayRoughMetal);
@@ -411,8 +862,6 @@ namespace dae {
 		for (const auto m : pMeshes)
 		{
 			m->RotateY(yawAngle);
-
-			m->UpdateAABB();
 			m->UpdateTransforms();
 		}
 	}
@@ -426,8 +875,8 @@ namespace dae {
 		m_Camera.fovAngle = 45.f;
 
 		// Materials
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		AddPlane(Vector3{ 0.f, 0.f, 10.f }, Vector3{ 0.f, 0.f, -1.f }, matLambert_GrayBlue);  // BACK
 		AddPlane(Vector3{ 0.f, 0.f, 0.f }, Vector3{ 0.f, 1.f, 0.f }, matLambert_GrayBlue);  // BOTTOM
@@ -437,9 +886,8 @@ namespace dae {
 
 		pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
 
-		Utils::ParseOBJ("resources/lowpoly_bunny.obj", pMesh->positions, pMesh->normals, pMesh->indices);
-
-		pMesh->CalculateNormals();
+		//Parsing already fills in the face normals
+		MeshCache::LoadOBJ("resources/lowpoly_bunny.obj", *pMesh);
 
 		pMesh->RotateY(PI);
 		pMesh->Scale(Vector3(2.f, 2.f, 2.f));
@@ -453,4 +901,56 @@ namespace dae {
 
 	}
 
+	void Scene_W4_InstancedBunnyScene::Initialize()
+	{
+		sceneName = "Instanced Bunny Scene";
+		m_Camera.origin = { 0.f, 3.f, -9.f };
+		m_Camera.fovAngle = 45.f;
+
+		// Materials
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert{ { .49f, 0.57f, 0.57f },  1.f });
+		const MaterialHandle bunnyMaterials[3]{
+			AddMaterial(Material_Lambert(colors::White, 1.f)),
+			AddMaterial(Material_CookTorrence{ { .972f, .960f, .915f }, 1.f, .3f }),
+			AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f)) };
+
+		AddPlane(Vector3{ 0.f, 0.f, 10.f }, Vector3{ 0.f, 0.f, -1.f }, matLambert_GrayBlue);  // BACK
+		AddPlane(Vector3{ 0.f, 0.f, 0.f }, Vector3{ 0.f, 1.f, 0.f }, matLambert_GrayBlue);  // BOTTOM
+		AddPlane(Vector3{ 0.f, 10.f, 0.f }, Vector3{ 0.f, -1.f, 0.f }, matLambert_GrayBlue);  // TOP
+		AddPlane(Vector3{ 5.f, 0.f, 0.f }, Vector3{ -1.f, 0.f, 0.f }, matLambert_GrayBlue);  // RIGHT
+		AddPlane(Vector3{ -5.f, 0.f, 0.f }, Vector3{ 1.f, 0.f, 0.f }, matLambert_GrayBlue);  // LEFT
+
+		//One load, nine placements
+		const std::shared_ptr<const TriangleMesh> pBunny{ LoadSharedMesh("resources/lowpoly_bunny.obj") };
+		if (pBunny)
+		{
+			for (int row = 0; row < 3; ++row)
+			{
+				for (int column = 0; column < 3; ++column)
+				{
+					MeshInstance* pInstance = AddMeshInstance(pBunny, TriangleCullMode::BackFaceCulling, bunnyMaterials[(row + column) % 3]);
+					pInstance->Translate(Vector3(-3.f + 3.f * column, 0.f, 4.f * row));
+					pInstance->UpdateTransforms();
+				}
+			}
+		}
+
+		AddPointLight(Vector3{ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, .61f, .45f });  // BackLight
+		AddPointLight(Vector3{ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, .8f, .45f });  // Front Light Left
+		AddPointLight(Vector3{ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ .34f, .47f, .68f });  // Front Light Right
+	}
+
+	void Scene_W4_InstancedBunnyScene::Update(Timer* pTimer)
+	{
+		Scene::Update(pTimer);
+
+		//Every instance turns at its own pace, the shared mesh itself never changes
+		for (size_t inx = 0; inx < m_MeshInstances.size(); ++inx)
+		{
+			MeshInstance& instance = m_MeshInstances[inx];
+			instance.RotateY(PI + (0.25f + 0.1f * inx) * pTimer->GetTotal());
+			instance.UpdateTransforms();
+		}
+	}
+
 }
@@ -1,19 +1,50 @@
 #pragma once
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "Maths.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "GeometryKernels.h"
+#include "Material.h"
 
 namespace dae
 {
 	//Forward Declarations
 	class Timer;
-	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
+	struct RayPacket;
+
+	//Bounded geometry referenced by the top-level BVH, planes are infinite and kept out of it
+	enum class SceneObjectType : uint8_t
+	{
+		Sphere,
+		Triangle,
+		TriangleMesh,
+		MeshInstance
+	};
+
+	struct SceneObject
+	{
+		SceneObjectType type{};
+		uint32_t index{}; //into the geometry vector of the matching type
+		uint32_t packedIndex{}; //into the packed SoA copy for spheres and triangles, meshes are tested one by one
+	};
+
+	//Last object that blocked a shadow ray, testing it first answers most repeated queries with a single primitive test
+	struct Occluder
+	{
+		static constexpr uint32_t None{ UINT32_MAX };
+
+		uint32_t object{ None }; //into the bounded objects, planes are numbered after them
+		uint32_t primitive{}; //triangle record for meshes and mesh instances
+		uint32_t revision{}; //placement revision it was found at, a mesh that moved since no longer counts as cached
+	};
 
 	//Scene Base Class
 	class Scene
@@ -33,35 +64,110 @@ namespace dae
 			m_Camera.Update(pTimer);
 		}
 
+		//Builds the top-level BVH on first use or when objects were added, refits it otherwise. Call after Initialize and Update
+		void UpdateAccelerationStructure();
+
+		//Changes whenever UpdateAccelerationStructure sees objects added or moved, the camera is not included
+		uint64_t GetRevision() const { return m_Revision; }
+		//World boxes of the objects that moved in the last UpdateAccelerationStructure, each one where it was and where it is now.
+		//Empty after a rebuild, the revision alone says everything changed then. Lights, planes and materials aren't tracked
+		const std::vector<Vector3>& GetChangedBoundsMin() const { return m_ChangedBoundsMin; }
+		const std::vector<Vector3>& GetChangedBoundsMax() const { return m_ChangedBoundsMax; }
+
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		/**
+		 * \brief GetClosestHit for up to RayPacketWidth rays, coherent rays are traced together as one packet
+		 * Rays pointing into different octants, or a target without packet support, fall back to one GetClosestHit per ray
+		 */
+		void GetClosestHits(const Ray* pRays, uint32_t rayCount, HitRecord* pClosestHits) const;
 		bool DoesHit(const Ray& ray) const;
+		/**
+		 * \brief DoesHit that tests the cached occluder before traversing the scene
+		 * \param occluder cached occluder, set to whatever blocks the ray or cleared when nothing does
+		 */
+		bool DoesHit(const Ray& ray, Occluder& occluder) const;
 
-		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
-		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
-		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const std::pmr::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
+		const std::pmr::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
+		const std::pmr::vector<Light>& GetLights() const { return m_Lights; }
+		const MaterialTable& GetMaterials() const { return m_Materials; }
 
 	protected:
-		std::string	sceneName;
+		//First arena block, later ones grow geometrically. Sized so the example scenes load without asking for a second one
+		static constexpr size_t InitialArenaSize{ 1 << 20 };
+
+		//Backs the geometry, mesh arrays, BVH nodes, lights and materials. Declared first so it is destroyed last:
+		//a scene is loaded with a few large allocations and unloaded by releasing them at once
+		std::pmr::monotonic_buffer_resource m_Arena{ InitialArenaSize };
 
-		std::vector<Plane> m_PlaneGeometries{};
-		std::vector<Sphere> m_SphereGeometries{};
-		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
-		std::vector<Light> m_Lights{};
-		std::vector<Material*> m_Materials{};
+		std::string	sceneName;
 
-		std::vector<Triangle> m_Triangles{};
+		std::pmr::vector<Plane> m_PlaneGeometries{ &m_Arena };
+		std::pmr::vector<Sphere> m_SphereGeometries{ &m_Arena };
+		std::pmr::vector<TriangleMesh> m_TriangleMeshGeometries{ &m_Arena };
+		std::pmr::vector<MeshInstance> m_MeshInstances{ &m_Arena };
+		std::pmr::vector<Light> m_Lights{ &m_Arena };
+		MaterialTable m_Materials{ &m_Arena };
+
+		std::pmr::vector<Triangle> m_Triangles{ &m_Arena };
+
+		std::pmr::vector<SceneObject> m_BoundedObjects{ &m_Arena };
+		//Rewritten every frame, so they stay on the regular heap
+		std::vector<Vector3> m_BoundedObjectsMin{};
+		std::vector<Vector3> m_BoundedObjectsMax{};
+		//Placement revision per bounded object for meshes, a mesh can change without its box changing
+		std::vector<uint32_t> m_BoundedObjectsRevision{};
+		std::vector<Vector3> m_ChangedBoundsMin{};
+		std::vector<Vector3> m_ChangedBoundsMax{};
+		BVH m_TopLevelBVH{ &m_Arena };
+		//Separate from IsEmpty, a scene without bounded objects (planes only) keeps an empty tree and must not rebuild every frame
+		bool m_IsTopLevelBVHBuilt{ false };
+
+		//SoA copies of the geometry for the SIMD kernels, spheres and triangles are packed in top-level BVH leaf order
+		PackedSpheres m_PackedSpheres{};
+		PackedPlanes m_PackedPlanes{};
+		PackedTriangles m_PackedTriangles{};
+		const GeometryKernels* m_pGeometryKernels{ &GetGeometryKernels() };
+
+		uint64_t m_Revision{};
 
 		Camera m_Camera{};
 
-		Sphere* AddSphere(const Vector3& origin, float radius, unsigned char materialIndex = 0);
-		Plane* AddPlane(const Vector3& origin, const Vector3& normal, unsigned char materialIndex = 0);
-		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, unsigned char materialIndex = 0);
+		Sphere* AddSphere(const Vector3& origin, float radius, MaterialHandle materialIndex = 0);
+		Plane* AddPlane(const Vector3& origin, const Vector3& normal, MaterialHandle materialIndex = 0);
+		TriangleMesh* AddTriangleMesh(TriangleCullMode cullMode, MaterialHandle materialIndex = 0);
+		//Places pMesh once more, the instance shares its data. Set the transform and call UpdateTransforms on the result
+		MeshInstance* AddMeshInstance(std::shared_ptr<const TriangleMesh> pMesh, TriangleCullMode cullMode, MaterialHandle materialIndex = 0);
+		//Loads an OBJ through the mesh cache the first time a path is asked for and hands out the same mesh afterwards, nullptr when it can't be read
+		//The mesh lives in the scene arena, so it must not outlive the scene
+		std::shared_ptr<const TriangleMesh> LoadSharedMesh(const std::string& objPath);
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
-		unsigned char AddMaterial(Material* pMaterial);
+		//Copies the parameters into the material table, the handle goes into the materialIndex of the primitives that use it
+		template<typename MaterialT>
+		MaterialHandle AddMaterial(const MaterialT& material)
+		{
+			return m_Materials.Add(material);
+		}
+
+	private:
+		//Every mesh OBJ loaded by LoadSharedMesh, by path
+		std::unordered_map<std::string, std::shared_ptr<const TriangleMesh>> m_SharedMeshes{};
+
+		void PackGeometry();
+		//Vertex data and placement of a TriangleMesh or MeshInstance object, a TriangleMesh is its own placement
+		const TriangleMesh& GetMeshData(const SceneObject& object) const;
+		const MeshPlacement& GetMeshPlacement(const SceneObject& object) const;
+		//Tests one top-level leaf, its objects are sorted by type so every run of spheres/triangles goes through a single kernel call
+		bool HitTest_Leaf(uint32_t first, uint32_t count, Ray& ray, HitRecord& hitRecord) const;
+		//Occlusion version of HitTest_Leaf, uses the any-hit kernels and returns at the first object in range
+		bool DoesHit_Leaf(uint32_t first, uint32_t count, const Ray& ray, Occluder& occluder) const;
+		//Tests only the cached occluder, false when there is none or its mesh moved
+		bool DoesHit_Occluder(const Occluder& occluder, const Ray& ray) const;
+		//Meshes are tested with the whole packet, loose spheres and triangles one lane at a time through HitTest_Leaf
+		void HitTest_LeafPacket(uint32_t first, uint32_t count, uint32_t laneMask, RayPacket& packet, HitRecord* pHits) const;
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -172,4 +278,27 @@ namespace dae
 	private:
 		TriangleMesh* pMesh;
 	};
+
+	//Grid of bunnies that all share one mesh and its BVH, only their transforms and materials differ
+	class Scene_W4_InstancedBunnyScene final : public Scene
+	{
+	public:
+		Scene_W4_InstancedBunnyScene() = default;
+		~Scene_W4_InstancedBunnyScene() override = default;
+
+		Scene_W4_InstancedBunnyScene(const Scene_W4_InstancedBunnyScene&) = delete;
+		Scene_W4_InstancedBunnyScene(Scene_W4_InstancedBunnyScene&&) noexcept = delete;
+		Scene_W4_InstancedBunnyScene& operator=(const Scene_W4_InstancedBunnyScene&) = delete;
+		Scene_W4_InstancedBunnyScene& operator=(Scene_W4_InstancedBunnyScene&&) noexcept = delete;
+
+		void Initialize() override;
+		void Update(Timer* pTimer) override;
+	};
+
+	/**
+	 * \brief Creates one of the scenes above by name, the caller owns it and still has to call Initialize
+	 * \param name w1, w2, w3, w3_test, w4_test, reference, bunny or instances
+	 * \return nullptr for an unknown name
+	 */
+	Scene* CreateScene(const std::string& name);
 }
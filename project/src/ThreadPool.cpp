@@ -0,0 +1,147 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+#include "Trace.h"
+
+namespace dae
+{
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+		m_Queues.reserve(threadCount);
+		for (uint32_t inx = 0; inx < threadCount; ++inx)
+		{
+			m_Queues.emplace_back(std::make_unique<WorkQueue>());
+		}
+
+		//The calling thread does its share of every batch, so one thread less is needed
+		m_Threads.reserve(threadCount - 1);
+		for (uint32_t inx = 0; inx < threadCount - 1; ++inx)
+		{
+			m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, inx);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_IsStopping = true;
+		}
+		m_WakeCondition.notify_all();
+
+		for (std::thread& thread : m_Threads)
+		{
+			thread.join();
+		}
+	}
+
+	void ThreadPool::ParallelFor(uint32_t taskCount, const std::function<void(uint32_t)>& task)
+	{
+		if (taskCount == 0)
+			return;
+
+		const uint32_t queueCount{ static_cast<uint32_t>(m_Queues.size()) };
+		{
+			//A worker that woke up late for the previous batch must be done before new tasks show up in the queues,
+			//otherwise it could run them with the previous task
+			std::unique_lock lock{ m_Mutex };
+			m_IdleCondition.wait(lock, [this] { return m_ActiveWorkers == 0; });
+
+			for (uint32_t queueIndex = 0; queueIndex < queueCount; ++queueIndex)
+			{
+				const uint32_t first{ static_cast<uint32_t>(uint64_t(taskCount) * queueIndex / queueCount) };
+				const uint32_t last{ static_cast<uint32_t>(uint64_t(taskCount) * (queueIndex + 1) / queueCount) };
+
+				WorkQueue& queue = *m_Queues[queueIndex];
+				std::lock_guard queueLock{ queue.mutex };
+				for (uint32_t taskIndex = first; taskIndex < last; ++taskIndex)
+				{
+					queue.taskIndices.push_back(taskIndex);
+				}
+			}
+
+			m_pTask = &task;
+			++m_Batch;
+		}
+		m_WakeCondition.notify_all();
+
+		RunTasks(queueCount - 1, task);
+
+		//The queues are empty now, but workers may still be busy with the last tasks they took
+		std::unique_lock lock{ m_Mutex };
+		m_IdleCondition.wait(lock, [this] { return m_ActiveWorkers == 0; });
+		m_pTask = nullptr;
+	}
+
+	void ThreadPool::WorkerLoop(uint32_t queueIndex)
+	{
+		Trace::SetThreadName("Worker");
+
+		uint64_t lastBatch{ 0 };
+		while (true)
+		{
+			const std::function<void(uint32_t)>* pTask{ nullptr };
+			{
+				std::unique_lock lock{ m_Mutex };
+				m_WakeCondition.wait(lock, [&] { return m_IsStopping || (m_Batch != lastBatch && m_pTask); });
+				if (m_IsStopping)
+					return;
+
+				lastBatch = m_Batch;
+				pTask = m_pTask;
+				++m_ActiveWorkers;
+			}
+
+			RunTasks(queueIndex, *pTask);
+
+			{
+				std::lock_guard lock{ m_Mutex };
+				--m_ActiveWorkers;
+			}
+			m_IdleCondition.notify_all();
+		}
+	}
+
+	void ThreadPool::RunTasks(uint32_t queueIndex, const std::function<void(uint32_t)>& task)
+	{
+		uint32_t taskIndex{};
+		while (PopTask(queueIndex, taskIndex))
+		{
+			task(taskIndex);
+		}
+	}
+
+	bool ThreadPool::PopTask(uint32_t queueIndex, uint32_t& taskIndex)
+	{
+		//Own work comes from the front, stolen work from the back, so owner and thief rarely want the same tile
+		{
+			WorkQueue& queue = *m_Queues[queueIndex];
+			std::lock_guard lock{ queue.mutex };
+			if (!queue.taskIndices.empty())
+			{
+				taskIndex = queue.taskIndices.front();
+				queue.taskIndices.pop_front();
+				return true;
+			}
+		}
+
+		const uint32_t queueCount{ static_cast<uint32_t>(m_Queues.size()) };
+		for (uint32_t offset = 1; offset < queueCount; ++offset)
+		{
+			WorkQueue& victim = *m_Queues[(queueIndex + offset) % queueCount];
+			std::lock_guard lock{ victim.mutex };
+			if (!victim.taskIndices.empty())
+			{
+				taskIndex = victim.taskIndices.back();
+				victim.taskIndices.pop_back();
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
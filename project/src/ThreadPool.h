@@ -0,0 +1,62 @@
+#pragma once
+
+//Standard includes
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	//Persistent worker threads that run batches of indexed tasks, idle workers steal from the back of busy workers' queues
+	class ThreadPool final
+	{
+	public:
+		/**
+		 * \brief Starts the worker threads, they sleep until the next ParallelFor
+		 * \param threadCount total threads working on a batch including the calling thread, 0 uses every hardware thread
+		 */
+		explicit ThreadPool(uint32_t threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		/**
+		 * \brief Runs task(taskIndex) for every index in [0, taskCount) and blocks until all of them finished
+		 * Every queue starts with a contiguous block of indices, so neighbouring tasks tend to run on the same thread
+		 */
+		void ParallelFor(uint32_t taskCount, const std::function<void(uint32_t)>& task);
+
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_Threads.size()) + 1; }
+
+	private:
+		struct WorkQueue
+		{
+			std::mutex mutex{};
+			std::deque<uint32_t> taskIndices{};
+		};
+
+		void WorkerLoop(uint32_t queueIndex);
+		void RunTasks(uint32_t queueIndex, const std::function<void(uint32_t)>& task);
+		bool PopTask(uint32_t queueIndex, uint32_t& taskIndex);
+
+		std::vector<std::thread> m_Threads{};
+		//One queue per worker, the last one belongs to the thread calling ParallelFor
+		std::vector<std::unique_ptr<WorkQueue>> m_Queues{};
+
+		std::mutex m_Mutex{};
+		std::condition_variable m_WakeCondition{};
+		std::condition_variable m_IdleCondition{};
+		const std::function<void(uint32_t)>* m_pTask{ nullptr };
+		uint64_t m_Batch{ 0 };
+		uint32_t m_ActiveWorkers{ 0 };
+		bool m_IsStopping{ false };
+	};
+}
@@ -1,5 +1,6 @@
 #include "Timer.h"
 
+#include <cfloat>
 #include <iostream>
 #include <numeric>
 
@@ -141,3 +142,9 @@ void Timer::Stop()
 		m_IsStopped = true;
 	}
 }
+
+void Timer::Step(float elapsedSeconds)
+{
+	m_ElapsedTime = elapsedSeconds;
+	m_TotalTime += elapsedSeconds;
+}
@@ -23,6 +23,8 @@ namespace dae
 		void Start();
 		void Update();
 		void Stop();
+		//Advances the clock by a fixed amount instead of reading the performance counter, for deterministic offline frames
+		void Step(float elapsedSeconds);
 
 		uint32_t GetFPS() const { return m_FPS; };
 		float GetdFPS() const { return m_dFPS; };
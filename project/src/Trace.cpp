@@ -0,0 +1,203 @@
+#include "Trace.h"
+
+//Standard includes
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace dae
+{
+	namespace Trace
+	{
+		namespace
+		{
+			//Every thread that recorded a marker, registered on its first one
+			struct ThreadTrace final
+			{
+				ThreadTrace();
+				~ThreadTrace();
+
+				ThreadTrace(const ThreadTrace&) = delete;
+				ThreadTrace(ThreadTrace&&) noexcept = delete;
+				ThreadTrace& operator=(const ThreadTrace&) = delete;
+				ThreadTrace& operator=(ThreadTrace&&) noexcept = delete;
+
+				EventRing ring{};
+				uint32_t threadId{};
+			};
+
+			struct CollectedEvent
+			{
+				TraceEvent event{};
+				uint32_t threadId{};
+			};
+
+			struct Registry
+			{
+				std::mutex mutex{};
+				std::vector<ThreadTrace*> threadTraces{};
+				//Indexed by thread id, kept after a thread exits so its markers still get a name
+				std::vector<std::string> threadNames{};
+				std::vector<CollectedEvent> events{};
+				//Markers the rings of exited threads had to drop
+				uint64_t retiredDroppedCount{};
+				std::chrono::steady_clock::time_point origin{};
+			};
+
+			//Constructed by the first ThreadTrace, so it outlives every one of them
+			Registry& GetRegistry()
+			{
+				static Registry registry{};
+				return registry;
+			}
+
+			std::atomic<bool> g_IsRecording{ false };
+			thread_local const char* t_pThreadName{ nullptr };
+
+			ThreadTrace& GetThreadTrace()
+			{
+				thread_local ThreadTrace threadTrace{};
+				return threadTrace;
+			}
+
+			//Caller holds the registry mutex
+			void CollectRing(Registry& registry, ThreadTrace& threadTrace)
+			{
+				threadTrace.ring.Drain([&](const TraceEvent& event)
+					{
+						registry.events.push_back({ event, threadTrace.threadId });
+					});
+			}
+
+			ThreadTrace::ThreadTrace()
+			{
+				Registry& registry = GetRegistry();
+				const std::lock_guard lock{ registry.mutex };
+				threadId = static_cast<uint32_t>(registry.threadNames.size());
+				registry.threadNames.emplace_back(t_pThreadName ? t_pThreadName : "Thread");
+				registry.threadTraces.push_back(this);
+			}
+
+			ThreadTrace::~ThreadTrace()
+			{
+				Registry& registry = GetRegistry();
+				const std::lock_guard lock{ registry.mutex };
+				CollectRing(registry, *this);
+				registry.retiredDroppedCount += ring.GetDroppedCount();
+				registry.threadTraces.erase(std::find(registry.threadTraces.begin(), registry.threadTraces.end(), this));
+			}
+
+			//Chrome trace timestamps are microseconds
+			double ToMicroseconds(int64_t nanoseconds)
+			{
+				return nanoseconds / 1000.0;
+			}
+		}
+
+		EventRing::EventRing() :
+			m_pEvents{ new TraceEvent[Capacity]{} }
+		{
+		}
+
+		EventRing::~EventRing()
+		{
+			delete[] m_pEvents;
+		}
+
+		void Start()
+		{
+			if constexpr (!IsEnabled)
+				return;
+
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+			for (ThreadTrace* pThreadTrace : registry.threadTraces)
+			{
+				pThreadTrace->ring.Drain([](const TraceEvent&) {});
+			}
+			registry.events.clear();
+			registry.origin = std::chrono::steady_clock::now();
+			g_IsRecording.store(true, std::memory_order_release);
+		}
+
+		bool IsRecording()
+		{
+			return g_IsRecording.load(std::memory_order_acquire);
+		}
+
+		void SetThreadName(const char* pName)
+		{
+			//Read when the thread records its first marker, until then no ring gets allocated for it
+			t_pThreadName = pName;
+		}
+
+		void Record(const char* pName, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, int64_t argument)
+		{
+			if (!IsRecording())
+				return;
+
+			const std::chrono::steady_clock::time_point origin{ GetRegistry().origin };
+			GetThreadTrace().ring.Push({ pName, argument,
+				std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count(),
+				std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() });
+		}
+
+		void Collect()
+		{
+			if constexpr (!IsEnabled)
+				return;
+
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+			for (ThreadTrace* pThreadTrace : registry.threadTraces)
+			{
+				CollectRing(registry, *pThreadTrace);
+			}
+		}
+
+		bool Write(const std::string& path)
+		{
+			Collect();
+			g_IsRecording.store(false, std::memory_order_release);
+
+			Registry& registry = GetRegistry();
+			const std::lock_guard lock{ registry.mutex };
+
+			uint64_t droppedCount{ registry.retiredDroppedCount };
+			for (const ThreadTrace* pThreadTrace : registry.threadTraces)
+			{
+				droppedCount += pThreadTrace->ring.GetDroppedCount();
+			}
+
+			std::ofstream file{ path };
+			if (!file)
+				return false;
+
+			file << std::fixed << std::setprecision(3);
+			file << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << droppedCount << "},\"traceEvents\":[\n";
+			file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"RayTracer\"}}";
+			for (size_t threadId = 0; threadId < registry.threadNames.size(); ++threadId)
+			{
+				file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadId << ",\"args\":{\"name\":\"" << registry.threadNames[threadId] << "\"}}";
+			}
+
+			//Complete events, the viewer nests them by time per thread
+			for (const CollectedEvent& collected : registry.events)
+			{
+				const TraceEvent& event = collected.event;
+				file << ",\n{\"name\":\"" << event.pName << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << collected.threadId
+					<< ",\"ts\":" << ToMicroseconds(event.startNanoseconds) << ",\"dur\":" << ToMicroseconds(event.durationNanoseconds);
+				if (event.argument >= 0)
+					file << ",\"args\":{\"index\":" << event.argument << "}";
+				file << "}";
+			}
+			file << "\n]}\n";
+
+			registry.events.clear();
+			return static_cast<bool>(file);
+		}
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+//Standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace dae
+{
+	/**
+	 * Timeline of scoped markers, exported as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+	 * Compiled in together with the counters (ENABLE_INSTRUMENTATION) and only recording between Start and Write.
+	 * Every thread writes its markers into its own single-producer ring buffer without locks, the render loop drains
+	 * the rings once per frame with Collect. A full ring drops markers instead of blocking the thread that records them
+	 */
+	namespace Trace
+	{
+#if defined(DAE_INSTRUMENTATION)
+		constexpr bool IsEnabled{ true };
+#else
+		constexpr bool IsEnabled{ false };
+#endif
+
+		//Marker names must outlive the trace, string literals only
+		struct TraceEvent
+		{
+			const char* pName{};
+			int64_t argument{}; //shown as args.index, -1 for none
+			int64_t startNanoseconds{};
+			int64_t durationNanoseconds{};
+		};
+
+		//Wait-free ring between one recording thread (Push) and the collecting thread (Drain)
+		class EventRing final
+		{
+		public:
+			static constexpr uint32_t Capacity{ 1u << 14 };
+
+			EventRing();
+			~EventRing();
+
+			EventRing(const EventRing&) = delete;
+			EventRing(EventRing&&) noexcept = delete;
+			EventRing& operator=(const EventRing&) = delete;
+			EventRing& operator=(EventRing&&) noexcept = delete;
+
+			//Recording thread only, false when the ring is full and the event got dropped
+			bool Push(const TraceEvent& event)
+			{
+				const uint32_t head{ m_Head.load(std::memory_order_relaxed) };
+				if (head - m_Tail.load(std::memory_order_acquire) == Capacity)
+				{
+					m_DroppedCount.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+
+				m_pEvents[head & (Capacity - 1)] = event;
+				m_Head.store(head + 1, std::memory_order_release);
+				return true;
+			}
+
+			//Collecting thread only, calls drain(const TraceEvent&) for every event pushed so far
+			template<typename DrainFunction>
+			void Drain(DrainFunction&& drain)
+			{
+				const uint32_t tail{ m_Tail.load(std::memory_order_relaxed) };
+				const uint32_t head{ m_Head.load(std::memory_order_acquire) };
+				for (uint32_t inx = tail; inx != head; ++inx)
+				{
+					drain(m_pEvents[inx & (Capacity - 1)]);
+				}
+				m_Tail.store(head, std::memory_order_release);
+			}
+
+			uint64_t GetDroppedCount() const { return m_DroppedCount.load(std::memory_order_relaxed); }
+
+		private:
+			TraceEvent* m_pEvents;
+			//Free-running indices, the wrap of uint32_t keeps head - tail correct as Capacity is a power of two
+			std::atomic<uint32_t> m_Head{ 0 };
+			std::atomic<uint32_t> m_Tail{ 0 };
+			std::atomic<uint64_t> m_DroppedCount{ 0 };
+		};
+
+		//Clears anything recorded before and starts recording markers on every thread
+		void Start();
+		bool IsRecording();
+
+		//Names the calling thread in the exported timeline
+		void SetThreadName(const char* pName);
+
+		void Record(const char* pName, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, int64_t argument = -1);
+
+		//Moves the markers of every ring into the trace, call it once per frame so the rings never fill up
+		void Collect();
+		//Collects, writes the trace and stops recording
+		bool Write(const std::string& path);
+
+		class ScopedEvent final
+		{
+		public:
+			explicit ScopedEvent(const char* pName, int64_t argument = -1) :
+				m_pName{ pName },
+				m_Argument{ argument }
+			{
+				if constexpr (IsEnabled)
+				{
+					if (IsRecording())
+						m_Start = std::chrono::steady_clock::now();
+				}
+			}
+			~ScopedEvent()
+			{
+				if constexpr (IsEnabled)
+				{
+					if (m_Start != std::chrono::steady_clock::time_point{})
+						Record(m_pName, m_Start, std::chrono::steady_clock::now(), m_Argument);
+				}
+			}
+
+			ScopedEvent(const ScopedEvent&) = delete;
+			ScopedEvent(ScopedEvent&&) noexcept = delete;
+			ScopedEvent& operator=(const ScopedEvent&) = delete;
+			ScopedEvent& operator=(ScopedEvent&&) noexcept = delete;
+
+		private:
+			const char* m_pName;
+			int64_t m_Argument;
+			std::chrono::steady_clock::time_point m_Start{};
+		};
+	}
+}
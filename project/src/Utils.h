@@ -1,7 +1,7 @@
 #pragma once
-#include <fstream>
 #include "Maths.h"
 #include "DataTypes.h"
+#include "Instrumentation.h"
 
 namespace dae
 {
@@ -11,6 +11,8 @@ namespace dae
 		//SPHERE HIT-TESTS
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
+			Instrumentation::Add(Instrumentation::Counter::SphereTests);
+
 			float A{ Vector3::Dot(ray.direction, ray.direction) };
 
 			Vector3 vectorFromStoR{ sphere.origin, ray.origin };
@@ -57,6 +59,8 @@ namespace dae
 		//PLANE HIT-TESTS
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
 		{
+			Instrumentation::Add(Instrumentation::Counter::PlaneTests);
+
 			//todo W1
 			//throw std::runtime_error("Not Implemented Yet");
 			float t{ Vector3::Dot(Vector3(plane.origin - ray.origin), plane.normal) / Vector3::Dot(ray.direction, plane.normal) };
@@ -86,78 +90,78 @@ namespace dae
 		}
 #pragma endregion
 #pragma region Triangle HitTest
-		//TRIANGLE HIT-TESTS
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Shadow rays leave the surface instead of arriving at it, so they see the opposite face
+		inline TriangleCullMode GetShadowCullMode(TriangleCullMode cullMode)
 		{
-			//todo W5
-			auto a = triangle.v1 - triangle.v0;
-			auto b = triangle.v2 - triangle.v0;
+			if (cullMode == TriangleCullMode::FrontFaceCulling) return TriangleCullMode::BackFaceCulling;
+			if (cullMode == TriangleCullMode::BackFaceCulling) return TriangleCullMode::FrontFaceCulling;
+			return cullMode;
+		}
 
-			auto n = Vector3::Cross(a, b).Normalized();
+		/**
+		 * \brief Moller-Trumbore ray/triangle test on a precomputed record, no normalization or allocation
+		 * \param t distance along the ray on a hit
+		 * \param u barycentric weight of v1 on a hit
+		 * \param v barycentric weight of v2 on a hit (v0 gets 1 - u - v)
+		 */
+		inline bool HitTest_TriangleRecord(const TriangleIntersectionRecord& triangle, TriangleCullMode cullMode, const Ray& ray, float& t, float& u, float& v)
+		{
+			Instrumentation::Add(Instrumentation::Counter::TriangleTests);
 
-			TriangleCullMode cullMode = triangle.cullMode;
-			if (ignoreHitRecord)
-			{
-				
-				if (triangle.cullMode == TriangleCullMode::FrontFaceCulling) cullMode = TriangleCullMode::BackFaceCulling;
-				else if (triangle.cullMode == TriangleCullMode::BackFaceCulling) cullMode = TriangleCullMode::FrontFaceCulling;
-			}
+			const Vector3 p{ Vector3::Cross(ray.direction, triangle.edge2) };
 
-			if (Vector3::Dot(n, ray.direction) > 0.f && cullMode == TriangleCullMode::BackFaceCulling)
+			//determinant == -Dot(direction, Cross(edge1, edge2)), so it is positive when the ray faces the front
+			const float determinant{ Vector3::Dot(triangle.edge1, p) };
+			switch (cullMode)
 			{
-				return false;
+			case TriangleCullMode::BackFaceCulling:
+				if (determinant <= 0.f) return false;
+				break;
+			case TriangleCullMode::FrontFaceCulling:
+				if (determinant >= 0.f) return false;
+				break;
+			case TriangleCullMode::NoCulling:
+				if (determinant == 0.f) return false;
+				break;
 			}
 
-			if (Vector3::Dot(n, ray.direction) < 0.f && cullMode == TriangleCullMode::FrontFaceCulling)
-			{
-				return false;
-			}
+			const float inverseDeterminant{ 1.f / determinant };
+			const Vector3 s{ ray.origin - triangle.v0 };
 
-			if (AreEqual(Vector3::Dot(n, ray.direction), 0))
-			{
-				return false;
-			} 
-			else
-			{
-				auto L = triangle.v0 - ray.origin;
+			u = Vector3::Dot(s, p) * inverseDeterminant;
+			if (u < 0.f || u > 1.f) return false;
 
-				auto t = Vector3::Dot(L, n) / Vector3::Dot(ray.direction, n);
+			const Vector3 q{ Vector3::Cross(s, triangle.edge1) };
 
-				if ((t < ray.min) || (t > ray.max))
-				{
-					return false;
-				}
-				else
-				{
-					auto P = ray.origin + ray.direction * t;
+			v = Vector3::Dot(ray.direction, q) * inverseDeterminant;
+			if (v < 0.f || u + v > 1.f) return false;
 
-					auto e1 = triangle.v1 - triangle.v0;
-					auto p1 = P - triangle.v0;
-
-					auto e2 = triangle.v2 - triangle.v1;
-					auto p2 = P - triangle.v1;
+			t = Vector3::Dot(triangle.edge2, q) * inverseDeterminant;
+			return t >= ray.min && t <= ray.max;
+		}
 
-					auto e3 = triangle.v0 - triangle.v2;
-					auto p3 = P - triangle.v2;
+		//TRIANGLE HIT-TESTS
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			//todo W5
+			const TriangleIntersectionRecord record{ triangle.v0, triangle.v1, triangle.v2 };
+			const TriangleCullMode cullMode{ ignoreHitRecord ? GetShadowCullMode(triangle.cullMode) : triangle.cullMode };
 
-					if (Vector3::Dot(Vector3::Cross(e1, p1), n) < 0.f || Vector3::Dot(Vector3::Cross(e2, p2), n) < 0.f || Vector3::Dot(Vector3::Cross(e3, p3), n) < 0.f)
-					{
-						return false;
-					} 
-					else
-					{
-						
+			float t, u, v;
+			if (!HitTest_TriangleRecord(record, cullMode, ray, t, u, v))
+			{
+				return false;
+			}
 
-						hitRecord.didHit = true;
-						hitRecord.t = t;
-						hitRecord.normal = n;
-						hitRecord.materialIndex = triangle.materialIndex;
-						hitRecord.origin = P;
-						return true;
-					}
-				}
+			hitRecord.didHit = true;
+			hitRecord.t = t;
+			if (ignoreHitRecord == false)
+			{
+				hitRecord.normal = Vector3::Cross(record.edge1, record.edge2).Normalized();
+				hitRecord.materialIndex = triangle.materialIndex;
+				hitRecord.origin = ray.origin + ray.direction * t;
 			}
-			return false;
+			return true;
 		}
 
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
@@ -167,8 +171,10 @@ namespace dae
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
-		inline bool SlabTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
+		inline bool SlabTest_TriangleMesh(const MeshPlacement& mesh, const Ray& ray)
 		{
+			Instrumentation::Add(Instrumentation::Counter::SlabTests);
+
 			float tx1 = (mesh.transformedMinAABB.x - ray.origin.x) / ray.direction.x;
 			float tx2 = (mesh.transformedMaxAABB.x - ray.origin.x) / ray.direction.x;
 
@@ -189,38 +195,250 @@ namespace dae
 
 			return tmax > 0 && tmax>=tmin;
 		}
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Returns the distance at which the ray enters the box, FLT_MAX when it misses or enters beyond maxDistance
+		inline float SlabTest_AABB(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray, const Vector3& inverseDirection, float maxDistance)
+		{
+			Instrumentation::Add(Instrumentation::Counter::SlabTests);
+
+			float tx1 = (minAABB.x - ray.origin.x) * inverseDirection.x;
+			float tx2 = (maxAABB.x - ray.origin.x) * inverseDirection.x;
+
+			float tmin = std::min(tx1, tx2);
+			float tmax = std::max(tx1, tx2);
+
+			float ty1 = (minAABB.y - ray.origin.y) * inverseDirection.y;
+			float ty2 = (maxAABB.y - ray.origin.y) * inverseDirection.y;
+
+			tmin = std::max(tmin, std::min(ty1, ty2));
+			tmax = std::min(tmax, std::max(ty1, ty2));
+
+			float tz1 = (minAABB.z - ray.origin.z) * inverseDirection.z;
+			float tz2 = (maxAABB.z - ray.origin.z) * inverseDirection.z;
+
+			tmin = std::max(tmin, std::min(tz1, tz2));
+			tmax = std::min(tmax, std::max(tz1, tz2));
+
+			if (tmax >= tmin && tmax >= ray.min && tmin < maxDistance)
+				return tmin;
+
+			return FLT_MAX;
+		}
+
+		/**
+		 * \brief Walks a BVH front-to-back and calls testLeaf once for every leaf the ray enters
+		 * \param bvh hierarchy to traverse
+		 * \param ray ray to trace, testLeaf shrinks ray.max on a hit so farther nodes get culled
+		 * \param testLeaf bool(uint32_t first, uint32_t count) over bvh.primitiveIndices, returning true stops the traversal (any-hit queries)
+		 */
+		template<typename LeafTest>
+		inline void Traverse_BVHLeaves(const BVH& bvh, Ray& ray, LeafTest&& testLeaf)
 		{
-			if (!SlabTest_TriangleMesh(mesh, ray))
+			if (bvh.IsEmpty())
 			{
- 				return false;
+				return;
 			}
 
-			HitRecord minHitRecord;
+			const Vector3 inverseDirection{ 1.f / ray.direction.x, 1.f / ray.direction.y, 1.f / ray.direction.z };
 
-			Triangle newTriangle{};
+			uint32_t nodeStack[BVH::MaxDepth];
+			float distanceStack[BVH::MaxDepth];
+			uint32_t stackSize{ 0 };
 
-			for (int inx = 0; inx < mesh.indices.size(); inx += 3)
+			const BVHNode* pNode = &bvh.nodes[0];
+			if (SlabTest_AABB(pNode->minAABB, pNode->maxAABB, ray, inverseDirection, ray.max) == FLT_MAX)
 			{
-				newTriangle = Triangle(mesh.transformedPositions[mesh.indices[inx]], mesh.transformedPositions[mesh.indices[inx + 1]], mesh.transformedPositions[mesh.indices[inx + 2]], mesh.transformedNormals[inx / 3]);
-				newTriangle.cullMode = mesh.cullMode;
-				newTriangle.materialIndex = mesh.materialIndex;
+				return;
+			}
 
-				HitTest_Triangle(newTriangle, ray, hitRecord, ignoreHitRecord);
-				if (inx == 0 || (inx > 0 && hitRecord.t < minHitRecord.t))
+			while (true)
+			{
+				if (pNode->IsLeaf())
 				{
-					minHitRecord = hitRecord;
+					if (testLeaf(pNode->leftFirst, pNode->primitiveCount))
+					{
+						return;
+					}
 				}
+				else
+				{
+					//Visit the nearest child first and only keep the far one around if the ray actually enters it
+					const BVHNode* pNear = &bvh.nodes[pNode->leftFirst];
+					const BVHNode* pFar = &bvh.nodes[pNode->leftFirst + 1];
+
+					float nearDistance = SlabTest_AABB(pNear->minAABB, pNear->maxAABB, ray, inverseDirection, ray.max);
+					float farDistance = SlabTest_AABB(pFar->minAABB, pFar->maxAABB, ray, inverseDirection, ray.max);
+
+					if (farDistance < nearDistance)
+					{
+						std::swap(pNear, pFar);
+						std::swap(nearDistance, farDistance);
+					}
 
+					if (nearDistance != FLT_MAX)
+					{
+						if (farDistance != FLT_MAX)
+						{
+							nodeStack[stackSize] = static_cast<uint32_t>(pFar - bvh.nodes.data());
+							distanceStack[stackSize] = farDistance;
+							++stackSize;
+						}
+
+						pNode = pNear;
+						continue;
+					}
+				}
+
+				//Pop until we find a node that can still contain something closer than the current hit
+				while (stackSize > 0 && distanceStack[stackSize - 1] >= ray.max)
+				{
+					--stackSize;
+				}
+
+				if (stackSize == 0)
+				{
+					break;
+				}
+
+				--stackSize;
+				pNode = &bvh.nodes[nodeStack[stackSize]];
 			}
-			hitRecord = minHitRecord;
-			return hitRecord.didHit;
+		}
+
+		/**
+		 * \brief Same as Traverse_BVHLeaves, but calls testPrimitive for every primitive of the visited leaves
+		 * \param testPrimitive bool(uint32_t primitiveIndex), returning true stops the traversal (any-hit queries)
+		 */
+		template<typename PrimitiveTest>
+		inline void Traverse_BVH(const BVH& bvh, Ray& ray, PrimitiveTest&& testPrimitive)
+		{
+			Traverse_BVHLeaves(bvh, ray, [&](uint32_t first, uint32_t count)
+				{
+					for (uint32_t inx = first; inx < first + count; ++inx)
+					{
+						if (testPrimitive(bvh.primitiveIndices[inx]))
+						{
+							return true;
+						}
+					}
+					return false;
+				});
+		}
+
+		/**
+		 * \brief Closest hit against mesh data placed in the world by placement, a TriangleMesh is its own placement while instances share the data
+		 * \param mesh object-space vertices, records and BVH
+		 * \param placement world transform, bounds, cull mode and material
+		 */
+		inline bool HitTest_PlacedMesh(const TriangleMesh& mesh, const MeshPlacement& placement, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			if (mesh.bvh.IsEmpty() || !SlabTest_TriangleMesh(placement, ray))
+			{
+ 				return false;
+			}
+
+			//The direction is left unnormalized so t means the same distance in object and world space
+			//Shrinking max makes every later triangle and node test reject anything behind the closest hit so far
+			Ray closestRay{ placement.inverseTransform.TransformPoint(ray.origin), placement.inverseTransform.TransformVector(ray.direction), ray.min, ray.max };
+			const TriangleCullMode cullMode{ ignoreHitRecord ? GetShadowCullMode(placement.cullMode) : placement.cullMode };
+
+			const TriangleIntersectionRecord* pClosestTriangle{ nullptr };
+			float closestU{}, closestV{};
+
+			Traverse_BVH(mesh.bvh, closestRay, [&](uint32_t recordIndex)
+				{
+					const TriangleIntersectionRecord& triangle = mesh.triangleRecords[recordIndex];
+
+					float t, u, v;
+					if (HitTest_TriangleRecord(triangle, cullMode, closestRay, t, u, v))
+					{
+						pClosestTriangle = &triangle;
+						closestRay.max = t;
+						closestU = u;
+						closestV = v;
+					}
+					return false;
+				});
+
+			if (!pClosestTriangle)
+			{
+				hitRecord.didHit = false;
+				return false;
+			}
+
+			hitRecord.didHit = true;
+			hitRecord.t = closestRay.max;
+			if (!ignoreHitRecord)
+			{
+				hitRecord.materialIndex = placement.materialIndex;
+				hitRecord.origin = ray.origin + hitRecord.t * ray.direction;
+				hitRecord.normal = placement.TransformNormal(mesh.GetObjectHitNormal(*pClosestTriangle, closestU, closestV));
+			}
+			return true;
+		}
+
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			return HitTest_PlacedMesh(mesh, mesh, ray, hitRecord, ignoreHitRecord);
+		}
+
+		inline bool HitTest_MeshInstance(const MeshInstance& instance, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		{
+			return HitTest_PlacedMesh(*instance.pMesh, instance, ray, hitRecord, ignoreHitRecord);
+		}
+
+		/**
+		 * \brief Occlusion test: shadow cull mode, no hit record, and the traversal stops at the first triangle in range
+		 * \param pRecordIndex receives the triangle record that blocks the ray
+		 */
+		inline bool DoesHit_PlacedMesh(const TriangleMesh& mesh, const MeshPlacement& placement, const Ray& ray, uint32_t* pRecordIndex = nullptr)
+		{
+			if (mesh.bvh.IsEmpty() || !SlabTest_TriangleMesh(placement, ray))
+			{
+				return false;
+			}
+
+			Ray objectRay{ placement.inverseTransform.TransformPoint(ray.origin), placement.inverseTransform.TransformVector(ray.direction), ray.min, ray.max };
+			const TriangleCullMode cullMode{ GetShadowCullMode(placement.cullMode) };
+
+			bool didHit{ false };
+			Traverse_BVH(mesh.bvh, objectRay, [&](uint32_t recordIndex)
+				{
+					float t, u, v;
+					didHit = HitTest_TriangleRecord(mesh.triangleRecords[recordIndex], cullMode, objectRay, t, u, v);
+					if (didHit && pRecordIndex)
+						*pRecordIndex = recordIndex;
+					return didHit;
+				});
+			return didHit;
+		}
+
+		inline bool DoesHit_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, uint32_t* pRecordIndex = nullptr)
+		{
+			return DoesHit_PlacedMesh(mesh, mesh, ray, pRecordIndex);
+		}
+
+		inline bool DoesHit_MeshInstance(const MeshInstance& instance, const Ray& ray, uint32_t* pRecordIndex = nullptr)
+		{
+			return DoesHit_PlacedMesh(*instance.pMesh, instance, ray, pRecordIndex);
+		}
+
+		//DoesHit_PlacedMesh for a single triangle record, skips the bounds and the BVH
+		inline bool DoesHit_TriangleRecord(const TriangleMesh& mesh, const MeshPlacement& placement, uint32_t recordIndex, const Ray& ray)
+		{
+			const Ray objectRay{ placement.inverseTransform.TransformPoint(ray.origin), placement.inverseTransform.TransformVector(ray.direction), ray.min, ray.max };
+
+			float t, u, v;
+			return HitTest_TriangleRecord(mesh.triangleRecords[recordIndex], GetShadowCullMode(placement.cullMode), objectRay, t, u, v);
+		}
+
+		inline bool DoesHit_TriangleRecord(const TriangleMesh& mesh, uint32_t recordIndex, const Ray& ray)
+		{
+			return DoesHit_TriangleRecord(mesh, mesh, recordIndex, ray);
 		}
 
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
-			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true);
+			return DoesHit_TriangleMesh(mesh, ray);
 		}
 #pragma endregion
 	}
@@ -252,79 +470,4 @@ namespace dae
 			return ColorRGB{};
 		} 
 	}
-
-	namespace Utils
-	{
-		//Just parses vertices and indices
-#pragma warning(push)
-#pragma warning(disable : 4505) //Warning unreferenced local function
-		static bool ParseOBJ(const std::string& filename, std::vector<Vector3>& positions, std::vector<Vector3>& normals, std::vector<int>& indices)
-		{
-			std::ifstream file(filename);
-			if (!file)
-				return false;
-
-			std::string sCommand;
-			// start a while iteration ending when the end of file is reached (ios::eof)
-			while (!file.eof())
-			{
-				//read the first word of the string, use the >> operator (istream::operator>>) 
-				file >> sCommand;
-				//use conditional statements to process the different commands	
-				if (sCommand == "#")
-				{
-					// Ignore Comment
-				}
-				else if (sCommand == "v")
-				{
-					//Vertex
-					float x, y, z;
-					file >> x >> y >> z;
-					positions.push_back({ x, y, z });
-				}
-				else if (sCommand == "f")
-				{
-					float i0, i1, i2;
-					file >> i0 >> i1 >> i2;
-
-					indices.push_back((int)i0 - 1);
-					indices.push_back((int)i1 - 1);
-					indices.push_back((int)i2 - 1);
-				}
-				//read till end of line and ignore all remaining chars
-				file.ignore(1000, '\n');
-
-				if (file.eof())
-					break;
-			}
-
-			//Precompute normals
-			for (uint64_t index = 0; index < indices.size(); index += 3)
-			{
-				uint32_t i0 = indices[index];
-				uint32_t i1 = indices[index + 1];
-				uint32_t i2 = indices[index + 2];
-
-				Vector3 edgeV0V1 = positions[i1] - positions[i0];
-				Vector3 edgeV0V2 = positions[i2] - positions[i0];
-				Vector3 normal = Vector3::Cross(edgeV0V1, edgeV0V2);
-
-				if (std::isnan(normal.x))
-				{
-					int k = 0;
-				}
-
-				normal.Normalize();
-				if (std::isnan(normal.x))
-				{
-					int k = 0;
-				}
-
-				normals.push_back(normal);
-			}
-
-			return true;
-		}
-#pragma warning(pop)
-	}
 }
\ No newline at end of file
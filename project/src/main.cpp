@@ -7,9 +7,14 @@
 #undef main
 
 //Standard includes
+#include <charconv>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <string>
 
 //Project includes
+#include "Instrumentation.h"
 #include "Timer.h"
 #include "Renderer.h"
 #include "Scene.h"
@@ -22,17 +27,292 @@ void ShutDown(SDL_Window* pWindow)
 	SDL_Quit();
 }
 
+struct RenderOptions
+{
+	bool isHeadless{ false };
+	bool showHelp{ false };
+	bool applyGamma{ false };
+	bool isProgressive{ false };
+	bool isIncremental{ false };
+	uint32_t maxSamplesPerPixel{ 256 };
+	uint32_t width{ 640 };
+	uint32_t height{ 480 };
+	std::string sceneName{ "reference" };
+	uint32_t samplesPerPixel{ 1 };
+	uint32_t frameCount{ 1 };
+	uint32_t framesPerSecond{ 30 };
+	uint32_t threadCount{ 0 };
+	uint32_t tileSize{ 32 };
+	std::string outputPath{ "render.ppm" };
+	std::string statisticsPath{};
+	std::string tracePath{};
+	uint32_t frameBudgetMilliseconds{ 0 };
+	uint32_t interleaveFactor{ 1 };
+};
+
+void PrintUsage()
+{
+	std::cout << "Usage: RayTracer [options]\n"
+		<< "  --help             show this list\n"
+		<< "  --headless         render without a window and write the frames to --output\n"
+		<< "  --width <pixels>   image width (default 640)\n"
+		<< "  --height <pixels>  image height (default 480)\n"
+		<< "  --scene <name>     w1, w2, w3, w3_test, w4_test, reference, bunny or instances (default reference)\n"
+		<< "  --samples <count>  samples per pixel (default 1)\n"
+		<< "  --gamma            sRGB encode the window and .ppm/.png output instead of showing linear values\n"
+		<< "  --progressive      accumulate jittered samples while the view is static, headless frames render until converged\n"
+		<< "  --max-samples <n>  progressive sample cap per pixel (default 256)\n"
+		<< "  --frames <count>   headless frames to render (default 1)\n"
+		<< "  --fps <count>      headless scene time step is 1 / fps seconds (default 30)\n"
+		<< "  --threads <count>  render threads, 0 uses every hardware thread (default 0)\n"
+		<< "  --tile <pixels>    tile size (default 32)\n"
+		<< "  --budget <ms>      window frame time target, a moving camera is traced at a lower resolution to meet it (default 0, off)\n"
+		<< "  --interleave <n>   1, 2 or 4: a moving camera traces one in n pixels per frame and reprojects the rest (default 1, off)\n"
+		<< "  --incremental      a static camera only retraces the tiles that objects moving in the scene can affect\n"
+		<< "  --output <path>    .ppm, .png, .pfm or .hdr, frame numbers get appended when rendering several frames (default render.ppm)\n"
+		<< "  --stats <path>     write the per-frame counters and stage times as CSV, needs a build with ENABLE_INSTRUMENTATION\n"
+		<< "  --trace <path>     record a Chrome trace-event timeline (chrome://tracing, ui.perfetto.dev) until exit, same build requirement\n";
+}
+
+bool ParseUnsigned(const char* pText, uint32_t& value)
+{
+	const char* pEnd{ pText + std::strlen(pText) };
+	const auto [pLast, error] = std::from_chars(pText, pEnd, value);
+	return error == std::errc{} && pLast == pEnd;
+}
+
+bool ParseOptions(int argc, char* args[], RenderOptions& options)
+{
+	for (int inx = 1; inx < argc; ++inx)
+	{
+		const std::string option{ args[inx] };
+		if (option == "--headless")
+		{
+			options.isHeadless = true;
+			continue;
+		}
+		if (option == "--help")
+		{
+			options.showHelp = true;
+			continue;
+		}
+		if (option == "--gamma")
+		{
+			options.applyGamma = true;
+			continue;
+		}
+		if (option == "--progressive")
+		{
+			options.isProgressive = true;
+			continue;
+		}
+		if (option == "--incremental")
+		{
+			options.isIncremental = true;
+			continue;
+		}
+
+		const bool takesValue{ option == "--width" || option == "--height" || option == "--scene" || option == "--samples" || option == "--frames"
+			|| option == "--fps" || option == "--threads" || option == "--tile" || option == "--output" || option == "--max-samples" || option == "--stats" || option == "--trace" || option == "--budget" || option == "--interleave" };
+		if (!takesValue)
+		{
+			std::cout << "Unknown option " << option << std::endl;
+			return false;
+		}
+
+		if (inx + 1 >= argc)
+		{
+			std::cout << "Missing value for " << option << std::endl;
+			return false;
+		}
+		const char* pValue{ args[++inx] };
+
+		bool isValid{ true };
+		if (option == "--width") isValid = ParseUnsigned(pValue, options.width) && options.width > 0;
+		else if (option == "--height") isValid = ParseUnsigned(pValue, options.height) && options.height > 0;
+		else if (option == "--scene") options.sceneName = pValue;
+		else if (option == "--samples") isValid = ParseUnsigned(pValue, options.samplesPerPixel) && options.samplesPerPixel > 0;
+		else if (option == "--frames") isValid = ParseUnsigned(pValue, options.frameCount) && options.frameCount > 0;
+		else if (option == "--fps") isValid = ParseUnsigned(pValue, options.framesPerSecond) && options.framesPerSecond > 0;
+		else if (option == "--threads") isValid = ParseUnsigned(pValue, options.threadCount);
+		else if (option == "--tile") isValid = ParseUnsigned(pValue, options.tileSize) && options.tileSize > 0;
+		else if (option == "--output") options.outputPath = pValue;
+		else if (option == "--max-samples") isValid = ParseUnsigned(pValue, options.maxSamplesPerPixel) && options.maxSamplesPerPixel > 0;
+		else if (option == "--stats") options.statisticsPath = pValue;
+		else if (option == "--trace") options.tracePath = pValue;
+		else if (option == "--budget") isValid = ParseUnsigned(pValue, options.frameBudgetMilliseconds);
+		else if (option == "--interleave") isValid = ParseUnsigned(pValue, options.interleaveFactor)
+			&& (options.interleaveFactor == 1 || options.interleaveFactor == 2 || options.interleaveFactor == 4);
+
+		if (!isValid)
+		{
+			std::cout << "Invalid value '" << pValue << "' for " << option << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+//render.ppm becomes render_0000.ppm, render_0001.ppm, ... when more than one frame is written
+std::string GetFramePath(const std::string& path, uint32_t frame, uint32_t frameCount)
+{
+	if (frameCount <= 1)
+		return path;
+
+	std::string frameNumber{ std::to_string(frame) };
+	frameNumber.insert(0, frameNumber.size() < 4 ? 4 - frameNumber.size() : 0, '0');
+
+	const size_t dotIndex{ path.find_last_of('.') };
+	const size_t slashIndex{ path.find_last_of("/\\") };
+	if (dotIndex == std::string::npos || (slashIndex != std::string::npos && dotIndex < slashIndex))
+		return path + "_" + frameNumber;
+
+	return path.substr(0, dotIndex) + "_" + frameNumber + path.substr(dotIndex);
+}
+
+//Opens the --stats trace file, empty when it wasn't asked for or the build has no counters to write
+std::ofstream OpenStatisticsFile(const RenderOptions& options)
+{
+	std::ofstream file{};
+	if (options.statisticsPath.empty())
+		return file;
+
+	if (!Instrumentation::IsEnabled)
+	{
+		std::cout << "--stats ignored, this build has no instrumentation (configure with -DENABLE_INSTRUMENTATION=ON)" << std::endl;
+		return file;
+	}
+
+	file.open(options.statisticsPath);
+	if (!file)
+		std::cout << "Something went wrong. " << options.statisticsPath << " can't be written!" << std::endl;
+	else
+		Instrumentation::WriteCsvHeader(file);
+	return file;
+}
+
+//Merges this frame's counters, appends them to the statistics file when there is one and drains the trace rings
+void EndInstrumentedFrame(std::ofstream& statisticsFile)
+{
+	Instrumentation::EndFrame();
+	if (statisticsFile.is_open())
+		Instrumentation::WriteCsvRow(statisticsFile, Instrumentation::GetLastFrame());
+	Trace::Collect();
+}
+
+void StartTrace(const RenderOptions& options)
+{
+	if (options.tracePath.empty())
+		return;
+
+	if (!Trace::IsEnabled)
+	{
+		std::cout << "--trace ignored, this build has no instrumentation (configure with -DENABLE_INSTRUMENTATION=ON)" << std::endl;
+		return;
+	}
+
+	Trace::SetThreadName("Main");
+	Trace::Start();
+}
+
+void FinishTrace(const RenderOptions& options)
+{
+	if (options.tracePath.empty() || !Trace::IsEnabled)
+		return;
+
+	if (Trace::Write(options.tracePath))
+		std::cout << "Saved " << options.tracePath << std::endl;
+	else
+		std::cout << "Something went wrong. " << options.tracePath << " not saved!" << std::endl;
+}
+
+//Offline mode: no window, fixed time steps, every frame is written to disk
+int RunHeadless(const RenderOptions& options)
+{
+	Scene* pScene = CreateScene(options.sceneName);
+	if (!pScene)
+	{
+		std::cout << "Unknown scene " << options.sceneName << std::endl;
+		return 1;
+	}
+	pScene->Initialize();
+
+	Timer timer{};
+	Renderer renderer{ options.width, options.height, options.threadCount, options.tileSize };
+	renderer.SetSamplesPerPixel(options.samplesPerPixel);
+	renderer.SetGammaCorrection(options.applyGamma);
+	renderer.SetProgressive(options.isProgressive);
+	renderer.SetMaxSamplesPerPixel(options.maxSamplesPerPixel);
+	renderer.SetInterleaveFactor(options.interleaveFactor);
+	renderer.SetIncrementalRendering(options.isIncremental);
+
+	std::ofstream statisticsFile{ OpenStatisticsFile(options) };
+	StartTrace(options);
+
+	int result{ 0 };
+	for (uint32_t frame = 0; frame < options.frameCount; ++frame)
+	{
+		{
+			const Instrumentation::ScopedStageTimer updateTimer{ Instrumentation::Stage::SceneUpdate };
+			pScene->Update(&timer);
+			pScene->UpdateAccelerationStructure();
+		}
+
+		//Progressive passes end on their own, every pixel stops at the latest at the sample cap
+		uint32_t passCount{ 0 };
+		do
+		{
+			renderer.Render(pScene);
+			++passCount;
+		} while (options.isProgressive && !renderer.IsConverged());
+
+		if (options.isProgressive)
+			std::cout << "Converged after " << passCount << " passes" << std::endl;
+
+		//All progressive passes of an output frame count as one frame
+		EndInstrumentedFrame(statisticsFile);
+		if (Instrumentation::IsEnabled)
+			Instrumentation::Print(std::cout, Instrumentation::GetLastFrame());
+
+		const std::string framePath{ GetFramePath(options.outputPath, frame, options.frameCount) };
+		if (!renderer.SaveBufferToImage(framePath))
+		{
+			std::cout << "Something went wrong. " << framePath << " not saved!" << std::endl;
+			result = 1;
+			break;
+		}
+		std::cout << "Saved " << framePath << std::endl;
+
+		timer.Step(1.f / options.framesPerSecond);
+	}
+	FinishTrace(options);
+
+	delete pScene;
+	return result;
+}
+
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	RenderOptions options{};
+	if (!ParseOptions(argc, args, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+	if (options.showHelp)
+	{
+		PrintUsage();
+		return 0;
+	}
+
+	if (options.isHeadless)
+		return RunHeadless(options);
 
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
-	const uint32_t width = 640;
-	const uint32_t height = 480;
+	const uint32_t width = options.width;
+	const uint32_t height = options.height;
 
 	SDL_Window* pWindow = SDL_CreateWindow(
 		"RayTracer - Ivans Minajevs",
@@ -45,12 +325,30 @@ int main(int argc, char* args[])
 
 	//Initialize "framework"
 	const auto pTimer = new Timer();
-	const auto pRenderer = new Renderer(pWindow);
+	const auto pRenderer = new Renderer(pWindow, options.threadCount, options.tileSize);
+	pRenderer->SetSamplesPerPixel(options.samplesPerPixel);
+	pRenderer->SetGammaCorrection(options.applyGamma);
+	pRenderer->SetProgressive(options.isProgressive);
+	pRenderer->SetMaxSamplesPerPixel(options.maxSamplesPerPixel);
+	pRenderer->SetFrameTimeBudget(options.frameBudgetMilliseconds / 1000.f);
+	pRenderer->SetInterleaveFactor(options.interleaveFactor);
+	pRenderer->SetIncrementalRendering(options.isIncremental);
 
-	Scene* pScene = new Scene_W4_ReferenceScene();
-	bool isReferenceScene = true;
+	Scene* pScene = CreateScene(options.sceneName);
+	if (!pScene)
+	{
+		std::cout << "Unknown scene " << options.sceneName << std::endl;
+		delete pRenderer;
+		delete pTimer;
+		ShutDown(pWindow);
+		return 1;
+	}
+	bool isReferenceScene = options.sceneName == "reference";
 	pScene->Initialize();
 
+	std::ofstream statisticsFile{ OpenStatisticsFile(options) };
+	StartTrace(options);
+
 	//Start loop
 	pTimer->Start();
 
@@ -62,6 +360,7 @@ int main(int argc, char* args[])
 	bool takeScreenshot = false;
 	bool isShadowToogled = false;
 	bool isLightingModeToogled = false;
+	bool isProgressiveToogled = false;
 	while (isLooping)
 	{
 		//--------- Get input events ---------
@@ -84,6 +383,10 @@ int main(int argc, char* args[])
 				{
 					isLightingModeToogled = true;
 				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4)
+				{
+					isProgressiveToogled = true;
+				}
 				if (e.key.keysym.scancode == SDL_SCANCODE_SPACE)
 				{
 					if (isReferenceScene)
@@ -102,6 +405,8 @@ int main(int argc, char* args[])
 						isReferenceScene = true;
 						std::cout << "Switched to Reference Scene!" << std::endl;
 					}
+					//The new scene may reuse the address of the old one
+					pRenderer->ResetAccumulation();
 				}
 				break;
 		
@@ -109,18 +414,28 @@ int main(int argc, char* args[])
 		}
 
 		//--------- Update ---------
-		pScene->Update(pTimer);
+		{
+			const Instrumentation::ScopedStageTimer updateTimer{ Instrumentation::Stage::SceneUpdate };
+			pScene->Update(pTimer);
+			pScene->UpdateAccelerationStructure();
+		}
 
 		//--------- Render ---------
 		pRenderer->Render(pScene);
+		EndInstrumentedFrame(statisticsFile);
 
 		//--------- Timer ---------
 		pTimer->Update();
+		pRenderer->ReportFrameTime(pTimer->GetElapsed());
 		printTimer += pTimer->GetElapsed();
 		if (printTimer >= 1.f)
 		{
 			printTimer = 0.f;
 			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			if (pRenderer->GetFrameTimeBudget() > 0.f)
+				std::cout << "Render scale: " << pRenderer->GetRenderScale() << std::endl;
+			if (Instrumentation::IsEnabled)
+				Instrumentation::Print(std::cout, Instrumentation::GetLastFrame());
 		}
 
 		//Save screenshot after full render
@@ -143,8 +458,15 @@ int main(int argc, char* args[])
 			pRenderer->CycleLightingMode();
 			isLightingModeToogled = false;
 		}
+		if (isProgressiveToogled)
+		{
+			pRenderer->SetProgressive(!pRenderer->IsProgressive());
+			std::cout << (pRenderer->IsProgressive() ? "Progressive rendering on" : "Progressive rendering off") << std::endl;
+			isProgressiveToogled = false;
+		}
 	}
 	pTimer->Stop();
+	FinishTrace(options);
 
 	//Shutdown "framework"
 	delete pScene;
@@ -1,7 +1,23 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
 #include "../src/Vector3.h"
 #include "../src/Vector4.h"
 #include "../src/Matrix.h"
+#include "../src/Utils.h"
+#include "../src/FrameBuffer.h"
+#include "../src/GeometryKernels.h"
+#include "../src/Instrumentation.h"
+#include "../src/Material.h"
+#include "../src/MeshCache.h"
+#include "../src/ObjParser.h"
+#include "../src/RayPacket.h"
+#include "../src/Scene.h"
+#include "../src/ThreadPool.h"
+#include "../src/Trace.h"
 
 namespace dae
 {
@@ -37,6 +53,599 @@ namespace dae
 
 	// W1
 
+	TEST(Matrix, Inverse) {
+		const Matrix transform{ Matrix::CreateScale(2.f, 0.5f, 3.f) * Matrix::CreateRotation(0.3f, 1.2f, -0.7f) * Matrix::CreateTranslation(4.f, -1.f, 2.f) };
+		const Matrix identity{ transform * Matrix::Inverse(transform) };
+
+		for (int r = 0; r < 4; ++r)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				EXPECT_NEAR(r == c ? 1.f : 0.f, identity[r][c], 1e-5f);
+			}
+		}
+
+		const Vector3 point{ 1.f, 2.f, 3.f };
+		const Vector3 roundTrip{ Matrix::Inverse(transform).TransformPoint(transform.TransformPoint(point)) };
+		EXPECT_NEAR(point.x, roundTrip.x, 1e-5f);
+		EXPECT_NEAR(point.y, roundTrip.y, 1e-5f);
+		EXPECT_NEAR(point.z, roundTrip.z, 1e-5f);
+
+		//The determinant of a small uniform scale is far below FLT_EPSILON
+		const Matrix smallScale{ Matrix::CreateScale(0.001f, 0.001f, 0.001f) * Matrix::CreateTranslation(4.f, -1.f, 2.f) };
+		const Vector3 smallRoundTrip{ Matrix::Inverse(smallScale).TransformPoint(smallScale.TransformPoint(point)) };
+		EXPECT_NEAR(point.x, smallRoundTrip.x, 1e-3f);
+		EXPECT_NEAR(point.y, smallRoundTrip.y, 1e-3f);
+		EXPECT_NEAR(point.z, smallRoundTrip.z, 1e-3f);
+	}
+
+	TEST(Triangle, IntersectionRecord) {
+		const TriangleIntersectionRecord triangle{ { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f } };
+		const Ray ray{ { 0.25f, 0.5f, -2.f }, Vector3::UnitZ };
+
+		float t, u, v;
+		ASSERT_TRUE(GeometryUtils::HitTest_TriangleRecord(triangle, TriangleCullMode::NoCulling, ray, t, u, v));
+		EXPECT_FLOAT_EQ(2.f, t);
+		EXPECT_FLOAT_EQ(0.25f, u);
+		EXPECT_FLOAT_EQ(0.5f, v);
+
+		// Cross(edge1, edge2) points along +z, so this ray sees the back face
+		EXPECT_FALSE(GeometryUtils::HitTest_TriangleRecord(triangle, TriangleCullMode::BackFaceCulling, ray, t, u, v));
+		EXPECT_TRUE(GeometryUtils::HitTest_TriangleRecord(triangle, TriangleCullMode::FrontFaceCulling, ray, t, u, v));
+	}
+
+	TEST(TriangleMesh, BVHMatchesBruteForce) {
+		std::mt19937 generator{ 1337 };
+		std::uniform_real_distribution<float> position{ -5.f, 5.f };
+		std::uniform_real_distribution<float> offset{ -0.5f, 0.5f };
+
+		TriangleMesh mesh{};
+		mesh.cullMode = TriangleCullMode::NoCulling;
+		for (int inx = 0; inx < 500; ++inx)
+		{
+			const Vector3 center{ position(generator), position(generator), position(generator) };
+			const Triangle triangle{ center + Vector3{ offset(generator), offset(generator), offset(generator) },
+				center + Vector3{ offset(generator), offset(generator), offset(generator) },
+				center + Vector3{ offset(generator), offset(generator), offset(generator) } };
+			mesh.AppendTriangle(triangle, true);
+		}
+		mesh.RotateY(PI_DIV_4);
+		mesh.Scale({ 0.5f, 2.f, 1.f });
+		mesh.Translate({ 1.f, -2.f, 3.f });
+		mesh.UpdateTransforms();
+
+		for (int inx = 0; inx < 200; ++inx)
+		{
+			const Ray ray{ { position(generator), position(generator), -10.f }, Vector3{ offset(generator), offset(generator), 1.f }.Normalized() };
+
+			float bruteForceT{ FLT_MAX };
+			for (size_t triangleInx = 0; triangleInx < mesh.indices.size(); triangleInx += 3)
+			{
+				Triangle triangle{ mesh.finalTransform.TransformPoint(mesh.positions[mesh.indices[triangleInx]]),
+					mesh.finalTransform.TransformPoint(mesh.positions[mesh.indices[triangleInx + 1]]),
+					mesh.finalTransform.TransformPoint(mesh.positions[mesh.indices[triangleInx + 2]]) };
+				triangle.cullMode = TriangleCullMode::NoCulling;
+
+				HitRecord triangleHit{};
+				if (GeometryUtils::HitTest_Triangle(triangle, ray, triangleHit) && triangleHit.t < bruteForceT)
+					bruteForceT = triangleHit.t;
+			}
+
+			HitRecord meshHit{};
+			EXPECT_EQ(bruteForceT != FLT_MAX, GeometryUtils::HitTest_TriangleMesh(mesh, ray, meshHit));
+			if (meshHit.didHit)
+				EXPECT_NEAR(bruteForceT, meshHit.t, 1e-3f);
+		}
+	}
+
+	TEST(TriangleMesh, AngleWeightedVertexNormals) {
+		//The corner at the origin touches one triangle in the z = 0 plane and a second 90 degree wedge in the x = 0 plane,
+		//split into two triangles. Weighted by angle, the split doesn't count and both planes pull equally
+		const std::vector<Vector3> positions{ { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f, 1.f } };
+		const std::vector<int> indices{ 0, 1, 2, 0, 3, 4, 0, 4, 2 };
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::NoCulling };
+		mesh.CalculateVertexNormals();
+
+		ASSERT_EQ(positions.size(), mesh.vertexNormals.size());
+		EXPECT_NEAR(-0.70710678f, mesh.vertexNormals[0].x, 1e-5f);
+		EXPECT_NEAR(0.f, mesh.vertexNormals[0].y, 1e-5f);
+		EXPECT_NEAR(0.70710678f, mesh.vertexNormals[0].z, 1e-5f);
+		EXPECT_NEAR(1.f, mesh.vertexNormals[1].z, 1e-5f);
+
+		//The centroid of the first triangle gets the average of its three vertex normals
+		HitRecord hit{};
+		ASSERT_TRUE(GeometryUtils::HitTest_TriangleMesh(mesh, Ray{ { 1.f / 3.f, 1.f / 3.f, 5.f }, { 0.f, 0.f, -1.f } }, hit));
+
+		const Vector3 expectedNormal{ (mesh.vertexNormals[0] + mesh.vertexNormals[1] + mesh.vertexNormals[2]).Normalized() };
+		EXPECT_NEAR(expectedNormal.x, hit.normal.x, 1e-4f);
+		EXPECT_NEAR(expectedNormal.y, hit.normal.y, 1e-4f);
+		EXPECT_NEAR(expectedNormal.z, hit.normal.z, 1e-4f);
+	}
+
+	TEST(MeshInstance, MatchesTransformedMeshCopy) {
+		const std::vector<Vector3> positions{ { -1.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 2.f, 0.f }, { 0.f, 1.f, -1.f } };
+		const std::vector<int> indices{ 0, 1, 2, 0, 3, 1, 1, 3, 2 };
+		const auto pShared = std::make_shared<const TriangleMesh>(positions, indices, TriangleCullMode::NoCulling);
+
+		//Two instances placed differently share one mesh, each has to behave like its own transformed copy
+		int hitCount{ 0 };
+		for (float offset : { -2.f, 3.f })
+		{
+			MeshInstance instance{};
+			instance.pMesh = pShared;
+			instance.cullMode = TriangleCullMode::NoCulling;
+			instance.materialIndex = 7;
+			instance.Translate({ offset, 0.5f, 1.f });
+			instance.RotateY(offset);
+			instance.UpdateTransforms();
+
+			TriangleMesh copy{ positions, indices, TriangleCullMode::NoCulling };
+			copy.materialIndex = 7;
+			copy.Translate({ offset, 0.5f, 1.f });
+			copy.RotateY(offset);
+			copy.UpdateTransforms();
+
+			for (float x = -2.f; x <= 2.f; x += 0.25f)
+			{
+				const Ray ray{ { offset + x, 0.75f, -5.f }, { 0.f, 0.f, 1.f } };
+				HitRecord instanceHit{}, copyHit{};
+				ASSERT_EQ(GeometryUtils::HitTest_TriangleMesh(copy, ray, copyHit), GeometryUtils::HitTest_MeshInstance(instance, ray, instanceHit));
+				EXPECT_EQ(GeometryUtils::DoesHit_TriangleMesh(copy, ray), GeometryUtils::DoesHit_MeshInstance(instance, ray));
+				if (!copyHit.didHit)
+					continue;
+
+				++hitCount;
+				EXPECT_FLOAT_EQ(copyHit.t, instanceHit.t);
+				EXPECT_EQ(7, instanceHit.materialIndex);
+				EXPECT_NEAR(copyHit.normal.x, instanceHit.normal.x, 1e-5f);
+				EXPECT_NEAR(copyHit.normal.z, instanceHit.normal.z, 1e-5f);
+			}
+		}
+		EXPECT_GT(hitCount, 0);
+	}
+
+	TEST(MaterialTable, HandlesPastByteRange) {
+		MaterialTable table{};
+		const MaterialHandle solidHandle{ table.Add(Material_SolidColor{ colors::Red }) };
+
+		//More than an unsigned char could address, every handle has to keep naming its own material
+		std::vector<MaterialHandle> handles{};
+		for (int inx = 0; inx < 300; ++inx)
+		{
+			handles.push_back(table.Add(Material_Lambert{ ColorRGB{ inx / 300.f, 0.f, 1.f }, 1.f }));
+		}
+		EXPECT_EQ(301u, table.GetCount());
+
+		EXPECT_EQ(MaterialType::SolidColor, GetMaterialType(solidHandle));
+		EXPECT_EQ(MaterialType::Lambert, GetMaterialType(handles[299]));
+		EXPECT_EQ(299u, GetMaterialSlot(handles[299]));
+
+		for (int inx : { 0, 255, 256, 299 })
+		{
+			const ColorRGB expected{ Material_Lambert{ ColorRGB{ inx / 300.f, 0.f, 1.f }, 1.f }.Shade() };
+			const ColorRGB shaded{ table.Shade(handles[inx], HitRecord{}, Vector3::UnitY, Vector3::UnitY) };
+			EXPECT_FLOAT_EQ(expected.r, shaded.r);
+			EXPECT_FLOAT_EQ(expected.b, shaded.b);
+		}
+		EXPECT_FLOAT_EQ(1.f, table.Shade(solidHandle, HitRecord{}, Vector3::UnitY, Vector3::UnitY).r);
+	}
+
+	TEST(GeometryKernels, MatchScalarHitTests) {
+		std::mt19937 generator{ 42 };
+		std::uniform_real_distribution<float> position{ -5.f, 5.f };
+		std::uniform_real_distribution<float> offset{ -1.f, 1.f };
+
+		//Odd counts so the last batch of every kernel width is only partially filled
+		std::vector<Sphere> spheres(37);
+		PackedSpheres packedSpheres{};
+		for (Sphere& sphere : spheres)
+		{
+			sphere.origin = { position(generator), position(generator), position(generator) };
+			sphere.radius = 0.25f + 0.5f * std::abs(offset(generator));
+			packedSpheres.Add(sphere);
+		}
+		packedSpheres.Pad();
+
+		std::vector<Triangle> triangles{};
+		PackedTriangles packedTriangles{};
+		for (int inx = 0; inx < 53; ++inx)
+		{
+			const Vector3 center{ position(generator), position(generator), position(generator) };
+			Triangle triangle{ center + Vector3{ offset(generator), offset(generator), offset(generator) },
+				center + Vector3{ offset(generator), offset(generator), offset(generator) },
+				center + Vector3{ offset(generator), offset(generator), offset(generator) } };
+			triangle.cullMode = static_cast<TriangleCullMode>(inx % 3);
+			triangles.push_back(triangle);
+			packedTriangles.Add(triangle);
+		}
+		packedTriangles.Pad();
+
+		const GeometryKernels& kernels = GetGeometryKernels();
+		for (int inx = 0; inx < 500; ++inx)
+		{
+			const Ray ray{ { position(generator), position(generator), -10.f }, Vector3{ 0.3f * offset(generator), 0.3f * offset(generator), 1.f }.Normalized() };
+			const bool isShadowRay{ inx % 2 == 1 };
+
+			uint32_t scalarSphere{ NoKernelHit };
+			Ray scalarRay{ ray };
+			for (uint32_t sphereInx = 0; sphereInx < spheres.size(); ++sphereInx)
+			{
+				HitRecord sphereHit{};
+				if (GeometryUtils::HitTest_Sphere(spheres[sphereInx], scalarRay, sphereHit))
+				{
+					scalarSphere = sphereInx;
+					scalarRay.max = sphereHit.t;
+				}
+			}
+
+			float sphereT{ ray.max };
+			EXPECT_EQ(scalarSphere, kernels.closestSphere(packedSpheres, 0, packedSpheres.count, ray, sphereT));
+
+			uint32_t scalarTriangle{ NoKernelHit };
+			scalarRay = ray;
+			for (uint32_t triangleInx = 0; triangleInx < triangles.size(); ++triangleInx)
+			{
+				HitRecord triangleHit{};
+				if (GeometryUtils::HitTest_Triangle(triangles[triangleInx], scalarRay, triangleHit, isShadowRay))
+				{
+					scalarTriangle = triangleInx;
+					scalarRay.max = triangleHit.t;
+				}
+			}
+
+			float triangleT{ ray.max };
+			EXPECT_EQ(scalarTriangle, kernels.closestTriangle(packedTriangles, 0, packedTriangles.count, ray, isShadowRay, triangleT));
+
+			//The any-hit kernels may stop at a different primitive, but only report a hit when there is one
+			float anyT{ ray.max };
+			EXPECT_EQ(scalarSphere != NoKernelHit, kernels.anySphere(packedSpheres, 0, packedSpheres.count, ray, anyT) != NoKernelHit);
+			anyT = ray.max;
+			EXPECT_EQ(scalarTriangle != NoKernelHit, kernels.anyTriangle(packedTriangles, 0, packedTriangles.count, ray, isShadowRay, anyT) != NoKernelHit);
+
+			//Sub-range starting mid-array, like the run of one top-level leaf
+			uint32_t scalarRangeSphere{ NoKernelHit };
+			scalarRay = ray;
+			for (uint32_t sphereInx = 5; sphereInx < 16; ++sphereInx)
+			{
+				HitRecord sphereHit{};
+				if (GeometryUtils::HitTest_Sphere(spheres[sphereInx], scalarRay, sphereHit))
+				{
+					scalarRangeSphere = sphereInx;
+					scalarRay.max = sphereHit.t;
+				}
+			}
+
+			sphereT = ray.max;
+			EXPECT_EQ(scalarRangeSphere, kernels.closestSphere(packedSpheres, 5, 11, ray, sphereT));
+		}
+	}
+
+	TEST(ThreadPool, RunsEveryTaskOnce) {
+		ThreadPool threadPool{ 4 };
+		EXPECT_EQ(4u, threadPool.GetThreadCount());
+
+		//Several batches in a row, so workers that wake up late for a batch get exercised too
+		for (uint32_t taskCount : { 1u, 3u, 97u, 1000u })
+		{
+			std::vector<std::atomic<int>> runCounts(taskCount);
+			threadPool.ParallelFor(taskCount, [&](uint32_t taskIndex) { ++runCounts[taskIndex]; });
+
+			for (const std::atomic<int>& runCount : runCounts)
+				EXPECT_EQ(1, runCount.load());
+		}
+	}
+
+	TEST(FrameBuffer, UpscaleInterpolatesBetweenPixelCenters) {
+		FrameBuffer source{ 2, 1 };
+		source.SetPixel(1, 0, { 1.f, 2.f, 4.f });
+
+		FrameBuffer target{ 4, 2 };
+		target.Upscale(source, 0, 2);
+
+		//Edge pixels clamp to the nearest source pixel, the inner ones sit a quarter and three quarters of the way
+		for (uint32_t py = 0; py < 2; ++py)
+		{
+			EXPECT_FLOAT_EQ(0.f, target.GetPixel(0, py).b);
+			EXPECT_FLOAT_EQ(1.f, target.GetPixel(1, py).b);
+			EXPECT_FLOAT_EQ(3.f, target.GetPixel(2, py).b);
+			EXPECT_FLOAT_EQ(4.f, target.GetPixel(3, py).b);
+			EXPECT_FLOAT_EQ(0.75f, target.GetPixel(2, py).r);
+		}
+	}
+
+	//Two spheres, the test moves the first one by hand
+	class MovingSphereScene final : public Scene
+	{
+	public:
+		void Initialize() override
+		{
+			pMovingSphere = AddSphere({ 0.f, 0.f, 10.f }, 1.f);
+			AddSphere({ 5.f, 0.f, 10.f }, 1.f);
+		}
+
+		Sphere* pMovingSphere{};
+	};
+
+	TEST(Scene, ReportsOldAndNewBoundsOfMovedObjects) {
+		MovingSphereScene scene{};
+		scene.Initialize();
+		scene.UpdateAccelerationStructure();
+		const uint64_t builtRevision{ scene.GetRevision() };
+		EXPECT_TRUE(scene.GetChangedBoundsMin().empty());
+
+		scene.UpdateAccelerationStructure();
+		EXPECT_EQ(builtRevision, scene.GetRevision());
+		EXPECT_TRUE(scene.GetChangedBoundsMin().empty());
+
+		scene.pMovingSphere->origin.y = 3.f;
+		scene.UpdateAccelerationStructure();
+		EXPECT_EQ(builtRevision + 1, scene.GetRevision());
+		ASSERT_EQ(2u, scene.GetChangedBoundsMin().size());
+		EXPECT_EQ(Vector3(-1.f, -1.f, 9.f), scene.GetChangedBoundsMin()[0]);
+		EXPECT_EQ(Vector3(1.f, 1.f, 11.f), scene.GetChangedBoundsMax()[0]);
+		EXPECT_EQ(Vector3(-1.f, 2.f, 9.f), scene.GetChangedBoundsMin()[1]);
+		EXPECT_EQ(Vector3(1.f, 4.f, 11.f), scene.GetChangedBoundsMax()[1]);
+	}
+
+	//Two clusters added interleaved, the build stores them cluster by cluster
+	class InterleavedSpheresScene final : public Scene
+	{
+	public:
+		void Initialize() override
+		{
+			AddSphere({ 0.f, 0.f, 10.f }, 1.f);
+			pMovingSphere = AddSphere({ 100.f, 0.f, 10.f }, 1.f);
+			AddSphere({ 3.f, 0.f, 10.f }, 1.f);
+			AddSphere({ 103.f, 0.f, 10.f }, 1.f);
+		}
+
+		Sphere* pMovingSphere{};
+	};
+
+	TEST(Scene, KeepsBoundsWithTheirObjectsWhenTheBuildReorders) {
+		InterleavedSpheresScene scene{};
+		scene.Initialize();
+		scene.UpdateAccelerationStructure();
+		const uint64_t builtRevision{ scene.GetRevision() };
+
+		scene.UpdateAccelerationStructure();
+		EXPECT_EQ(builtRevision, scene.GetRevision());
+		EXPECT_TRUE(scene.GetChangedBoundsMin().empty());
+
+		scene.pMovingSphere->origin.y = 3.f;
+		scene.UpdateAccelerationStructure();
+		EXPECT_EQ(builtRevision + 1, scene.GetRevision());
+		ASSERT_EQ(2u, scene.GetChangedBoundsMin().size());
+		EXPECT_EQ(Vector3(99.f, -1.f, 9.f), scene.GetChangedBoundsMin()[0]);
+		EXPECT_EQ(Vector3(101.f, 1.f, 11.f), scene.GetChangedBoundsMax()[0]);
+		EXPECT_EQ(Vector3(99.f, 2.f, 9.f), scene.GetChangedBoundsMin()[1]);
+		EXPECT_EQ(Vector3(101.f, 4.f, 11.f), scene.GetChangedBoundsMax()[1]);
+	}
+
+	class PlanesOnlyScene final : public Scene
+	{
+	public:
+		void Initialize() override
+		{
+			AddPlane({ 0.f, -1.f, 0.f }, { 0.f, 1.f, 0.f });
+		}
+	};
+
+	TEST(Scene, KeepsRevisionWithoutBoundedObjects) {
+		PlanesOnlyScene scene{};
+		scene.Initialize();
+		scene.UpdateAccelerationStructure();
+		const uint64_t builtRevision{ scene.GetRevision() };
+
+		scene.UpdateAccelerationStructure();
+		scene.UpdateAccelerationStructure();
+		EXPECT_EQ(builtRevision, scene.GetRevision());
+	}
+
+	TEST(Instrumentation, MergesThreadCountersAtFrameEnd) {
+		Instrumentation::EndFrame();
+
+		//Counts of a pool worker and of a thread that already exited both land in the frame totals
+		ThreadPool threadPool{ 2 };
+		threadPool.ParallelFor(8, [](uint32_t) { Instrumentation::Add(Instrumentation::Counter::TriangleTests, 2); });
+		std::thread{ [] { Instrumentation::Add(Instrumentation::Counter::TriangleTests, 3); } }.join();
+		Instrumentation::Add(Instrumentation::Counter::SphereTests);
+
+		Instrumentation::EndFrame();
+		const Instrumentation::FrameStatistics& frame = Instrumentation::GetLastFrame();
+		EXPECT_EQ(Instrumentation::IsEnabled ? 19u : 0u, frame.counters[size_t(Instrumentation::Counter::TriangleTests)]);
+		EXPECT_EQ(Instrumentation::IsEnabled ? 1u : 0u, frame.counters[size_t(Instrumentation::Counter::SphereTests)]);
+
+		//The next frame starts from zero
+		Instrumentation::EndFrame();
+		EXPECT_EQ(0u, Instrumentation::GetLastFrame().counters[size_t(Instrumentation::Counter::TriangleTests)]);
+	}
+
+	TEST(Trace, EventRingKeepsOrderAndDropsWhenFull) {
+		Trace::EventRing ring{};
+		for (uint32_t inx = 0; inx < Trace::EventRing::Capacity; ++inx)
+			EXPECT_TRUE(ring.Push({ "Event", int64_t(inx) }));
+		EXPECT_FALSE(ring.Push({ "Event", -1 }));
+		EXPECT_EQ(1u, ring.GetDroppedCount());
+
+		int64_t expected{ 0 };
+		ring.Drain([&](const Trace::TraceEvent& event) { EXPECT_EQ(expected++, event.argument); });
+		EXPECT_EQ(int64_t(Trace::EventRing::Capacity), expected);
+
+		//One thread pushing while this one drains, every event arrives once and in order
+		constexpr int64_t eventCount{ 200000 };
+		std::thread producer{ [&ring]
+			{
+				for (int64_t inx = 0; inx < eventCount;)
+				{
+					if (ring.Push({ "Event", inx }))
+						++inx;
+				}
+			} };
+
+		expected = 0;
+		while (expected < eventCount)
+			ring.Drain([&](const Trace::TraceEvent& event) { EXPECT_EQ(expected++, event.argument); });
+		producer.join();
+	}
+
+#if defined(DAE_PACKET_TRACING)
+	TEST(RayPacket, MatchesSingleRayMeshTest) {
+		std::mt19937 generator{ 7 };
+		std::uniform_real_distribution<float> position{ -3.f, 3.f };
+		std::uniform_real_distribution<float> offset{ -0.5f, 0.5f };
+
+		std::vector<Vector3> positions{};
+		std::vector<int> indices{};
+		for (int inx = 0; inx < 300; ++inx)
+		{
+			const Vector3 center{ position(generator), position(generator), position(generator) };
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				indices.push_back(static_cast<int>(positions.size()));
+				positions.push_back(center + Vector3{ offset(generator), offset(generator), offset(generator) });
+			}
+		}
+
+		TriangleMesh mesh{ positions, indices, TriangleCullMode::BackFaceCulling };
+		mesh.RotateY(0.7f);
+		mesh.Translate({ 0.5f, -0.25f, 1.f });
+		mesh.UpdateTransforms();
+
+		//Tilted vertex normals, so the normals only match when both paths report the same barycentrics
+		mesh.CalculateVertexNormals();
+		for (Vector3& vertexNormal : mesh.vertexNormals)
+		{
+			vertexNormal = (vertexNormal + Vector3{ offset(generator), offset(generator), offset(generator) }).Normalized();
+		}
+
+		for (int inx = 0; inx < 200; ++inx)
+		{
+			//Neighbouring rays like a 2x2 pixel block, one lane left out every other packet
+			const Vector3 origin{ position(generator), position(generator), -10.f };
+			const Vector3 direction{ 0.2f * offset(generator), 0.2f * offset(generator), 1.f };
+			const uint32_t laneMask{ inx % 2 == 0 ? AllPacketLanes : 0b1011u };
+
+			RayPacket packet{};
+			Ray rays[RayPacketWidth]{};
+			for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+			{
+				rays[lane] = Ray{ origin, (direction + Vector3{ 0.01f * (lane % 2), 0.01f * (lane / 2), 0.f }).Normalized() };
+				packet.SetRay(lane, rays[lane]);
+			}
+
+			HitRecord packetHits[RayPacketWidth]{};
+			const uint32_t hitMask{ GeometryUtils::HitTest_TriangleMeshPacket(mesh, packet, laneMask, packetHits) };
+
+			for (uint32_t lane = 0; lane < RayPacketWidth; ++lane)
+			{
+				HitRecord hit{};
+				const bool didHit{ (laneMask & (1u << lane)) && GeometryUtils::HitTest_TriangleMesh(mesh, rays[lane], hit) };
+
+				EXPECT_EQ(didHit, (hitMask & (1u << lane)) != 0);
+				if (!didHit)
+					continue;
+
+				EXPECT_EQ(hit.t, packetHits[lane].t);
+				EXPECT_EQ(hit.t, packet.max[lane]);
+				EXPECT_EQ(hit.normal.x, packetHits[lane].normal.x);
+				EXPECT_EQ(hit.normal.y, packetHits[lane].normal.y);
+				EXPECT_EQ(hit.normal.z, packetHits[lane].normal.z);
+			}
+		}
+	}
+#endif
+
+	TEST(ObjParser, PolygonsAndRelativeIndices) {
+		const std::filesystem::path objPath{ std::filesystem::temp_directory_path() / "dae_obj_parser_test.obj" };
+		{
+			std::ofstream obj{ objPath };
+			obj << "# quad with uvs and one normal, written with relative indices\r\n";
+			obj << "o Quad\nv 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n";
+			obj << "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvn 0 0 1\n";
+			obj << "f -4/-4/-1 -3/-3/-1 -2/-2/-1 -1/-1/-1\n";
+			//Same positions again without uvs, so every corner becomes a second vertex
+			obj << "f 1//1 2//1 3//1\n";
+			//Out of range, skipped
+			obj << "f 1 2 9\n";
+		}
+
+		ObjMesh mesh{};
+		ASSERT_TRUE(Utils::ParseOBJ(objPath.string(), mesh));
+		ObjMesh meshWithoutUVs{};
+		ASSERT_TRUE(Utils::ParseOBJ(objPath.string(), meshWithoutUVs, false));
+		std::filesystem::remove(objPath);
+
+		//Without vt the third face shares the quad's v/vn vertices
+		const std::vector<int> expectedIndicesWithoutUVs{ 0, 1, 2, 0, 2, 3, 0, 1, 2 };
+		EXPECT_EQ(expectedIndicesWithoutUVs, meshWithoutUVs.indices);
+		EXPECT_EQ(4u, meshWithoutUVs.positions.size());
+		EXPECT_EQ(4u, meshWithoutUVs.normals.size());
+		EXPECT_TRUE(meshWithoutUVs.texCoords.empty());
+
+		//The quad is fanned into two triangles, the third face adds one more
+		const std::vector<int> expectedIndices{ 0, 1, 2, 0, 2, 3, 4, 5, 6 };
+		EXPECT_EQ(expectedIndices, mesh.indices);
+		ASSERT_EQ(7u, mesh.positions.size());
+		ASSERT_EQ(7u, mesh.texCoords.size());
+		ASSERT_EQ(7u, mesh.normals.size());
+
+		EXPECT_EQ(1.f, mesh.positions[2].x);
+		EXPECT_EQ(1.f, mesh.positions[2].y);
+		EXPECT_EQ(1.f, mesh.texCoords[2].x);
+		EXPECT_EQ(1.f, mesh.texCoords[2].y);
+		EXPECT_EQ(1.f, mesh.normals[0].z);
+		EXPECT_EQ(mesh.positions[1].x, mesh.positions[5].x);
+		EXPECT_EQ(0.f, mesh.texCoords[5].x);
+	}
+
+	TEST(MeshCache, MatchesParsedOBJ) {
+		const std::filesystem::path objPath{ std::filesystem::temp_directory_path() / "dae_mesh_cache_test.obj" };
+		{
+			std::ofstream obj{ objPath };
+			obj << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0 0 1\n";
+			obj << "f 1 2 3\nf 1 3 4\nf 1 2 5\nf 2 3 5\n";
+		}
+		const std::string cachePath{ MeshCache::GetCachePath(objPath.string()) };
+		std::filesystem::remove(cachePath);
+
+		//First load parses and writes the cache, the second one only reads the cache
+		TriangleMesh parsedMesh{};
+		ASSERT_TRUE(MeshCache::LoadOBJ(objPath.string(), parsedMesh));
+		ASSERT_TRUE(std::filesystem::exists(cachePath));
+
+		TriangleMesh cachedMesh{};
+		ASSERT_TRUE(MeshCache::Load(cachePath, objPath.string(), cachedMesh));
+
+		ASSERT_EQ(parsedMesh.positions.size(), cachedMesh.positions.size());
+		EXPECT_EQ(parsedMesh.indices, cachedMesh.indices);
+		EXPECT_EQ(parsedMesh.normals.size(), cachedMesh.normals.size());
+		ASSERT_EQ(parsedMesh.vertexNormals.size(), cachedMesh.vertexNormals.size());
+		for (size_t inx = 0; inx < parsedMesh.vertexNormals.size(); ++inx)
+		{
+			EXPECT_EQ(parsedMesh.vertexNormals[inx].x, cachedMesh.vertexNormals[inx].x);
+		}
+		EXPECT_EQ(parsedMesh.bvh.nodes.size(), cachedMesh.bvh.nodes.size());
+		EXPECT_EQ(parsedMesh.bvh.primitiveIndices, cachedMesh.bvh.primitiveIndices);
+		ASSERT_EQ(parsedMesh.triangleRecords.size(), cachedMesh.triangleRecords.size());
+		for (size_t inx = 0; inx < parsedMesh.triangleRecords.size(); ++inx)
+		{
+			EXPECT_EQ(parsedMesh.triangleRecords[inx].triangleIndex, cachedMesh.triangleRecords[inx].triangleIndex);
+		}
+
+		//A cache that doesn't match its source anymore is ignored
+		{
+			std::ofstream obj{ objPath, std::ios::app };
+			obj << "f 3 4 5\n";
+		}
+		TriangleMesh staleMesh{};
+		EXPECT_FALSE(MeshCache::Load(cachePath, objPath.string(), staleMesh));
+
+		std::filesystem::remove(cachePath);
+		std::filesystem::remove(objPath);
+	}
+
 	int main(int argc, char** argv) {
 		::testing::InitGoogleTest(&argc, argv);
 		return RUN_ALL_TESTS();